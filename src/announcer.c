@@ -0,0 +1,139 @@
+// announcer.c
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "announcer.h"
+#include "cache.h"
+#include "protocol.h"
+#include "utils.h"
+
+/**
+ * Creates the socket the announcements are sent from and builds the
+ * responses for the current minute. Nothing is sent until the announcer
+ * is started.
+ *
+ * @param announcer The announcer to initialise.
+ * @param group The multicast group and port to announce to.
+ * @param interface The address of the interface to send from, or INADDR_ANY for the default route.
+ * @param ttl The number of routers the announcements may cross.
+ * */
+void announcerInit(struct announcer* announcer, struct sockaddr_in* group, struct in_addr interface, unsigned int ttl)
+{
+    unsigned char multicast_ttl = ttl;
+
+    memset(announcer, 0, sizeof(struct announcer));
+    announcer->group = *group;
+
+    announcer->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+    if (announcer->fd < 0) {
+        error("could not create the announcement socket", 2);
+    }
+
+    if (setsockopt(announcer->fd, IPPROTO_IP, IP_MULTICAST_TTL, &multicast_ttl, sizeof(multicast_ttl)) < 0) {
+        error("could not set the announcement time to live", 2);
+    }
+
+    if (setsockopt(announcer->fd, IPPROTO_IP, IP_MULTICAST_IF, &interface, sizeof(interface)) < 0) {
+        error("could not send announcements from that interface", 2);
+    }
+
+    announcer->cache = malloc(sizeof(struct response_cache));
+
+    if (announcer->cache == NULL) {
+        error("could not allocate the announcement cache", 3);
+    }
+
+    cacheInit(announcer->cache);
+}
+
+/**
+ * Starts the thread that sends the announcements.
+ *
+ * @param announcer The announcer to start.
+ * */
+void announcerStart(struct announcer* announcer)
+{
+    if (pthread_create(&announcer->thread, NULL, runAnnouncer, announcer) != 0) {
+        error("could not start the announcer", 3);
+    }
+}
+
+/**
+ * Announces the current minute straight away, so that listeners that are
+ * already waiting do not have to wait for the next one, then announces
+ * each minute as soon as the cache timer rebuilds it.
+ *
+ * @param arg The announcer.
+ * @return Never returns, the thread ends with the process.
+ * */
+void* runAnnouncer(void* arg)
+{
+    struct announcer* announcer = arg;
+    struct pollfd timer_poll = { .fd = announcer->cache->timer_fd, .events = POLLIN };
+
+    announce(announcer);
+
+    while (true) {
+        if (poll(&timer_poll, 1, -1) < 0) {
+            continue;
+        }
+
+        // the sends are copied before they return, so nothing is ever pinned
+        // and every rebuild happens straight away
+        cacheHandleTimer(announcer->cache);
+        announce(announcer);
+    }
+
+    return NULL;
+}
+
+/**
+ * Sends the cached response to every request type in every language to
+ * the group, one datagram each. They are ordinary DT Responses, so a
+ * listener decodes them exactly as it would an answer to its own request.
+ *
+ * @param announcer The announcer.
+ * */
+void announce(struct announcer* announcer)
+{
+    for (uint16_t lang = LANG_ENG; lang <= LANG_GER; lang++) {
+        for (uint16_t type = REQ_DATE; type <= REQ_TIME; type++) {
+
+            struct iovec segments[CACHE_SEGMENTS];
+            struct msghdr msg = {0};
+
+            cacheLookup(announcer->cache, type, lang, segments);
+
+            msg.msg_name = &announcer->group;
+            msg.msg_namelen = sizeof(announcer->group);
+            msg.msg_iov = segments;
+            msg.msg_iovlen = CACHE_SEGMENTS;
+
+            if (sendmsg(announcer->fd, &msg, 0) < 0) {
+                __atomic_store_n(&announcer->failures, announcer->failures + 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    __atomic_store_n(&announcer->announcements, announcer->announcements + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Closes the socket and the cache timer.
+ *
+ * @param announcer The announcer.
+ * */
+void announcerClose(struct announcer* announcer)
+{
+    close(announcer->fd);
+    cacheClose(announcer->cache);
+}
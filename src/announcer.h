@@ -0,0 +1,41 @@
+// announcer.h
+
+#ifndef ANNOUNCER_H
+#define ANNOUNCER_H
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "cache.h"
+
+// the default number of routers an announcement may cross, 1 keeps it on the local network
+#define DEFAULT_ANNOUNCE_TTL 1
+
+// the largest time to live that may be given
+#define MAX_ANNOUNCE_TTL 255
+
+// Sends every response to a multicast group at the start of each minute
+struct announcer {
+
+    // the socket the announcements are sent from and where they are sent
+    int fd;
+    struct sockaddr_in group;
+
+    // the responses, rebuilt by the announcer's own minute timer
+    struct response_cache* cache;
+
+    pthread_t thread;
+
+    // the minutes announced and the datagrams that could not be sent
+    uint64_t announcements;
+    uint64_t failures;
+};
+
+void announcerInit(struct announcer* announcer, struct sockaddr_in* group, struct in_addr interface, unsigned int ttl);
+void announcerStart(struct announcer* announcer);
+void* runAnnouncer(void* arg);
+void announce(struct announcer* announcer);
+void announcerClose(struct announcer* announcer);
+
+#endif
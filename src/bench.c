@@ -0,0 +1,443 @@
+// bench.c
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "clock.h"
+#include "histogram.h"
+#include "protocol.h"
+#include "target.h"
+#include "utils.h"
+
+// A socket with at most one request in flight
+struct bench_slot {
+    int fd;
+    bool busy;
+
+    // true while the server's receive queue is full, which only a Unix
+    // socket reports, until the socket polls writable again
+    bool blocked;
+
+    // when the request was due to be sent, in nanoseconds
+    uint64_t sent_at;
+};
+
+/**
+ * Reads the bench options followed by <time|date> and either <ip address>
+ * <port> or unix:<path>.
+ * 
+ * @param argc The number of arguments, starting from "bench".
+ * @param argv The arguments, starting from "bench".
+ * @param options The options to populate.
+ * @return True if all of the options were valid.
+ * */
+bool readBenchOptions(int argc, char** argv, struct bench_options* options)
+{
+    static struct option long_options[] = {
+        { "concurrency", required_argument, NULL, 'c' },
+        { "duration", required_argument, NULL, 'd' },
+        { "requests", required_argument, NULL, 'n' },
+        { "rate", required_argument, NULL, 'r' },
+        { "timeout", required_argument, NULL, 't' },
+        { "compare", required_argument, NULL, 'p' },
+        { "compact", no_argument, NULL, 'k' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+
+    // the flag is added to the request type once it has been read
+    bool compact = false;
+
+    options->concurrency = DEFAULT_BENCH_CONCURRENCY;
+    options->duration = DEFAULT_BENCH_DURATION;
+    options->requests = 0;
+    options->rate = 0;
+    options->timeout = DEFAULT_BENCH_TIMEOUT;
+    options->compare_count = 0;
+
+    while ((opt = getopt_long(argc, argv, "+c:d:n:r:t:p:k", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                options->concurrency = atoi(optarg);
+                break;
+            case 'd':
+                options->duration = atof(optarg);
+                break;
+            case 'n':
+                options->requests = strtoull(optarg, NULL, 10);
+                break;
+            case 'r':
+                options->rate = atof(optarg);
+                break;
+            case 't':
+                options->timeout = atof(optarg);
+                break;
+            case 'p':
+                if (options->compare_count == MAX_BENCH_TARGETS - 1) {
+                    return false;
+                }
+                options->compare_ports[options->compare_count++] = optarg;
+                break;
+            case 'k':
+                compact = true;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    if (options->concurrency < 1 || options->concurrency > MAX_BENCH_CONCURRENCY ||
+        options->duration <= 0 || options->rate < 0 || options->timeout <= 0) {
+        return false;
+    }
+
+    // a Unix socket takes the place of both the address and the port
+    if (!(argc - optind == 3 || (argc - optind == 2 && targetIsUnix(argv[optind + 1])))) {
+        return false;
+    }
+
+    if (strcmp(argv[optind], "date") == 0) {
+        options->request_type = REQ_DATE;
+    } else if (strcmp(argv[optind], "time") == 0) {
+        options->request_type = REQ_TIME;
+    } else {
+        return false;
+    }
+
+    if (compact) {
+        options->request_type |= REQ_FLAG_COMPACT;
+    }
+
+    options->host = argv[optind + 1];
+    options->port = argc - optind == 3 ? argv[optind + 2] : NULL;
+
+    return true;
+}
+
+/**
+ * Creates a non-blocking socket connected to the server.
+ * 
+ * @param address The address of the server, or its Unix socket.
+ * @return The socket descriptor.
+ * */
+int openSlot(struct target* address)
+{
+    int fd = targetOpen(address, SOCK_NONBLOCK);
+
+    if (fd < 0) {
+        error("could not connect", 1);
+    }
+
+    return fd;
+}
+
+/**
+ * Sends a load of requests to a server and measures the responses.
+ * 
+ * In a closed loop (no rate) every slot sends its next request as soon
+ * as the previous one is answered. In an open loop requests are due at
+ * fixed intervals whether or not the server keeps up, and latency is
+ * measured from when a request was due so that a slow server is not
+ * hidden by the client waiting for it.
+ * 
+ * @param options The options for the test.
+ * @param result Where the outcome of the test is to be stored.
+ * */
+void benchRun(struct bench_options* options, struct bench_result* result)
+{
+    struct target address;
+
+    struct bench_slot* slots = calloc(options->concurrency, sizeof(struct bench_slot));
+    struct pollfd* fds = calloc(options->concurrency, sizeof(struct pollfd));
+
+    uint8_t req[REQ_PKT_LEN];
+    uint8_t buffer[RES_PKT_LEN];
+
+    uint64_t timeout = options->timeout * 1e9;
+    uint64_t interval = options->rate > 0 ? 1e9 / options->rate : 0;
+    uint64_t start, end, next_send;
+
+    // the number of requests currently in flight, and slots waiting for room to send
+    unsigned int busy = 0, blocked = 0;
+
+    if (slots == NULL || fds == NULL) {
+        error("could not allocate the slots", 3);
+    }
+
+    memset(result, 0, sizeof(struct bench_result));
+    histogramInit(&result->latency);
+
+    if (!targetRead(options->host, options->port, &address)) {
+        error("bad hostname, ip address or unix socket path", 1);
+    }
+
+    if (dtReq(req, REQ_PKT_LEN, options->request_type) == 0) {
+        error("could not create packet", 3);
+    }
+
+    for (unsigned int i = 0; i < options->concurrency; i++) {
+        slots[i].fd = openSlot(&address);
+        fds[i].fd = slots[i].fd;
+        fds[i].events = POLLIN;
+    }
+
+    start = clockMonotonicNanos();
+    end = start + (uint64_t)(options->duration * 1e9);
+    next_send = start;
+
+    while (true) {
+
+        uint64_t now = clockMonotonicNanos();
+
+        // true while more requests should be sent
+        bool sending = options->requests > 0 ?
+            result->sent < options->requests : now < end;
+
+        // the next time something needs doing, which bounds the wait
+        uint64_t wake = now + timeout;
+
+        if (!sending && busy == 0) {
+            break;
+        }
+
+        // hand out requests to the free slots
+        for (unsigned int i = 0; sending && i < options->concurrency; i++) {
+
+            if (slots[i].busy || slots[i].blocked) {
+                continue;
+            }
+
+            // an open loop only sends when the next request is due
+            if (interval > 0 && next_send > now) {
+                break;
+            }
+
+            slots[i].sent_at = interval > 0 ? next_send : now;
+            next_send += interval;
+
+            if (send(slots[i].fd, req, REQ_PKT_LEN, 0) >= 0) {
+                slots[i].busy = true;
+                busy++;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+
+                // a Unix socket with a full queue holds the sender back rather than
+                // dropping the request, so it is sent once there is room, still due when it was
+                slots[i].blocked = true;
+                fds[i].events = POLLOUT;
+                next_send -= interval;
+                blocked++;
+                result->blocked++;
+                continue;
+            } else {
+                result->lost++;
+            }
+
+            result->sent++;
+
+            sending = options->requests > 0 ?
+                result->sent < options->requests : now < end;
+        }
+
+        // every slot is busy but a request is already due
+        if (sending && interval > 0 && next_send <= now && busy + blocked == options->concurrency) {
+            result->backlogged++;
+        }
+
+        // give up on requests that have waited too long, a fresh socket
+        // stops a late response from being mistaken for the next one
+        for (unsigned int i = 0; i < options->concurrency; i++) {
+
+            if (!slots[i].busy) {
+                continue;
+            }
+
+            if (now - slots[i].sent_at >= timeout) {
+                close(slots[i].fd);
+                slots[i].fd = openSlot(&address);
+                fds[i].fd = slots[i].fd;
+                slots[i].busy = false;
+                busy--;
+                result->lost++;
+            } else if (slots[i].sent_at + timeout < wake) {
+                wake = slots[i].sent_at + timeout;
+            }
+        }
+
+        if (sending && interval > 0 && next_send < wake) {
+            wake = next_send;
+        }
+
+        struct timespec wait = { 0, 0 };
+
+        if (wake > now && !(sending && interval == 0 && busy + blocked < options->concurrency)) {
+            wait.tv_sec = (wake - now) / 1000000000;
+            wait.tv_nsec = (wake - now) % 1000000000;
+        }
+
+        if (ppoll(fds, options->concurrency, &wait, NULL) < 0 && errno != EINTR) {
+            error("could not poll", 4);
+        }
+
+        now = clockMonotonicNanos();
+
+        // collect the responses
+        for (unsigned int i = 0; i < options->concurrency; i++) {
+
+            // there is room in the server's queue again
+            if (slots[i].blocked && (fds[i].revents & (POLLOUT | POLLERR))) {
+                slots[i].blocked = false;
+                fds[i].events = POLLIN;
+                blocked--;
+            }
+
+            if (!(fds[i].revents & POLLIN)) {
+                continue;
+            }
+
+            ssize_t n = recv(slots[i].fd, buffer, RES_PKT_LEN, 0);
+
+            if (n < 0 || !slots[i].busy) {
+                continue;
+            }
+
+            slots[i].busy = false;
+            busy--;
+
+            if (!dtResValid(buffer, n)) {
+                result->invalid++;
+                continue;
+            }
+
+            result->received++;
+            result->bytes += n;
+            histogramRecord(&result->latency, now - slots[i].sent_at);
+        }
+    }
+
+    result->elapsed = (clockMonotonicNanos() - start) / 1e9;
+
+    for (unsigned int i = 0; i < options->concurrency; i++) {
+        close(slots[i].fd);
+    }
+
+    free(slots);
+    free(fds);
+}
+
+/**
+ * Prints the throughput, loss and latency distribution of a test.
+ * 
+ * @param options The options the test was run with.
+ * @param result The outcome of the test.
+ * */
+void benchPrint(struct bench_options* options, struct bench_result* result)
+{
+    struct histogram* latency = &result->latency;
+
+    printf("Target:\t\t%s%s%s (%s%s)\n", options->host, options->port != NULL ? ":" : "",
+        options->port != NULL ? options->port : "",
+        getRequestTypeString(options->request_type & ~REQ_FLAG_COMPACT),
+        options->request_type & REQ_FLAG_COMPACT ? ", compact" : "");
+
+    if (options->rate > 0) {
+        printf("Mode:\t\topen loop at %.0f requests/s, up to %u in flight\n",
+            options->rate, options->concurrency);
+    } else {
+        printf("Mode:\t\tclosed loop, %u in flight\n", options->concurrency);
+    }
+
+    printf("Duration:\t%.3f s\n", result->elapsed);
+    printf("Sent:\t\t%lu\n", result->sent);
+    printf("Received:\t%lu\n", result->received);
+    printf("Lost:\t\t%lu (%.3f%%)\n", result->lost,
+        result->sent > 0 ? 100.0 * result->lost / result->sent : 0.0);
+    printf("Invalid:\t%lu\n", result->invalid);
+
+    if (result->blocked > 0) {
+        printf("Held back:\t%lu sends waited for room in the server's queue\n", result->blocked);
+    }
+
+    if (options->rate > 0) {
+        printf("Backlogged:\t%lu\n", result->backlogged);
+    }
+
+    printf("Throughput:\t%.0f responses/s, %.0f bytes/s of responses\n",
+        result->received / result->elapsed, result->bytes / result->elapsed);
+
+    if (latency->count == 0) {
+        return;
+    }
+
+    printf("Latency (us):\tmin %.1f, mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+        latency->min / 1e3, (double) latency->sum / latency->count / 1e3,
+        histogramPercentile(latency, 50) / 1e3, histogramPercentile(latency, 90) / 1e3,
+        histogramPercentile(latency, 99) / 1e3, histogramPercentile(latency, 99.9) / 1e3,
+        latency->max / 1e3);
+
+    printf("\n");
+    histogramPrint(latency, stdout);
+}
+
+/**
+ * Prints the headline figures of the same test run against several
+ * ports or Unix sockets side by side, one column per target.
+ * 
+ * @param targets The port or unix: path of each target that was tested.
+ * @param results The outcome of the test against each target.
+ * @param count The number of targets.
+ * */
+void benchCompare(char** targets, struct bench_result* results, unsigned int count)
+{
+    // the percentiles compared, in the same order as the rows
+    static const double percentiles[] = { 50, 90, 99, 99.9 };
+    static const char* percentile_names[] = { "p50 (us)", "p90 (us)", "p99 (us)", "p99.9 (us)" };
+
+    // every column is wide enough for the longest path
+    int width = 14;
+
+    for (unsigned int t = 0; t < count; t++) {
+        if ((int) strlen(targets[t]) + 2 > width) {
+            width = strlen(targets[t]) + 2;
+        }
+    }
+
+    printf("%-16s", "Target");
+    for (unsigned int t = 0; t < count; t++) {
+        printf("%*s", width, targets[t]);
+    }
+
+    printf("\n%-16s", "Throughput (/s)");
+    for (unsigned int t = 0; t < count; t++) {
+        printf("%*.0f", width, results[t].received / results[t].elapsed);
+    }
+
+    printf("\n%-16s", "Lost (%)");
+    for (unsigned int t = 0; t < count; t++) {
+        printf("%*.3f", width, results[t].sent > 0 ? 100.0 * results[t].lost / results[t].sent : 0.0);
+    }
+
+    for (unsigned int p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]); p++) {
+        printf("\n%-16s", percentile_names[p]);
+        for (unsigned int t = 0; t < count; t++) {
+            printf("%*.1f", width, histogramPercentile(&results[t].latency, percentiles[p]) / 1e3);
+        }
+    }
+
+    printf("\n%-16s", "max (us)");
+    for (unsigned int t = 0; t < count; t++) {
+        printf("%*.1f", width, results[t].latency.max / 1e3);
+    }
+
+    printf("\n");
+}
@@ -0,0 +1,81 @@
+// bench.h
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "histogram.h"
+
+// the defaults for the bench mode of the client
+#define DEFAULT_BENCH_CONCURRENCY 16
+#define DEFAULT_BENCH_DURATION 5.0
+#define DEFAULT_BENCH_TIMEOUT 1.0
+
+// the largest number of requests that may be in flight at once
+#define MAX_BENCH_CONCURRENCY 4096
+
+// the most ports that may be tested one after another and compared
+#define MAX_BENCH_TARGETS 8
+
+// Options for a load test against a single server port
+struct bench_options {
+
+    // the type of request to send, REQ_DATE or REQ_TIME, with
+    // REQ_FLAG_COMPACT set if the responses should have no text
+    uint16_t request_type;
+
+    // where to send the requests, the host is unix: and a path and the port
+    // NULL for a Unix socket
+    char* host;
+    char* port;
+
+    // more ports to run the same test against, e.g. a server using another
+    // backend, or unix: paths to compare a Unix socket with a port
+    char* compare_ports[MAX_BENCH_TARGETS - 1];
+    unsigned int compare_count;
+
+    // the number of requests kept in flight, each on its own socket
+    unsigned int concurrency;
+
+    // stop after this many seconds, or after this many requests if it is non-zero
+    double duration;
+    uint64_t requests;
+
+    // the target rate in requests per second for an open loop, or 0 for a closed loop
+    double rate;
+
+    // how long to wait for a response before counting the request as lost
+    double timeout;
+};
+
+// The outcome of a load test
+struct bench_result {
+    uint64_t sent;
+    uint64_t received;
+    uint64_t lost;
+    uint64_t invalid;
+
+    // the bytes of every valid response
+    uint64_t bytes;
+
+    // open loop sends that had to wait for a free slot
+    uint64_t backlogged;
+
+    // sends that had to wait because the server's queue was full
+    uint64_t blocked;
+
+    // the wall time of the whole test in seconds
+    double elapsed;
+
+    // the round trip time of every valid response, in nanoseconds
+    struct histogram latency;
+};
+
+bool readBenchOptions(int argc, char** argv, struct bench_options* options);
+void benchRun(struct bench_options* options, struct bench_result* result);
+void benchPrint(struct bench_options* options, struct bench_result* result);
+void benchCompare(char** targets, struct bench_result* results, unsigned int count);
+
+#endif
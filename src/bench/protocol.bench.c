@@ -0,0 +1,290 @@
+// protocol.bench.c
+
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../clock.h"
+#include "../protocol.h"
+#include "../utils.h"
+
+// the defaults for how long each benchmark is measured
+#define DEFAULT_REPETITIONS 10
+#define DEFAULT_MIN_TIME_MS 20
+
+// the output formats
+#define FORMAT_TEXT 0
+#define FORMAT_CSV 1
+#define FORMAT_JSON 2
+
+// A single function measured with one language and request type
+struct bench_case {
+    char* function;
+    uint16_t langCode;
+    uint16_t reqType;
+
+    // runs the function the given number of times
+    void (*run)(struct bench_case* c, uint64_t iterations);
+
+    // a prepared packet for the functions that read one
+    uint8_t pkt[RES_PKT_LEN];
+    size_t pktLen;
+};
+
+// the results are summed in here so that the calls cannot be optimised away
+volatile uint64_t sink;
+
+void runDtReq(struct bench_case* c, uint64_t iterations)
+{
+    uint8_t pkt[REQ_PKT_LEN];
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        total += dtReq(pkt, REQ_PKT_LEN, c->reqType);
+    }
+    sink += total;
+}
+
+void runDtReqValid(struct bench_case* c, uint64_t iterations)
+{
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        total += dtReqValid(c->pkt, c->pktLen);
+    }
+    sink += total;
+}
+
+void runDtRes(struct bench_case* c, uint64_t iterations)
+{
+    uint8_t pkt[RES_PKT_LEN];
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        total += dtRes(pkt, RES_PKT_LEN, c->reqType, c->langCode, 2018, 9, 21, 13, 37);
+    }
+    sink += total;
+}
+
+void runDtResNow(struct bench_case* c, uint64_t iterations)
+{
+    uint8_t pkt[RES_PKT_LEN];
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        total += dtResNow(pkt, RES_PKT_LEN, c->reqType, c->langCode);
+    }
+    sink += total;
+}
+
+void runDtResValid(struct bench_case* c, uint64_t iterations)
+{
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        total += dtResValid(c->pkt, c->pktLen);
+    }
+    sink += total;
+}
+
+void runDtResText(struct bench_case* c, uint64_t iterations)
+{
+    char text[RES_TEXT_LEN + 1];
+    size_t textLen;
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        dtResText(c->pkt, c->pktLen, text, &textLen);
+        total += textLen;
+    }
+    sink += total;
+}
+
+void runDtPktLength(struct bench_case* c, uint64_t iterations)
+{
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        total += dtPktLength(c->pkt);
+    }
+    sink += total;
+}
+
+/**
+ * Measures a case. The number of iterations is doubled until one
+ * repetition takes at least min_time, then a warm-up repetition is
+ * thrown away and the rest are timed.
+ * 
+ * @param c The case.
+ * @param repetitions The number of timed repetitions.
+ * @param min_time The shortest time a repetition may take, in nanoseconds.
+ * @param samples Where the ns/op of each repetition is to be stored.
+ * @return The number of iterations in each repetition.
+ * */
+uint64_t measure(struct bench_case* c, unsigned int repetitions, uint64_t min_time, double samples[])
+{
+    uint64_t iterations = 1;
+
+    // calibrate, which also warms up the caches and branch predictors
+    while (true) {
+        uint64_t start = clockMonotonicNanos();
+        c->run(c, iterations);
+        if (clockMonotonicNanos() - start >= min_time) {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    // one more untimed warm-up at the final size
+    c->run(c, iterations);
+
+    for (unsigned int r = 0; r < repetitions; r++) {
+        uint64_t start = clockMonotonicNanos();
+        c->run(c, iterations);
+        samples[r] = (double)(clockMonotonicNanos() - start) / iterations;
+    }
+
+    return iterations;
+}
+
+/**
+ * Usage: protocol.bench [--csv | --json] [--repetitions <n>] [--min-time <ms>] [--filter <function>]
+ * */
+int main(int argc, char** argv)
+{
+    static struct option long_options[] = {
+        { "csv", no_argument, NULL, 'c' },
+        { "json", no_argument, NULL, 'j' },
+        { "repetitions", required_argument, NULL, 'r' },
+        { "min-time", required_argument, NULL, 'm' },
+        { "filter", required_argument, NULL, 'f' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    // the functions that are measured and how to run them
+    struct {
+        char* function;
+        void (*run)(struct bench_case* c, uint64_t iterations);
+    } functions[] = {
+        { "dtReq", runDtReq },
+        { "dtReqValid", runDtReqValid },
+        { "dtRes", runDtRes },
+        { "dtResNow", runDtResNow },
+        { "dtResValid", runDtResValid },
+        { "dtResText", runDtResText },
+        { "dtPktLength", runDtPktLength }
+    };
+
+    uint16_t langCodes[3] = { LANG_ENG, LANG_MAO, LANG_GER };
+    uint16_t reqTypes[2] = { REQ_DATE, REQ_TIME };
+
+    int format = FORMAT_TEXT;
+    unsigned int repetitions = DEFAULT_REPETITIONS;
+    uint64_t min_time = DEFAULT_MIN_TIME_MS * 1000000ULL;
+    char* filter = NULL;
+    bool first = true;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "cjr:m:f:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c': format = FORMAT_CSV; break;
+            case 'j': format = FORMAT_JSON; break;
+            case 'r': repetitions = atoi(optarg); break;
+            case 'm': min_time = atof(optarg) * 1000000; break;
+            case 'f': filter = optarg; break;
+            default:
+                error("usage: protocol.bench [--csv | --json] [--repetitions <n>] [--min-time <ms>] [--filter <function>]", 1);
+        }
+    }
+
+    if (repetitions < 2) {
+        error("at least 2 repetitions are needed to measure the variance", 1);
+    }
+
+    double* samples = calloc(repetitions, sizeof(double));
+
+    if (samples == NULL) {
+        error("could not allocate the samples", 3);
+    }
+
+    if (format == FORMAT_TEXT) {
+        printf("%-12s %-14s %-5s %10s %10s %10s %8s %14s\n",
+            "function", "language", "type", "ns/op", "min ns/op", "stddev", "cv %", "ops/sec");
+    } else if (format == FORMAT_CSV) {
+        printf("function,language,type,iterations,repetitions,mean_ns,min_ns,stddev_ns,ops_per_sec\n");
+    } else {
+        printf("[\n");
+    }
+
+    for (int f = 0; f < sizeof(functions) / sizeof(functions[0]); f++) {
+
+        if (filter != NULL && strcmp(filter, functions[f].function) != 0) {
+            continue;
+        }
+
+        for (int l = 0; l < 3; l++) {
+            for (int t = 0; t < 2; t++) {
+
+                struct bench_case c = {
+                    .function = functions[f].function,
+                    .langCode = langCodes[l],
+                    .reqType = reqTypes[t],
+                    .run = functions[f].run
+                };
+
+                // the request and response readers get a real packet of the right kind
+                if (strncmp(c.function, "dtReq", 5) == 0) {
+                    c.pktLen = dtReq(c.pkt, REQ_PKT_LEN, c.reqType);
+                } else {
+                    c.pktLen = dtRes(c.pkt, RES_PKT_LEN, c.reqType, c.langCode, 2018, 9, 21, 13, 37);
+                }
+
+                uint64_t iterations = measure(&c, repetitions, min_time, samples);
+
+                double mean = 0, min = samples[0], variance = 0;
+
+                for (unsigned int r = 0; r < repetitions; r++) {
+                    mean += samples[r];
+                    if (samples[r] < min) {
+                        min = samples[r];
+                    }
+                }
+                mean /= repetitions;
+
+                for (unsigned int r = 0; r < repetitions; r++) {
+                    variance += (samples[r] - mean) * (samples[r] - mean);
+                }
+                variance /= repetitions - 1;
+
+                double stddev = sqrt(variance);
+                char* language = getLangName(c.langCode);
+                char* type = getRequestTypeString(c.reqType);
+
+                // the macron in Maori throws out the column widths, and the
+                // machine readable formats use the language code instead
+                if (format == FORMAT_TEXT) {
+                    printf("%-12s %-14s %-5s %10.2f %10.2f %10.2f %8.2f %14.0f\n",
+                        c.function, c.langCode == LANG_MAO ? "Te Reo Maori" : language, type,
+                        mean, min, stddev, 100 * stddev / mean, 1e9 / mean);
+                } else if (format == FORMAT_CSV) {
+                    printf("%s,%u,%s,%lu,%u,%.3f,%.3f,%.3f,%.0f\n", c.function, c.langCode, type,
+                        iterations, repetitions, mean, min, stddev, 1e9 / mean);
+                } else {
+                    printf("%s  {\"function\": \"%s\", \"language\": %u, \"type\": \"%s\", "
+                        "\"iterations\": %lu, \"repetitions\": %u, \"mean_ns\": %.3f, "
+                        "\"min_ns\": %.3f, \"stddev_ns\": %.3f, \"ops_per_sec\": %.0f}",
+                        first ? "" : ",\n", c.function, c.langCode, type, iterations,
+                        repetitions, mean, min, stddev, 1e9 / mean);
+                }
+
+                first = false;
+                fflush(stdout);
+            }
+        }
+    }
+
+    if (format == FORMAT_JSON) {
+        printf("\n]\n");
+    }
+
+    free(samples);
+
+    return 0;
+}
@@ -0,0 +1,242 @@
+// cache.c
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "clock.h"
+#include "protocol.h"
+#include "utils.h"
+
+/**
+ * Creates the minute timer and builds the responses for the current minute.
+ * 
+ * @param cache The cache to initialise.
+ * */
+void cacheInit(struct response_cache* cache)
+{
+    memset(cache, 0, sizeof(struct response_cache));
+
+    cache->timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (cache->timer_fd < 0) {
+        error("could not create the cache timer", 2);
+    }
+
+    for (unsigned int count = 1; count <= BATCH_MAX_QUERIES; count++) {
+        dtBatchResHeader(cache->batch_headers[count], BATCH_HEADER_LEN, count);
+    }
+
+    cacheRebuild(cache);
+}
+
+/**
+ * Rebuilds all six responses from the current time into a generation that
+ * nothing is still sending from, then arms the timer for the start of the
+ * next minute. If every other generation is still pinned the rebuild is
+ * tried again a second later.
+ * 
+ * @param cache The cache to rebuild.
+ * */
+void cacheRebuild(struct response_cache* cache)
+{
+    struct tm now;
+    struct timespec raw_time;
+
+    // the timer is absolute so that it is not skewed by how long the rebuild takes
+    struct itimerspec next_minute = {0};
+
+    // the generation to build into, the first build goes straight into the current one
+    unsigned int next = cache->current;
+    struct cache_generation* generation;
+
+    // each response is encoded whole and then split into its segments
+    uint8_t packet[RES_PKT_LEN];
+
+    // time() may lag CLOCK_REALTIME by a tick, which would rearm the timer in the past
+    clock_gettime(CLOCK_REALTIME, &raw_time);
+    clockLocalTime(raw_time.tv_sec, &now);
+
+    if (cache->rebuilds > 0) {
+        do {
+            next = (next + 1) % CACHE_GENERATIONS;
+        } while (next != cache->current && cache->generations[next].pins > 0);
+    }
+
+    // keep sending the old minute rather than change a segment in flight
+    if (cache->rebuilds > 0 && next == cache->current) {
+        cache->postponed++;
+        next_minute.it_value.tv_sec = raw_time.tv_sec + 1;
+
+        if (timerfd_settime(cache->timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+            &next_minute, NULL) < 0) {
+            error("could not arm the cache timer", 2);
+        }
+
+        return;
+    }
+
+    generation = &cache->generations[next];
+
+    // encode every language and request type for this minute
+    for (int lang = 0; lang < CACHE_LANGS; lang++) {
+        for (int type = 0; type < CACHE_REQ_TYPES; type++) {
+            size_t length = dtRes(packet, RES_PKT_LEN,
+                type + 1, lang + 1, now.tm_year + 1900, now.tm_mon + 1,
+                now.tm_mday, now.tm_hour, now.tm_min);
+
+            memcpy(generation->headers[lang][type], packet, RES_HEADER_LEN);
+            memcpy(generation->texts[lang][type], packet + RES_HEADER_LEN, length - RES_HEADER_LEN);
+            generation->text_lengths[lang][type] = length - RES_HEADER_LEN;
+        }
+
+        dtResCompact(generation->compact[lang], RES_HEADER_LEN, lang + 1, now.tm_year + 1900,
+            now.tm_mon + 1, now.tm_mday, now.tm_hour, now.tm_min);
+    }
+
+    // publish the new minute, the old one stays untouched until its pins are gone
+    cache->current = next;
+    cache->rebuilds++;
+
+    // fire again at the top of the next minute, or as soon as the clock is set
+    next_minute.it_value.tv_sec = raw_time.tv_sec - now.tm_sec + 60;
+
+    if (timerfd_settime(cache->timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+        &next_minute, NULL) < 0) {
+        error("could not arm the cache timer", 2);
+    }
+}
+
+/**
+ * Called when the timer descriptor is readable. Acknowledges the
+ * expiry and rebuilds the responses.
+ * 
+ * @param cache The cache whose timer fired.
+ * */
+void cacheHandleTimer(struct response_cache* cache)
+{
+    uint64_t expirations;
+
+    // ECANCELED means the wall clock was set, which also calls for a rebuild
+    if (read(cache->timer_fd, &expirations, sizeof(expirations)) < 0 &&
+        errno != ECANCELED) {
+        return;
+    }
+
+    cacheRebuild(cache);
+}
+
+/**
+ * Points a gather list at the header and text segments of the cached
+ * response to a request. Nothing is copied.
+ * No checking is done beforehand, reqType and langCode must be valid.
+ * 
+ * @param cache The cache.
+ * @param reqType The type of request. Must be either REQ_DATE or REQ_TIME.
+ * @param langCode The language to respond in.
+ * @param segments Where the header and text segments are to be stored. They
+ *                 stay valid until the next rebuild, or while pinned.
+ * @return The length of the whole response.
+ * */
+size_t cacheLookup(struct response_cache* cache, uint16_t reqType, uint16_t langCode, struct iovec segments[CACHE_SEGMENTS])
+{
+    struct cache_generation* generation = &cache->generations[cache->current];
+
+    cache->hits++;
+
+    segments[0].iov_base = generation->headers[langCode - 1][reqType - 1];
+    segments[0].iov_len = RES_HEADER_LEN;
+    segments[1].iov_base = generation->texts[langCode - 1][reqType - 1];
+    segments[1].iov_len = generation->text_lengths[langCode - 1][reqType - 1];
+
+    return RES_HEADER_LEN + segments[1].iov_len;
+}
+
+/**
+ * Points a single segment at the cached compact response in a language.
+ * No checking is done beforehand, langCode must be valid.
+ * 
+ * @param cache The cache.
+ * @param langCode The language to respond in.
+ * @param segments Where the segment is to be stored, as for cacheLookup().
+ * @return The length of the response.
+ * */
+size_t cacheLookupCompact(struct response_cache* cache, uint16_t langCode, struct iovec segments[1])
+{
+    struct cache_generation* generation = &cache->generations[cache->current];
+
+    cache->hits++;
+
+    segments[0].iov_base = generation->compact[langCode - 1];
+    segments[0].iov_len = RES_HEADER_LEN;
+
+    return RES_HEADER_LEN;
+}
+
+/**
+ * Points a gather list at the header of a batch response followed by the
+ * cached response to each of its queries, which are the records.
+ * No checking is done beforehand, the request must be valid.
+ * 
+ * @param cache The cache.
+ * @param pkt The batch request.
+ * @param n The length of the request.
+ * @param segments Where the segments are to be stored, as for cacheLookup().
+ * @param segment_count Where the number of segments is to be stored.
+ * @return The length of the whole response.
+ * */
+size_t cacheLookupBatch(struct response_cache* cache, uint8_t pkt[], size_t n, struct iovec segments[CACHE_MAX_SEGMENTS], size_t* segment_count)
+{
+    unsigned int count = dtBatchCount(pkt, n);
+    size_t length = BATCH_HEADER_LEN;
+
+    segments[0].iov_base = cache->batch_headers[count];
+    segments[0].iov_len = BATCH_HEADER_LEN;
+
+    for (unsigned int q = 0; q < count; q++) {
+        length += cacheLookup(cache, dtBatchReqType(pkt, n, q), dtBatchReqLangCode(pkt, n, q),
+            &segments[1 + q * CACHE_SEGMENTS]);
+    }
+
+    *segment_count = 1 + count * CACHE_SEGMENTS;
+
+    return length;
+}
+
+/**
+ * Stops the current generation from being rebuilt until it is unpinned.
+ * Used by sends that the kernel may still be reading after they return.
+ * 
+ * @param cache The cache.
+ * @return The generation that was pinned.
+ * */
+unsigned int cachePin(struct response_cache* cache)
+{
+    cache->generations[cache->current].pins++;
+    return cache->current;
+}
+
+/**
+ * Releases a generation pinned by cachePin().
+ * 
+ * @param cache The cache.
+ * @param generation The generation returned by cachePin().
+ * */
+void cacheUnpin(struct response_cache* cache, unsigned int generation)
+{
+    cache->generations[generation].pins--;
+}
+
+/**
+ * Closes the timer descriptor.
+ * 
+ * @param cache The cache.
+ * */
+void cacheClose(struct response_cache* cache)
+{
+    close(cache->timer_fd);
+}
@@ -0,0 +1,74 @@
+// cache.h
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "protocol.h"
+
+// The number of distinct responses, one per language and request type
+#define CACHE_LANGS 3
+#define CACHE_REQ_TYPES 2
+
+// the number of minutes of responses kept, so that a minute that is still
+// being sent without a copy is not overwritten by the next one
+#define CACHE_GENERATIONS 4
+
+// the number of segments each response is sent as, the header then the text
+#define CACHE_SEGMENTS 2
+
+// the most segments any response is sent as, a batch response's header
+// then the header and text of each of its records
+#define CACHE_MAX_SEGMENTS (1 + BATCH_MAX_QUERIES * CACHE_SEGMENTS)
+
+// The responses for one minute, which are never changed once published
+struct cache_generation {
+
+    // the header and text of each response, indexed by language code - 1 and request type - 1
+    uint8_t headers[CACHE_LANGS][CACHE_REQ_TYPES][RES_HEADER_LEN];
+    uint8_t texts[CACHE_LANGS][CACHE_REQ_TYPES][RES_TEXT_LEN];
+    size_t text_lengths[CACHE_LANGS][CACHE_REQ_TYPES];
+
+    // the compact response of each language, which is the same for either request type
+    uint8_t compact[CACHE_LANGS][RES_HEADER_LEN];
+
+    // the sends still in flight that point into this generation
+    unsigned int pins;
+};
+
+// Holds every response for the current minute, and recent minutes that are still in flight
+struct response_cache {
+
+    struct cache_generation generations[CACHE_GENERATIONS];
+
+    // the generation that new responses are sent from
+    unsigned int current;
+
+    // the header of a batch response with each number of records, which never changes
+    uint8_t batch_headers[BATCH_MAX_QUERIES + 1][BATCH_HEADER_LEN];
+
+    // a timerfd that becomes readable when the minute rolls over
+    int timer_fd;
+
+    // the number of times the responses were rebuilt and looked up
+    uint64_t rebuilds;
+    uint64_t hits;
+
+    // the rebuilds that had to wait because every other generation was pinned
+    uint64_t postponed;
+};
+
+void cacheInit(struct response_cache* cache);
+void cacheRebuild(struct response_cache* cache);
+void cacheHandleTimer(struct response_cache* cache);
+size_t cacheLookup(struct response_cache* cache, uint16_t reqType, uint16_t langCode, struct iovec segments[CACHE_SEGMENTS]);
+size_t cacheLookupCompact(struct response_cache* cache, uint16_t langCode, struct iovec segments[1]);
+size_t cacheLookupBatch(struct response_cache* cache, uint8_t pkt[], size_t n, struct iovec segments[CACHE_MAX_SEGMENTS], size_t* segment_count);
+unsigned int cachePin(struct response_cache* cache);
+void cacheUnpin(struct response_cache* cache, unsigned int generation);
+void cacheClose(struct response_cache* cache);
+
+#endif
@@ -7,26 +7,137 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "bench.h"
 #include "client.h"
+#include "clock.h"
+#include "dtclient.h"
 #include "protocol.h"
+#include "target.h"
+#include "timepage.h"
 #include "utils.h"
 
 /**
- * Usage: client <time|date> <ip address> <port>
+ * Usage: client [--compact] <time|date> <ip address> <port>
+ *        client bench [options] <time|date> <ip address> <port>
+ *        client stats <ip address> <admin port>
+ *        client batch <ip address> <port> <date|time>:<eng|mao|ger>...
+ *        client listen [--once] <group> <port> [<interface address>]
+ *        client page [--repeat <n>] <name> <time|date> <eng|mao|ger>
+ * 
+ * Wherever a server is asked, unix:<path> may be given instead of the
+ * address and port to send to a Unix socket of a server on this host.
  * */
 int main(int argc, char** argv)
 {
     uint16_t request_type, port;
 
+    // ask for the fields alone, without the text
+    bool compact = false;
+
+    // load test the server instead of sending a single request
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        return bench(argc - 1, argv + 1);
+    }
+
+    // print the counters of a server instead of asking it the time
+    if (argc == 4 && strcmp(argv[1], "stats") == 0) {
+        stats(argv[2], argv[3]);
+        return 0;
+    }
+
+    // ask for several responses in one datagram
+    if (argc > 1 && strcmp(argv[1], "batch") == 0) {
+
+        uint16_t reqTypes[BATCH_MAX_QUERIES];
+        uint16_t langCodes[BATCH_MAX_QUERIES];
+
+        // a Unix socket takes the place of both the address and the port
+        unsigned int first = argc > 2 && targetIsUnix(argv[2]) ? 3 : 4;
+        unsigned int count = argc > first ? argc - first : 0;
+
+        if (count < 1 || count > BATCH_MAX_QUERIES) {
+            char msg[120] = {0};
+            sprintf(msg, "usage: client batch <ip address> <port> | unix:<path> <date|time>:<eng|mao|ger>... (at most %u)",
+                BATCH_MAX_QUERIES);
+            error(msg, 1);
+        }
+
+        for (unsigned int q = 0; q < count; q++) {
+            if (!readQuery(argv[first + q], &reqTypes[q], &langCodes[q])) {
+                error("each query must be <date|time>:<eng|mao|ger>", 1);
+            }
+        }
+
+        batch(argv[2], first == 4 ? argv[3] : NULL, reqTypes, langCodes, count);
+        return 0;
+    }
+
+    // wait for the server to announce the time instead of asking for it
+    if (argc > 1 && strcmp(argv[1], "listen") == 0) {
+
+        bool once = argc > 2 && strcmp(argv[2], "--once") == 0;
+
+        if (once) {
+            argc--;
+            argv++;
+        }
+
+        if (argc != 4 && argc != 5) {
+            error("usage: client listen [--once] <group> <port> [<interface address>]", 1);
+        }
+
+        port = atoi(argv[3]);
+        if (port < MIN_PORT_NO || port > MAX_PORT_NO) {
+            char msg[55] = {0};
+            sprintf(msg, "the port must be between %u and %u (inclusive)", MIN_PORT_NO, MAX_PORT_NO);
+            error(msg, 1);
+        }
+
+        listenAnnouncements(argv[2], port, argc == 5 ? argv[4] : NULL, once);
+        return 0;
+    }
+
+    // read the time page of a server on this host instead of asking it
+    if (argc > 1 && strcmp(argv[1], "page") == 0) {
+
+        uint16_t langCode;
+        unsigned int repeat = 1;
+        char query[16] = {0};
+
+        if (argc > 3 && strcmp(argv[2], "--repeat") == 0) {
+            repeat = atoi(argv[3]);
+            argc -= 2;
+            argv += 2;
+        }
+
+        if (argc != 5 || repeat < 1) {
+            error("usage: client page [--repeat <n>] <name> <time|date> <eng|mao|ger>", 1);
+        }
+
+        // the same form as a query of a batch request
+        if (snprintf(query, sizeof(query), "%s:%s", argv[3], argv[4]) >= (int) sizeof(query) ||
+            !readQuery(query, &request_type, &langCode)) {
+            error("the query must be <time|date> <eng|mao|ger>", 1);
+        }
+
+        readPage(argv[2], request_type, langCode, repeat);
+        return 0;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--compact") == 0) {
+        compact = true;
+        argc--;
+        argv++;
+    }
+
     // validate the number of arguments passed in
-    if (argc != 4) {
-        error("client expects exactly 4 arguments", 1);
+    if (argc != 4 && !(argc == 3 && targetIsUnix(argv[2]))) {
+        error("client expects exactly 4 arguments, or 3 with a unix:<path>", 1);
     }
 
     // set the request_type based on the first argument
@@ -39,15 +150,19 @@ int main(int argc, char** argv)
     }
 
     // set the port based on the third argument
-    port = atoi(argv[3]);
+    port = argc == 4 ? atoi(argv[3]) : MIN_PORT_NO;
     if (port < MIN_PORT_NO || port > MAX_PORT_NO) {
         char msg[55] = {0};
         sprintf(msg, "the port must be between %u and %u (inclusive)", MIN_PORT_NO, MAX_PORT_NO);
         error(msg, 1);
     }
 
+    if (compact) {
+        request_type |= REQ_FLAG_COMPACT;
+    }
+
     // send a request
-    request(request_type, argv[2], argv[3]);
+    request(request_type, argv[2], argc == 4 ? argv[3] : NULL);
 
     return 0;
 }
@@ -55,166 +170,457 @@ int main(int argc, char** argv)
 /**
  * Sends a request to the server.
  * 
- * @param request_type The type of request, either REQ_DATE or REQ_TIME.
- * @param ip_address_string The ip address of the server as a string.
- * @param port The port the server is listening on.
+ * @param request_type The type of request, either REQ_DATE or REQ_TIME,
+ *                     with REQ_FLAG_COMPACT set for a compact response.
+ * @param ip_address_string The ip address of the server as a string, or unix: and the path of its socket.
+ * @param port The port the server is listening on, NULL for a Unix socket.
  * */
 void request(uint16_t request_type, char* ip_address_string, char* port_string)
 {
-    
-    // the address information of the server
-    // struct sockaddr_in server_address;
-    socklen_t server_address_len;
 
-    // the socket descriptor of the client
-    int client_socket;
+    // the connection to the server, which is only used for the one request
+    struct dtclient client;
 
-    // the buffers to hold the raw request and response packets
-    uint8_t req[REQ_PKT_LEN] = {0};
-    uint8_t buffer[RES_PKT_LEN] = {0};
+    // the decoded response
+    struct dtclient_response response;
 
-    // stores the amount of time for select() to wait before returning
-    struct timeval timeout;
+    // the outcome of each call
+    int status;
 
-    // this is required for select() to work
-    fd_set socket_set;
+    // resolve the server and connect to it
+    status = dtclientOpen(&client, ip_address_string, port_string);
 
-    // this is used to test what is returned by select()
-    int select_result;
+    if (status != DTCLIENT_OK) {
+        error(dtclientError(status), 1);
+    }
 
-    // set aside some space for the text from the incoming data to be placed
-    char text[RES_TEXT_LEN] = {0};
+    // send the request and wait up to a second for the response
+    status = dtclientRequest(&client, request_type, &response);
+    dtclientClose(&client);
 
-    // denotes the length of the text received.
-    size_t text_len = 0;
+    if (status == DTCLIENT_ERR_REQUEST) {
+        error(dtclientError(status), 3);
+    }
+
+    if (status != DTCLIENT_OK) {
+        error(dtclientError(status), status == DTCLIENT_ERR_TIMEOUT ? 4 : 2);
+    }
 
-    // holds the server address hints
+    // print the other information
+    printf("MagicNo:\t0x%04X\n", MAGIC_NO);
+    printf("PacketType:\t%u\n", PACKET_RES);
+    printf("LanguageCode:\t%u\n", response.lang_code);
+    printf("Year:\t\t%u\n", response.year);
+    printf("Month:\t\t%u\n", response.month);
+    printf("Day:\t\t%u\n", response.day);
+    printf("Hour:\t\t%u\n", response.hour);
+    printf("Minute:\t\t%u\n", response.minute);
+    printf("Length:\t\t%zu\n", response.text_length);
+
+    // a compact response has no text
+    if (!(request_type & REQ_FLAG_COMPACT)) {
+        printf("Text:\t\t%s\n", response.text);
+    }
+
+}
+
+
+/**
+ * Asks the admin port of a server for a snapshot of its counters and
+ * prints it as it comes.
+ * 
+ * @param ip_address_string The ip address of the server as a string.
+ * @param port_string The admin port of the server.
+ * */
+void stats(char* ip_address_string, char* port_string)
+{
+    uint8_t req[STATS_REQ_LEN];
+    uint8_t* buffer = malloc(STATS_RES_MAX_LEN);
     struct addrinfo hints;
-    
-    // a pointer to all the addresses returned by getaddrinfo
-    struct addrinfo *addresses;
+    struct addrinfo* address;
+    struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+    ssize_t received;
+    int client_socket;
 
-    // a pointer to the current address used as the server address
-    struct addrinfo *server_address;
+    if (buffer == NULL) {
+        error("could not allocate the response", 3);
+    }
 
-    // setup the hints data structure
     memset(&hints, 0, sizeof(struct addrinfo));
     hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_DGRAM;
 
-    // get the address info
-    if (getaddrinfo(ip_address_string, port_string, &hints, &addresses) != 0) {
+    if (getaddrinfo(ip_address_string, port_string, &hints, &address) != 0) {
         error("bad hostname or ip address", 1);
     }
-    
-    // iterate over every possible server address returned by getaddrinfo
-    // and select the first one that we can connect to
-    for (server_address = addresses; server_address != NULL; server_address = server_address->ai_next) {
 
-        // create a socket
-        client_socket = socket(server_address->ai_family,
-            server_address->ai_socktype, server_address->ai_protocol);
+    client_socket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
 
-        // if it is no good, get another one
-        if (client_socket < 0) {
-            continue;
-        }
+    if (client_socket < 0 || connect(client_socket, address->ai_addr, address->ai_addrlen) < 0) {
+        error("could not connect", 1);
+    }
 
-        // attempt to connect to the server, if this works, break
-        if (connect(client_socket, server_address->ai_addr,
-            server_address->ai_addrlen) == 0) {
-            break;
-        }
+    freeaddrinfo(address);
+
+    // give up on the server after a second
+    setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    dtStatsReq(req, STATS_REQ_LEN);
+
+    if (send(client_socket, req, STATS_REQ_LEN, 0) < 0) {
+        error("could not send packet", 2);
+    }
+
+    received = recv(client_socket, buffer, STATS_RES_MAX_LEN, 0);
+
+    if (received < 0) {
+        error("no stats received", 4);
+    }
 
-        // close this socket and get another one
-        close(client_socket);
+    if (!dtStatsResValid(buffer, received)) {
+        error("invalid stats response", 2);
     }
 
-    // display an error if we could not connect to the server
-    if (server_address == NULL) {
+    fwrite(buffer + STATS_HEADER_LEN, 1, received - STATS_HEADER_LEN, stdout);
+
+    close(client_socket);
+    free(buffer);
+}
+
+/**
+ * Reads a query of a batch request, a request type and a language
+ * separated by a colon, e.g. time:mao.
+ * 
+ * @param arg The argument.
+ * @param reqType Where the request type is to be stored.
+ * @param langCode Where the language code is to be stored.
+ * @return True if the query was valid.
+ * */
+bool readQuery(char* arg, uint16_t* reqType, uint16_t* langCode)
+{
+    char* lang = strchr(arg, ':');
+
+    if (lang == NULL) {
+        return false;
+    }
+
+    if (strncmp(arg, "date", lang - arg) == 0 && lang - arg == 4) {
+        *reqType = REQ_DATE;
+    } else if (strncmp(arg, "time", lang - arg) == 0 && lang - arg == 4) {
+        *reqType = REQ_TIME;
+    } else {
+        return false;
+    }
+
+    if (strcmp(lang + 1, "eng") == 0) {
+        *langCode = LANG_ENG;
+    } else if (strcmp(lang + 1, "mao") == 0) {
+        *langCode = LANG_MAO;
+    } else if (strcmp(lang + 1, "ger") == 0) {
+        *langCode = LANG_GER;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Sends a batch request to the server and prints each record of the
+ * response, which arrives in one datagram.
+ * 
+ * @param ip_address_string The ip address of the server as a string, or unix: and the path of its socket.
+ * @param port_string The port the server is listening on, any language will do, or NULL for a Unix socket.
+ * @param reqTypes The type of each query.
+ * @param langCodes The language of each query.
+ * @param count The number of queries.
+ * */
+void batch(char* ip_address_string, char* port_string, uint16_t reqTypes[], uint16_t langCodes[], unsigned int count)
+{
+    uint8_t req[BATCH_REQ_MAX_LEN];
+    uint8_t buffer[BATCH_RES_MAX_LEN];
+    struct target server_address;
+    struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+    size_t length;
+    ssize_t received;
+    int client_socket;
+
+    if (!targetRead(ip_address_string, port_string, &server_address)) {
+        error("bad hostname, ip address or unix socket path", 1);
+    }
+
+    client_socket = targetOpen(&server_address, 0);
+
+    if (client_socket < 0) {
         error("could not connect", 1);
     }
 
-    server_address_len = sizeof(server_address);
+    // give up on the server after a second
+    setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
 
-    // create the packet
-    if (dtReq(req, REQ_PKT_LEN, request_type) == 0) {
+    length = dtBatchReq(req, BATCH_REQ_MAX_LEN, reqTypes, langCodes, count);
+
+    if (length == 0) {
         error("could not create packet", 3);
     }
 
-    // set the timeout to be one second
-    timeout.tv_sec = 1;
-    timeout.tv_usec = 0;
+    if (send(client_socket, req, length, 0) < 0) {
+        error("could not send packet", 2);
+    }
 
-    // set the socket_set
-    FD_ZERO(&socket_set);
-    FD_SET(client_socket, &socket_set);
+    received = recv(client_socket, buffer, BATCH_RES_MAX_LEN, 0);
 
-    // wait for the socket to be writable
-    select_result = select(client_socket + 1, NULL, &socket_set, NULL, &timeout);
+    if (received < 0) {
+        error("no response received", 4);
+    }
 
-    // print an error if something went wrong while selecting
-    if (select_result < 0) {
-        error("could not select", 4);
+    if (!dtBatchResValid(buffer, received)) {
+        error("invalid batch response", 2);
     }
 
-    // print an error if a timeout occurred
-    if (select_result == 0) {
-        error("select timed out", 4);
+    printf("MagicNo:\t0x%04X\n", dtPktMagicNo(buffer, received));
+    printf("PacketType:\t%u\n", dtPktType(buffer, received));
+    printf("Records:\t%u\n", dtBatchCount(buffer, received));
+
+    for (unsigned int r = 0; r < dtBatchCount(buffer, received); r++) {
+
+        char text[RES_TEXT_LEN + 1] = {0};
+        size_t text_len, record_len;
+        uint8_t* record = buffer + dtBatchResRecord(buffer, received, r, &record_len);
+
+        dtResText(record, record_len, text, &text_len);
+
+        printf("%s %s:\t%04u-%02u-%02u %02u:%02u\t%s\n",
+            getLangName(dtResLangCode(record, record_len)), getRequestTypeString(reqTypes[r]),
+            dtResYear(record, record_len), dtResMonth(record, record_len), dtResDay(record, record_len),
+            dtResHour(record, record_len), dtResMinute(record, record_len), text);
     }
 
-    // attempt to send the packet
-    if (sendto(client_socket, req, REQ_PKT_LEN, 0, (struct sockaddr *) server_address->ai_addr, server_address->ai_addrlen) < 0) {
-        error("could not send packet", 2);
+    close(client_socket);
+}
+
+/**
+ * Joins a multicast group that a server announces to and prints each
+ * response it announces, as the current value for that language and
+ * request type. Nothing is ever sent, and anything that is not a valid
+ * DT Response is ignored.
+ * 
+ * @param group_string The multicast group as a string.
+ * @param port The port the server announces to.
+ * @param interface_string The address of the interface to listen on, or NULL for the default.
+ * @param once If true, return after the first announcement rather than listening forever.
+ * */
+void listenAnnouncements(char* group_string, uint16_t port, char* interface_string, bool once)
+{
+    struct sockaddr_in group_addr;
+    struct ip_mreq membership;
+    int option_value = 1;
+    int client_socket;
+
+    memset(&group_addr, 0, sizeof(group_addr));
+    group_addr.sin_family = AF_INET;
+    group_addr.sin_port = htons(port);
+
+    if (inet_pton(AF_INET, group_string, &group_addr.sin_addr) != 1 ||
+        !IN_MULTICAST(ntohl(group_addr.sin_addr.s_addr))) {
+        error("the group must be a multicast address", 1);
     }
 
-    // set the timeout to be one second, this must be set again because select() modifies the timeout
-    timeout.tv_sec = 1;
-    timeout.tv_usec = 0;
+    membership.imr_multiaddr = group_addr.sin_addr;
+    membership.imr_interface.s_addr = htonl(INADDR_ANY);
 
-    // set the socket_set, this must be set again because select() modifies socket_set
-    FD_ZERO(&socket_set);
-    FD_SET(client_socket, &socket_set);
+    if (interface_string != NULL && inet_pton(AF_INET, interface_string, &membership.imr_interface) != 1) {
+        error("bad interface address", 1);
+    }
 
-    // Wait for the socket to be readable
-    select_result = select(client_socket + 1, &socket_set, NULL, NULL, &timeout);
+    client_socket = socket(AF_INET, SOCK_DGRAM, 0);
 
-    // print an error if something went wrong while selecting
-    if (select_result < 0) {
-        error("could not select", 4);
+    if (client_socket < 0) {
+        error("could not create socket", 2);
     }
 
-    // print an error if a timeout occurred
-    if (select_result == 0) {
-        error("select timed out", 4);
+    // several listeners on one host may share the group
+    setsockopt(client_socket, SOL_SOCKET, SO_REUSEADDR, &option_value, sizeof(option_value));
+
+    // binding to the group keeps out unicast traffic to the same port
+    if (bind(client_socket, (struct sockaddr *) &group_addr, sizeof(group_addr)) < 0) {
+        error("could not bind to the group", 2);
     }
 
-    // attempt to receive the response
-    if (recvfrom(client_socket, buffer, RES_PKT_LEN, 0, (struct sockaddr *) &server_address, &server_address_len) < 0) {
-        error("could not recieve packet", 2);
+    if (setsockopt(client_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0) {
+        error("could not join the group", 2);
     }
 
-    // free the memory used by getaddrinfo
-    freeaddrinfo(addresses);
+    printf("Listening for announcements to %s port %u...\n", group_string, port);
+    fflush(stdout);
+
+    while (true) {
+
+        uint8_t buffer[RES_PKT_LEN];
+        char text[RES_TEXT_LEN + 1] = {0};
+        size_t text_len;
+
+        ssize_t received = recv(client_socket, buffer, RES_PKT_LEN, 0);
+
+        if (received < 0 || !dtResValid(buffer, received)) {
+            continue;
+        }
+
+        dtResText(buffer, received, text, &text_len);
+
+        printf("%s:\t%04u-%02u-%02u %02u:%02u\t%s\n",
+            getLangName(dtResLangCode(buffer, received)),
+            dtResYear(buffer, received), dtResMonth(buffer, received), dtResDay(buffer, received),
+            dtResHour(buffer, received), dtResMinute(buffer, received), text);
+        fflush(stdout);
+
+        if (once) {
+            break;
+        }
+    }
 
-    // close the socket
     close(client_socket);
+}
+
+/**
+ * Reads a response from the time page of a server on the same host and
+ * prints it as if it had been sent. No request is made, the response is
+ * copied straight out of shared memory. When the page is read more than
+ * once the average time of a read is printed as well.
+ * 
+ * @param name The name the server was given for its time page.
+ * @param request_type The type of request, either REQ_DATE or REQ_TIME.
+ * @param langCode The language of the response.
+ * @param repeat The number of times to read the page.
+ * */
+void readPage(char* name, uint16_t request_type, uint16_t langCode, unsigned int repeat)
+{
+    uint8_t buffer[RES_PKT_LEN] = {0};
+    char text[RES_TEXT_LEN + 1] = {0};
+    size_t length = 0, text_len;
+    time_t minute = 0;
+    uint64_t start;
 
-    // extract the text, storing it in text and the length in text_len
-    dtResText(buffer, dtPktLength(buffer), text, &text_len);
+    const struct time_page* page = timepageOpen(name);
 
-    // print the other information
-    printf("MagicNo:\t0x%04X\n", dtPktMagicNo(buffer, RES_PKT_LEN));
-    printf("PacketType:\t%u\n", dtPktType(buffer, RES_PKT_LEN));
-    printf("LanguageCode:\t%u\n", dtResLangCode(buffer, RES_PKT_LEN));
-    printf("Year:\t\t%u\n", dtResYear(buffer, RES_PKT_LEN));
-    printf("Month:\t\t%u\n", dtResMonth(buffer, RES_PKT_LEN));
-    printf("Day:\t\t%u\n", dtResDay(buffer, RES_PKT_LEN));
-    printf("Hour:\t\t%u\n", dtResHour(buffer, RES_PKT_LEN));
-    printf("Minute:\t\t%u\n", dtResMinute(buffer, RES_PKT_LEN));
-    printf("Length:\t\t%u\n", dtResLength(buffer, RES_PKT_LEN));
-
-    // print the text response
-    printf("Text:\t\t%s\n", text);
+    if (page == NULL) {
+        error("no time page with that name, is the server running with --time-page?", 2);
+    }
+
+    start = clockMonotonicNanos();
+
+    for (unsigned int r = 0; r < repeat; r++) {
+        length = timepageRead(page, request_type, langCode, buffer, RES_PKT_LEN, &minute);
+    }
+
+    if (repeat > 1) {
+        printf("Read %u times, %.1f ns per read\n", repeat, (double) (clockMonotonicNanos() - start) / repeat);
+    }
 
+    timepageUnmap(page);
+
+    if (length == 0 || !dtResValid(buffer, length)) {
+        error("could not read the time page", 2);
+    }
+
+    if (!timepageFresh(minute, time(NULL))) {
+        error("the time page is stale, the server that wrote it has stopped", 4);
+    }
+
+    dtResText(buffer, length, text, &text_len);
+
+    printf("MagicNo:\t0x%04X\n", dtPktMagicNo(buffer, length));
+    printf("PacketType:\t%u\n", dtPktType(buffer, length));
+    printf("LanguageCode:\t%u\n", dtResLangCode(buffer, length));
+    printf("Year:\t\t%u\n", dtResYear(buffer, length));
+    printf("Month:\t\t%u\n", dtResMonth(buffer, length));
+    printf("Day:\t\t%u\n", dtResDay(buffer, length));
+    printf("Hour:\t\t%u\n", dtResHour(buffer, length));
+    printf("Minute:\t\t%u\n", dtResMinute(buffer, length));
+    printf("Length:\t\t%u\n", dtResLength(buffer, length));
+    printf("Text:\t\t%s\n", text);
 }
+
+/**
+ * Runs a load test against the server and prints the results.
+ * 
+ * @param argc The number of arguments, starting from "bench".
+ * @param argv The arguments, starting from "bench".
+ * @return The exit code.
+ * */
+int bench(int argc, char** argv)
+{
+    struct bench_options options;
+
+    // the target given last and any it is compared with, the host and port of
+    // each or unix: and a path with no port, and the name each is shown by
+    char* hosts[MAX_BENCH_TARGETS];
+    char* ports[MAX_BENCH_TARGETS];
+    char* names[MAX_BENCH_TARGETS];
+    struct bench_result* results;
+    unsigned int count;
+
+    if (!readBenchOptions(argc, argv, &options)) {
+        error("usage: client bench [--concurrency <n>] [--duration <s> | --requests <n>] "
+            "[--rate <r>] [--timeout <s>] [--compact] [--compare <port> | unix:<path>]... "
+            "<time|date> <ip address> <port> | unix:<path>", 1);
+    }
+
+    hosts[0] = options.host;
+    ports[0] = options.port;
+    count = options.compare_count + 1;
+
+    // a port compared with a Unix socket is on the loopback address of the same host
+    for (unsigned int t = 1; t < count; t++) {
+        char* compare = options.compare_ports[t - 1];
+
+        if (targetIsUnix(compare)) {
+            hosts[t] = compare;
+            ports[t] = NULL;
+        } else {
+            hosts[t] = targetIsUnix(options.host) ? "127.0.0.1" : options.host;
+            ports[t] = compare;
+        }
+    }
+
+    for (unsigned int t = 0; t < count; t++) {
+        uint16_t port = ports[t] != NULL ? atoi(ports[t]) : MIN_PORT_NO;
+        if (port < MIN_PORT_NO || port > MAX_PORT_NO) {
+            char msg[55] = {0};
+            sprintf(msg, "the port must be between %u and %u (inclusive)", MIN_PORT_NO, MAX_PORT_NO);
+            error(msg, 1);
+        }
+
+        names[t] = ports[t] != NULL ? ports[t] : hosts[t];
+    }
+
+    // each result holds a full latency histogram
+    results = calloc(count, sizeof(struct bench_result));
+
+    if (results == NULL) {
+        error("could not allocate the results", 3);
+    }
+
+    // run the same test against each target in turn
+    for (unsigned int t = 0; t < count; t++) {
+        options.host = hosts[t];
+        options.port = ports[t];
+
+        if (t > 0) {
+            printf("\n");
+        }
+
+        benchRun(&options, &results[t]);
+        benchPrint(&options, &results[t]);
+        fflush(stdout);
+    }
+
+    if (count > 1) {
+        printf("\n");
+        benchCompare(names, results, count);
+    }
+
+    free(results);
+
+    return 0;
+}
\ No newline at end of file
@@ -3,9 +3,16 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 int main(int argc, char** argv);
 void request(uint16_t reqType, char* ip_addr, char* port);
+void stats(char* ip_addr, char* port);
+bool readQuery(char* arg, uint16_t* reqType, uint16_t* langCode);
+void batch(char* ip_addr, char* port, uint16_t reqTypes[], uint16_t langCodes[], unsigned int count);
+void listenAnnouncements(char* group, uint16_t port, char* interface, bool once);
+void readPage(char* name, uint16_t reqType, uint16_t langCode, unsigned int repeat);
+int bench(int argc, char** argv);
 
 #endif
\ No newline at end of file
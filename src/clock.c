@@ -0,0 +1,115 @@
+// clock.c
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "clock.h"
+
+// the minute shared by every thread, the start is -1 until it is first computed
+static struct clock_minute minute = { .start = -1 };
+
+// held by whichever thread is rewriting the minute
+static bool writing = false;
+
+/**
+ * Recomputes the local time the slow way and publishes the minute it
+ * falls in. tzset() is called first so that changes to TZ or the zone
+ * files are picked up, and since this happens at least once a minute a
+ * DST transition (which always falls on a minute boundary) is seen as
+ * soon as it happens.
+ * 
+ * @param t The time to convert.
+ * @param result Where the broken-down local time is to be stored.
+ * */
+static void clockRefresh(time_t t, struct tm* result)
+{
+    tzset();
+    localtime_r(&t, result);
+
+    // another thread is already publishing, so just return our own result
+    if (__atomic_test_and_set(&writing, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    uint32_t sequence = minute.sequence;
+
+    // mark the minute as being rewritten before touching it
+    __atomic_store_n(&minute.sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    minute.start = t - result->tm_sec;
+    minute.local = *result;
+    minute.local.tm_sec = 0;
+    minute.refreshes++;
+
+    __atomic_store_n(&minute.sequence, sequence + 2, __ATOMIC_RELEASE);
+    __atomic_clear(&writing, __ATOMIC_RELEASE);
+}
+
+/**
+ * Converts a time to local time. Within the current minute this is a
+ * copy of the cached minute with the seconds filled in, which takes no
+ * locks and makes no system calls. Anything else takes the slow path.
+ * 
+ * @param t The time to convert.
+ * @param result Where the broken-down local time is to be stored.
+ * */
+void clockLocalTime(time_t t, struct tm* result)
+{
+    uint32_t before, after;
+    time_t start;
+
+    // retry if the minute was rewritten while it was being copied
+    do {
+        before = __atomic_load_n(&minute.sequence, __ATOMIC_ACQUIRE);
+        start = minute.start;
+        *result = minute.local;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&minute.sequence, __ATOMIC_RELAXED);
+    } while (before != after || (before & 1));
+
+    if (start < 0 || t < start || t - start >= 60) {
+        clockRefresh(t, result);
+        return;
+    }
+
+    result->tm_sec = t - start;
+}
+
+/**
+ * Returns the current local time. The time is read from the coarse
+ * real time clock, which the vDSO serves without a system call, so it
+ * may lag the precise clock by a scheduler tick.
+ * 
+ * @param result Where the broken-down local time is to be stored.
+ * */
+void clockNow(struct tm* result)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    clockLocalTime(now.tv_sec, result);
+}
+
+/**
+ * Returns the number of times the cached minute has been recomputed.
+ * 
+ * @return The number of refreshes.
+ * */
+uint64_t clockRefreshes()
+{
+    return __atomic_load_n(&minute.refreshes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Returns the time from the monotonic clock, for measuring intervals.
+ * 
+ * @return The time in nanoseconds.
+ * */
+uint64_t clockMonotonicNanos()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
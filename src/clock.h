@@ -0,0 +1,28 @@
+// clock.h
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+// The local time at the start of the current minute, published with a seqlock
+struct clock_minute {
+
+    // odd while the minute is being rewritten
+    uint32_t sequence;
+
+    // the time at the start of the minute and its broken-down local time
+    time_t start;
+    struct tm local;
+
+    // the number of times the minute has been recomputed
+    uint64_t refreshes;
+};
+
+void clockNow(struct tm* result);
+void clockLocalTime(time_t t, struct tm* result);
+uint64_t clockRefreshes();
+uint64_t clockMonotonicNanos();
+
+#endif
@@ -0,0 +1,427 @@
+// dtclient.c
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "dtclient.h"
+#include "protocol.h"
+#include "target.h"
+
+// What a blocking request is waiting for
+struct dtclient_wait {
+    bool done;
+    int status;
+    struct dtclient_response* response;
+};
+
+/**
+ * Resolves the server and connects a socket to it, which every request
+ * made with the handle is then sent over. Nothing is ever printed and the
+ * process never exits, every failure is returned.
+ *
+ * @param client The handle to initialise.
+ * @param host The address or hostname of the server, or unix: and the path of its socket.
+ * @param port The port the server is listening on, which is not used for a Unix socket and may be NULL.
+ * @return DTCLIENT_OK, DTCLIENT_ERR_ADDRESS or DTCLIENT_ERR_CONNECT.
+ * */
+int dtclientOpen(struct dtclient* client, char* host, char* port)
+{
+    memset(client, 0, sizeof(struct dtclient));
+    client->fd = -1;
+    client->timeout = (uint64_t) DTCLIENT_DEFAULT_TIMEOUT * 1000000;
+
+    if (!targetRead(host, port, &client->server)) {
+        return DTCLIENT_ERR_ADDRESS;
+    }
+
+    client->fd = targetOpen(&client->server, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (client->fd < 0) {
+        return DTCLIENT_ERR_CONNECT;
+    }
+
+    return DTCLIENT_OK;
+}
+
+/**
+ * Sets how long the requests sent from now on wait for their responses.
+ *
+ * @param client The handle.
+ * @param milliseconds The timeout.
+ * */
+void dtclientSetTimeout(struct dtclient* client, unsigned int milliseconds)
+{
+    client->timeout = (uint64_t) milliseconds * 1000000;
+}
+
+/**
+ * Gets the socket to watch for responses in the caller's own event loop.
+ * When it is readable, or dtclientNextTimeout() has passed, call
+ * dtclientProcess().
+ *
+ * @param client The handle.
+ * @return The socket descriptor.
+ * */
+int dtclientFd(struct dtclient* client)
+{
+    return client->fd;
+}
+
+/**
+ * Sends a request without waiting for its response. The callback is made
+ * from dtclientProcess() once the response arrives or the request times
+ * out, and may send further requests.
+ *
+ * @param client The handle.
+ * @param reqType The type of request, either REQ_DATE or REQ_TIME, with REQ_FLAG_COMPACT set for a compact response.
+ * @param callback What to call with the outcome.
+ * @param context Passed to the callback untouched.
+ * @return DTCLIENT_OK once the request is sent, DTCLIENT_ERR_REQUEST, DTCLIENT_ERR_FULL if
+ *         DTCLIENT_MAX_PENDING requests are waiting, DTCLIENT_ERR_AGAIN if a Unix socket's
+ *         queue is full and the socket should be polled for writing, or DTCLIENT_ERR_SEND.
+ * */
+int dtclientSend(struct dtclient* client, uint16_t reqType, dtclient_callback callback, void* context)
+{
+    uint8_t req[REQ_PKT_LEN];
+    struct dtclient_request* request;
+
+    if (dtReq(req, REQ_PKT_LEN, reqType) == 0) {
+        return DTCLIENT_ERR_REQUEST;
+    }
+
+    if (client->count == DTCLIENT_MAX_PENDING) {
+        return DTCLIENT_ERR_FULL;
+    }
+
+    if (send(client->fd, req, REQ_PKT_LEN, 0) < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? DTCLIENT_ERR_AGAIN : DTCLIENT_ERR_SEND;
+    }
+
+    request = &client->pending[(client->head + client->count) % DTCLIENT_MAX_PENDING];
+    request->reqType = reqType;
+    request->number = client->sent++;
+    request->sent_at = clockMonotonicNanos();
+    request->answered = false;
+    request->callback = callback;
+    request->context = context;
+
+    client->count++;
+
+    return DTCLIENT_OK;
+}
+
+/**
+ * Takes the oldest request off the ring, along with any requests behind it
+ * that were answered out of order.
+ *
+ * @param client The handle.
+ * @return A copy of the request, as the callback may reuse its slot.
+ * */
+struct dtclient_request dtclientTake(struct dtclient* client)
+{
+    struct dtclient_request request = client->pending[client->head];
+
+    do {
+        client->head = (client->head + 1) % DTCLIENT_MAX_PENDING;
+        client->count--;
+    } while (client->count > 0 && client->pending[client->head].answered);
+
+    return request;
+}
+
+/**
+ * Checks whether a valid DT Response could be the answer to a request.
+ * A compact request takes any response, as a server that does not know
+ * the flag answers in full. Otherwise a response is only turned down if
+ * it is word for word the answer to the other request type, so that a
+ * server that words its responses differently is still answered in order.
+ *
+ * @param reqType The type of the request.
+ * @param pkt The response.
+ * @param n The length of the response.
+ * @return True if the response answers the request.
+ * */
+bool dtclientAnswers(uint16_t reqType, uint8_t pkt[], size_t n)
+{
+    uint8_t other[RES_PKT_LEN];
+    size_t length;
+
+    if (reqType & REQ_FLAG_COMPACT) {
+        return true;
+    }
+
+    if (n == RES_HEADER_LEN) {
+        return false;
+    }
+
+    length = dtRes(other, RES_PKT_LEN, reqType == REQ_DATE ? REQ_TIME : REQ_DATE, dtResLangCode(pkt, n),
+        dtResYear(pkt, n), dtResMonth(pkt, n), dtResDay(pkt, n), dtResHour(pkt, n), dtResMinute(pkt, n));
+
+    return length != n || memcmp(other, pkt, n) != 0;
+}
+
+/**
+ * Matches a datagram to the oldest request waiting that it answers and
+ * makes its callback. Matching the oldest rather than the first keeps a
+ * lost response from shifting every later answer onto the wrong request.
+ *
+ * @param client The handle.
+ * @param pkt The datagram.
+ * @param n The length of the datagram.
+ * @param now The time it was read.
+ * @return True if it answered a request.
+ * */
+bool dtclientMatch(struct dtclient* client, uint8_t pkt[], size_t n, uint64_t now)
+{
+    struct dtclient_response response;
+    struct dtclient_request* request = NULL;
+
+    if (!dtResValid(pkt, n) || !validLangCode(dtResLangCode(pkt, n))) {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < client->count && request == NULL; i++) {
+
+        struct dtclient_request* waiting = &client->pending[(client->head + i) % DTCLIENT_MAX_PENDING];
+
+        if (!waiting->answered && dtclientAnswers(waiting->reqType, pkt, n)) {
+            request = waiting;
+        }
+    }
+
+    if (request == NULL) {
+        return false;
+    }
+
+    response.lang_code = dtResLangCode(pkt, n);
+    response.year = dtResYear(pkt, n);
+    response.month = dtResMonth(pkt, n);
+    response.day = dtResDay(pkt, n);
+    response.hour = dtResHour(pkt, n);
+    response.minute = dtResMinute(pkt, n);
+    response.latency = now - request->sent_at;
+
+    dtResText(pkt, n, response.text, &response.text_length);
+
+    client->answered++;
+
+    // the oldest request is taken off the ring, a later one waits for the requests ahead of it
+    if (request == &client->pending[client->head]) {
+        struct dtclient_request taken = dtclientTake(client);
+        taken.callback(client, DTCLIENT_OK, &response, taken.context);
+    } else {
+        request->answered = true;
+        request->callback(client, DTCLIENT_OK, &response, request->context);
+    }
+
+    return true;
+}
+
+/**
+ * Fails every request that was waiting when it was called. Requests sent
+ * by the callbacks are left waiting.
+ *
+ * @param client The handle.
+ * @param status The error to fail them with.
+ * @return The number of requests failed.
+ * */
+int dtclientFailAll(struct dtclient* client, int status)
+{
+    uint64_t end = client->sent;
+    int failed = 0;
+
+    while (client->count > 0 && client->pending[client->head].number < end) {
+        struct dtclient_request taken = dtclientTake(client);
+        taken.callback(client, status, NULL, taken.context);
+        failed++;
+    }
+
+    return failed;
+}
+
+/**
+ * Reads every response waiting on the socket, making the callback of the
+ * request each one answers, then times out the requests that have waited
+ * too long. Datagrams that answer no request waiting, such as a response
+ * that arrives after its request timed out, are counted and dropped.
+ *
+ * @param client The handle.
+ * @return The number of requests completed.
+ * */
+int dtclientProcess(struct dtclient* client)
+{
+    uint8_t buffer[RES_PKT_LEN];
+    ssize_t received;
+    uint64_t now;
+    int completed = 0;
+
+    while (true) {
+
+        received = recv(client->fd, buffer, RES_PKT_LEN, 0);
+
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+
+        // an error on a datagram socket, e.g. the server's port refusing an
+        // earlier request, says nothing of which request it belongs to
+        if (received < 0) {
+            completed += dtclientFailAll(client, DTCLIENT_ERR_RECEIVE);
+            break;
+        }
+
+        if (dtclientMatch(client, buffer, received, clockMonotonicNanos())) {
+            completed++;
+        } else {
+            client->unmatched++;
+        }
+    }
+
+    now = clockMonotonicNanos();
+
+    // the oldest request is at the head, so it is always the next to time out
+    while (client->count > 0 && now - client->pending[client->head].sent_at >= client->timeout) {
+        struct dtclient_request taken = dtclientTake(client);
+        client->timed_out++;
+        taken.callback(client, DTCLIENT_ERR_TIMEOUT, NULL, taken.context);
+        completed++;
+    }
+
+    return completed;
+}
+
+/**
+ * Gets how long the caller's event loop may sleep before the oldest request
+ * times out, in the form poll() takes.
+ *
+ * @param client The handle.
+ * @return The time in milliseconds, rounded up, or -1 if no request is waiting.
+ * */
+int dtclientNextTimeout(struct dtclient* client)
+{
+    uint64_t now = clockMonotonicNanos();
+    uint64_t expires;
+
+    if (client->count == 0) {
+        return -1;
+    }
+
+    expires = client->pending[client->head].sent_at + client->timeout;
+
+    return expires > now ? (expires - now + 999999) / 1000000 : 0;
+}
+
+/**
+ * Hands a blocking request the outcome it is waiting for.
+ *
+ * @param client The handle.
+ * @param status The outcome.
+ * @param response The response, or NULL.
+ * @param context The struct dtclient_wait of the request.
+ * */
+void dtclientFinishWait(struct dtclient* client, int status, struct dtclient_response* response, void* context)
+{
+    struct dtclient_wait* wait = context;
+
+    wait->done = true;
+    wait->status = status;
+
+    if (response != NULL) {
+        *wait->response = *response;
+    }
+}
+
+/**
+ * Sends a request and waits for its response or for it to time out. Any
+ * other requests still waiting are completed along the way.
+ *
+ * @param client The handle.
+ * @param reqType The type of request, either REQ_DATE or REQ_TIME, with REQ_FLAG_COMPACT set for a compact response.
+ * @param response Where the response is to be stored.
+ * @return DTCLIENT_OK once the response is stored, or an error.
+ * */
+int dtclientRequest(struct dtclient* client, uint16_t reqType, struct dtclient_response* response)
+{
+    struct dtclient_wait wait = { .done = false, .status = DTCLIENT_OK, .response = response };
+    struct pollfd socket_poll = { .fd = client->fd, .events = POLLOUT };
+    uint64_t deadline = clockMonotonicNanos() + client->timeout;
+    uint64_t now;
+    int status;
+
+    // only a Unix socket whose server has a full queue has to wait to send
+    while ((status = dtclientSend(client, reqType, dtclientFinishWait, &wait)) == DTCLIENT_ERR_AGAIN) {
+
+        now = clockMonotonicNanos();
+
+        if (now >= deadline) {
+            return DTCLIENT_ERR_TIMEOUT;
+        }
+
+        poll(&socket_poll, 1, (deadline - now + 999999) / 1000000);
+    }
+
+    if (status != DTCLIENT_OK) {
+        return status;
+    }
+
+    // the request is certain to finish by timing out, so this never waits for ever
+    socket_poll.events = POLLIN;
+
+    while (!wait.done) {
+        poll(&socket_poll, 1, dtclientNextTimeout(client));
+        dtclientProcess(client);
+    }
+
+    return wait.status;
+}
+
+/**
+ * Closes the socket and fails every request still waiting with
+ * DTCLIENT_ERR_CLOSED. It must not be called from a callback, and any
+ * request a callback sends fails with DTCLIENT_ERR_SEND.
+ *
+ * @param client The handle.
+ * */
+void dtclientClose(struct dtclient* client)
+{
+    if (client->fd >= 0) {
+        close(client->fd);
+        client->fd = -1;
+    }
+
+    dtclientFailAll(client, DTCLIENT_ERR_CLOSED);
+}
+
+/**
+ * Describes an outcome.
+ *
+ * @param status DTCLIENT_OK or an error.
+ * @return A description of it.
+ * */
+char* dtclientError(int status)
+{
+    switch (status) {
+        case DTCLIENT_OK: return "success";
+        case DTCLIENT_ERR_ADDRESS: return "bad hostname, ip address or unix socket path";
+        case DTCLIENT_ERR_CONNECT: return "could not connect";
+        case DTCLIENT_ERR_REQUEST: return "could not create packet";
+        case DTCLIENT_ERR_FULL: return "too many requests waiting";
+        case DTCLIENT_ERR_AGAIN: return "the server's queue is full";
+        case DTCLIENT_ERR_SEND: return "could not send packet";
+        case DTCLIENT_ERR_RECEIVE: return "could not receive packet";
+        case DTCLIENT_ERR_TIMEOUT: return "timed out";
+        case DTCLIENT_ERR_CLOSED: return "closed";
+        default: return "unknown error";
+    }
+}
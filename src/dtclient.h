@@ -0,0 +1,107 @@
+// dtclient.h
+
+#ifndef DTCLIENT_H
+#define DTCLIENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+#include "target.h"
+
+// the most requests a handle keeps in flight at once
+#define DTCLIENT_MAX_PENDING 64
+
+// how long a request waits for its response by default, in milliseconds
+#define DTCLIENT_DEFAULT_TIMEOUT 1000
+
+// The outcome of a call or of a request, every error is negative
+#define DTCLIENT_OK 0
+#define DTCLIENT_ERR_ADDRESS -1
+#define DTCLIENT_ERR_CONNECT -2
+#define DTCLIENT_ERR_REQUEST -3
+#define DTCLIENT_ERR_FULL -4
+#define DTCLIENT_ERR_AGAIN -5
+#define DTCLIENT_ERR_SEND -6
+#define DTCLIENT_ERR_RECEIVE -7
+#define DTCLIENT_ERR_TIMEOUT -8
+#define DTCLIENT_ERR_CLOSED -9
+
+// A DT Response, decoded
+struct dtclient_response {
+    uint16_t lang_code;
+    uint16_t year;
+    uint8_t month;
+    uint8_t day;
+    uint8_t hour;
+    uint8_t minute;
+
+    // the text, which is empty for a compact response
+    char text[RES_TEXT_LEN + 1];
+    size_t text_length;
+
+    // the time from sending the request to reading its response, in nanoseconds
+    uint64_t latency;
+};
+
+struct dtclient;
+
+// Called once for every request sent with dtclientSend(), with DTCLIENT_OK
+// and the response, or an error and NULL
+typedef void (*dtclient_callback)(struct dtclient* client, int status, struct dtclient_response* response, void* context);
+
+// A request waiting for its response
+struct dtclient_request {
+    uint16_t reqType;
+
+    // how many requests the handle had sent before this one
+    uint64_t number;
+    uint64_t sent_at;
+    bool answered;
+
+    dtclient_callback callback;
+    void* context;
+};
+
+// A socket connected to one server that any number of requests are sent
+// over in turn. DT Responses do not say which request they answer, so each
+// is matched to the oldest request still waiting that it is a valid answer to.
+struct dtclient {
+    int fd;
+    struct target server;
+
+    // how long a request waits for its response, in nanoseconds
+    uint64_t timeout;
+
+    // the requests in the order they were sent, a ring starting at head
+    struct dtclient_request pending[DTCLIENT_MAX_PENDING];
+    unsigned int head;
+    unsigned int count;
+
+    // the requests sent
+    uint64_t sent;
+
+    // the responses matched to a request, the requests that timed out and
+    // the datagrams that did not answer any request waiting
+    uint64_t answered;
+    uint64_t timed_out;
+    uint64_t unmatched;
+};
+
+int dtclientOpen(struct dtclient* client, char* host, char* port);
+void dtclientSetTimeout(struct dtclient* client, unsigned int milliseconds);
+int dtclientFd(struct dtclient* client);
+int dtclientSend(struct dtclient* client, uint16_t reqType, dtclient_callback callback, void* context);
+struct dtclient_request dtclientTake(struct dtclient* client);
+bool dtclientAnswers(uint16_t reqType, uint8_t pkt[], size_t n);
+bool dtclientMatch(struct dtclient* client, uint8_t pkt[], size_t n, uint64_t now);
+int dtclientFailAll(struct dtclient* client, int status);
+int dtclientProcess(struct dtclient* client);
+int dtclientNextTimeout(struct dtclient* client);
+void dtclientFinishWait(struct dtclient* client, int status, struct dtclient_response* response, void* context);
+int dtclientRequest(struct dtclient* client, uint16_t reqType, struct dtclient_response* response);
+void dtclientClose(struct dtclient* client);
+char* dtclientError(int status);
+
+#endif
@@ -0,0 +1,179 @@
+// handoff.c
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "handoff.h"
+
+/**
+ * Passes sockets to another process over a Unix socket with SCM_RIGHTS.
+ * The count goes first so that the receiver can check that it expects the
+ * same sockets, then the sockets follow HANDOFF_CHUNK at a time, each
+ * message carrying the port of every socket in it. The Unix socket must
+ * keep message boundaries, i.e. be SOCK_SEQPACKET.
+ *
+ * @param fd The Unix socket.
+ * @param sockets The sockets to pass, which stay open in this process.
+ * @param ports The port each socket is bound to.
+ * @param count The number of sockets.
+ * @return True if every message was sent.
+ * */
+bool handoffSend(int fd, int sockets[], uint16_t ports[], unsigned int count)
+{
+    uint32_t total = count;
+
+    if (send(fd, &total, sizeof(total), MSG_NOSIGNAL) != sizeof(total)) {
+        return false;
+    }
+
+    for (unsigned int first = 0; first < count; first += HANDOFF_CHUNK) {
+
+        unsigned int n = count - first < HANDOFF_CHUNK ? count - first : HANDOFF_CHUNK;
+
+        // the control buffer must be aligned for a cmsghdr
+        union {
+            char buffer[CMSG_SPACE(HANDOFF_CHUNK * sizeof(int))];
+            struct cmsghdr align;
+        } control;
+
+        struct iovec iov = { .iov_base = &ports[first], .iov_len = n * sizeof(uint16_t) };
+        struct msghdr msg = {0};
+        struct cmsghdr* cmsg;
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = CMSG_SPACE(n * sizeof(int));
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(n * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &sockets[first], n * sizeof(int));
+
+        if (sendmsg(fd, &msg, MSG_NOSIGNAL) != (ssize_t) iov.iov_len) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Receives the sockets passed by handoffSend(). The sockets are close on
+ * exec, and if anything goes wrong every socket received so far is closed.
+ *
+ * @param fd The Unix socket.
+ * @param sockets Where the sockets are to be stored.
+ * @param ports Where the port of each socket is to be stored.
+ * @param count The number of sockets expected.
+ * @return True if exactly count sockets were received.
+ * */
+bool handoffReceive(int fd, int sockets[], uint16_t ports[], unsigned int count)
+{
+    uint32_t total;
+    unsigned int received = 0;
+
+    if (recv(fd, &total, sizeof(total), 0) != sizeof(total) || total != count) {
+        return false;
+    }
+
+    while (received < count) {
+
+        union {
+            char buffer[CMSG_SPACE(HANDOFF_CHUNK * sizeof(int))];
+            struct cmsghdr align;
+        } control;
+
+        struct iovec iov = { .iov_base = &ports[received], .iov_len = HANDOFF_CHUNK * sizeof(uint16_t) };
+        struct msghdr msg = {0};
+        struct cmsghdr* cmsg;
+        unsigned int n;
+
+        // never write past the ports that are expected
+        if (count - received < HANDOFF_CHUNK) {
+            iov.iov_len = (count - received) * sizeof(uint16_t);
+        }
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+
+        ssize_t length = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        cmsg = CMSG_FIRSTHDR(&msg);
+
+        if (length <= 0 || cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            break;
+        }
+
+        n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+        // more sockets than were expected are closed rather than stored
+        if (n > count - received) {
+            int* extra = (int*) CMSG_DATA(cmsg);
+
+            for (unsigned int i = 0; i < n; i++) {
+                close(extra[i]);
+            }
+
+            break;
+        }
+
+        memcpy(&sockets[received], CMSG_DATA(cmsg), n * sizeof(int));
+        received += n;
+
+        // each socket must come with its port
+        if ((msg.msg_flags & (MSG_CTRUNC | MSG_TRUNC)) || length != (ssize_t) (n * sizeof(uint16_t))) {
+            break;
+        }
+    }
+
+    if (received == count) {
+        return true;
+    }
+
+    for (unsigned int i = 0; i < received; i++) {
+        close(sockets[i]);
+    }
+
+    return false;
+}
+
+/**
+ * Tells the old process that this one is serving from its sockets.
+ *
+ * @param fd The Unix socket.
+ * @return True if the old process was still there to be told.
+ * */
+bool handoffReady(int fd)
+{
+    char ready = HANDOFF_READY;
+
+    return send(fd, &ready, 1, MSG_NOSIGNAL) == 1;
+}
+
+/**
+ * Waits for the new process to say that it is serving.
+ *
+ * @param fd The Unix socket.
+ * @param timeout How long to wait, in milliseconds.
+ * @return True if the new process is serving, false if it went away or took too long.
+ * */
+bool handoffWait(int fd, int timeout)
+{
+    struct pollfd ready_poll = { .fd = fd, .events = POLLIN };
+    char ready = 0;
+    int result;
+
+    do {
+        result = poll(&ready_poll, 1, timeout);
+    } while (result < 0 && errno == EINTR);
+
+    return result == 1 && recv(fd, &ready, 1, MSG_DONTWAIT) == 1 && ready == HANDOFF_READY;
+}
@@ -0,0 +1,23 @@
+// handoff.h
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// the most descriptors passed in one message, well under the kernel's SCM_MAX_FD
+#define HANDOFF_CHUNK 64
+
+// how long the old server waits for the new one to start serving, in milliseconds
+#define HANDOFF_TIMEOUT 10000
+
+// the byte the new server sends once it is serving from the sockets
+#define HANDOFF_READY 'R'
+
+bool handoffSend(int fd, int sockets[], uint16_t ports[], unsigned int count);
+bool handoffReceive(int fd, int sockets[], uint16_t ports[], unsigned int count);
+bool handoffReady(int fd);
+bool handoffWait(int fd, int timeout);
+
+#endif
@@ -0,0 +1,177 @@
+// histogram.c
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "histogram.h"
+
+/**
+ * Empties a histogram.
+ * 
+ * @param hist The histogram.
+ * */
+void histogramInit(struct histogram* hist)
+{
+    memset(hist, 0, sizeof(struct histogram));
+    hist->min = UINT64_MAX;
+}
+
+/**
+ * Returns the bucket a value falls into. Values below HIST_SUB_BUCKETS
+ * get a bucket each, above that each power of two is split linearly.
+ * 
+ * @param value The value.
+ * @return The index of the bucket.
+ * */
+unsigned int histogramBucket(uint64_t value)
+{
+    if (value < HIST_SUB_BUCKETS) {
+        return value;
+    }
+
+    // the position of the highest set bit, at least HIST_SUB_BITS
+    unsigned int exponent = 63 - __builtin_clzll(value);
+    unsigned int shift = exponent - HIST_SUB_BITS;
+
+    return HIST_SUB_BUCKETS + shift * HIST_SUB_BUCKETS +
+        ((value >> shift) & (HIST_SUB_BUCKETS - 1));
+}
+
+/**
+ * Returns the smallest value that falls into a bucket.
+ * 
+ * @param bucket The index of the bucket.
+ * @return The lower bound of the bucket.
+ * */
+uint64_t histogramBucketLow(unsigned int bucket)
+{
+    if (bucket < HIST_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    unsigned int shift = (bucket - HIST_SUB_BUCKETS) / HIST_SUB_BUCKETS;
+    uint64_t sub = (bucket - HIST_SUB_BUCKETS) % HIST_SUB_BUCKETS;
+
+    return (HIST_SUB_BUCKETS + sub) << shift;
+}
+
+/**
+ * Returns the largest value that falls into a bucket.
+ * 
+ * @param bucket The index of the bucket.
+ * @return The upper bound of the bucket.
+ * */
+uint64_t histogramBucketHigh(unsigned int bucket)
+{
+    if (bucket + 1 == HIST_BUCKETS) {
+        return UINT64_MAX;
+    }
+
+    return histogramBucketLow(bucket + 1) - 1;
+}
+
+/**
+ * Records a single value.
+ * 
+ * @param hist The histogram.
+ * @param value The value, usually a duration in nanoseconds.
+ * */
+void histogramRecord(struct histogram* hist, uint64_t value)
+{
+    hist->counts[histogramBucket(value)]++;
+    hist->count++;
+    hist->sum += value;
+
+    if (value < hist->min) {
+        hist->min = value;
+    }
+
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+/**
+ * Adds every value recorded in one histogram to another.
+ * 
+ * @param dst The histogram to add to.
+ * @param src The histogram to add.
+ * */
+void histogramMerge(struct histogram* dst, struct histogram* src)
+{
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+
+    dst->count += src->count;
+    dst->sum += src->sum;
+
+    if (src->min < dst->min) {
+        dst->min = src->min;
+    }
+
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+/**
+ * Returns an upper bound on the value below which a percentage of the
+ * recorded values fall.
+ * 
+ * @param hist The histogram.
+ * @param percentile The percentage, e.g. 99.9.
+ * @return The value at the percentile, or 0 if nothing was recorded.
+ * */
+uint64_t histogramPercentile(struct histogram* hist, double percentile)
+{
+    if (hist->count == 0) {
+        return 0;
+    }
+
+    // the number of values that must be at or below the result
+    uint64_t rank = (uint64_t)(percentile / 100.0 * hist->count + 0.999999);
+    uint64_t seen = 0;
+
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+
+        seen += hist->counts[i];
+
+        if (seen >= rank) {
+            uint64_t high = histogramBucketHigh(i);
+            return high < hist->max ? high : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+/**
+ * Prints every non-empty bucket with its count and the cumulative percentage.
+ * 
+ * @param hist The histogram.
+ * @param stream Where to print it.
+ * */
+void histogramPrint(struct histogram* hist, FILE* stream)
+{
+    uint64_t seen = 0;
+
+    fprintf(stream, "%14s %14s %12s %9s\n", "from (ns)", "to (ns)", "count", "cumul %");
+
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+
+        if (hist->counts[i] == 0) {
+            continue;
+        }
+
+        seen += hist->counts[i];
+
+        fprintf(stream, "%14lu %14lu %12lu %8.3f%%\n", histogramBucketLow(i),
+            histogramBucketHigh(i), hist->counts[i], 100.0 * seen / hist->count);
+    }
+}
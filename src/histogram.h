@@ -0,0 +1,35 @@
+// histogram.h
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Every power of two is split into this many linear sub-buckets,
+// which keeps each recorded value within 1/16th of its true value.
+#define HIST_SUB_BUCKETS 16
+#define HIST_SUB_BITS 4
+
+// enough buckets for any uint64_t value
+#define HIST_BUCKETS (HIST_SUB_BUCKETS + (64 - HIST_SUB_BITS) * HIST_SUB_BUCKETS)
+
+// A log-linear histogram of durations in nanoseconds
+struct histogram {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+};
+
+void histogramInit(struct histogram* hist);
+void histogramRecord(struct histogram* hist, uint64_t value);
+void histogramMerge(struct histogram* dst, struct histogram* src);
+uint64_t histogramPercentile(struct histogram* hist, double percentile);
+uint64_t histogramBucketLow(unsigned int bucket);
+uint64_t histogramBucketHigh(unsigned int bucket);
+unsigned int histogramBucket(uint64_t value);
+void histogramPrint(struct histogram* hist, FILE* stream);
+
+#endif
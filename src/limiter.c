@@ -0,0 +1,230 @@
+// limiter.c
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "limiter.h"
+#include "utils.h"
+
+/**
+ * Allocates an empty table. The table is never resized, once three
+ * quarters of the slots are used the least recently seen address is
+ * evicted to make room for each new one.
+ * 
+ * @param limiter The limiter to initialise.
+ * @param slots The number of slots, a power of two.
+ * @param rate The number of requests per second each address may make.
+ * @param burst The most requests an address may make at once after being idle.
+ * */
+void limiterInit(struct limiter* limiter, uint32_t slots, double rate, double burst)
+{
+    limiter->entries = calloc(slots, sizeof(struct limiter_entry));
+
+    if (limiter->entries == NULL) {
+        error("could not allocate the rate limiter", 3);
+    }
+
+    limiter->slots = slots;
+    limiter->capacity = slots / 4 * 3;
+    limiter->count = 0;
+    limiter->newest = LIMITER_NONE;
+    limiter->oldest = LIMITER_NONE;
+    limiter->rate = rate;
+    limiter->burst = burst;
+    limiter->limited = 0;
+    limiter->evictions = 0;
+}
+
+/**
+ * Returns the slot an address would be stored in if there were no collisions.
+ * 
+ * @param limiter The limiter.
+ * @param addr The address in network byte order.
+ * @return The slot.
+ * */
+uint32_t limiterHome(struct limiter* limiter, uint32_t addr)
+{
+    // mix the bits so that neighbouring addresses land far apart
+    addr ^= addr >> 16;
+    addr *= 0x7FEB352D;
+    addr ^= addr >> 15;
+    addr *= 0x846CA68B;
+    addr ^= addr >> 16;
+
+    return addr & (limiter->slots - 1);
+}
+
+/**
+ * Finds the slot holding an address, or the empty slot it would go in.
+ * 
+ * @param limiter The limiter.
+ * @param addr The address in network byte order.
+ * @return The slot.
+ * */
+uint32_t limiterFind(struct limiter* limiter, uint32_t addr)
+{
+    uint32_t slot = limiterHome(limiter, addr);
+
+    while (limiter->entries[slot].used && limiter->entries[slot].addr != addr) {
+        slot = (slot + 1) & (limiter->slots - 1);
+    }
+
+    return slot;
+}
+
+/**
+ * Takes an entry out of the least recently used list.
+ * 
+ * @param limiter The limiter.
+ * @param slot The slot of the entry.
+ * */
+void limiterUnlink(struct limiter* limiter, uint32_t slot)
+{
+    struct limiter_entry* entry = &limiter->entries[slot];
+
+    if (entry->newer != LIMITER_NONE) {
+        limiter->entries[entry->newer].older = entry->older;
+    } else {
+        limiter->newest = entry->older;
+    }
+
+    if (entry->older != LIMITER_NONE) {
+        limiter->entries[entry->older].newer = entry->newer;
+    } else {
+        limiter->oldest = entry->newer;
+    }
+}
+
+/**
+ * Puts an entry at the front of the least recently used list.
+ * 
+ * @param limiter The limiter.
+ * @param slot The slot of the entry.
+ * */
+void limiterTouch(struct limiter* limiter, uint32_t slot)
+{
+    struct limiter_entry* entry = &limiter->entries[slot];
+
+    entry->newer = LIMITER_NONE;
+    entry->older = limiter->newest;
+
+    if (limiter->newest != LIMITER_NONE) {
+        limiter->entries[limiter->newest].newer = slot;
+    } else {
+        limiter->oldest = slot;
+    }
+
+    limiter->newest = slot;
+}
+
+/**
+ * Removes the least recently seen address. The entries after it in the
+ * same run are shifted back so that no lookup ever stops short at the
+ * hole, which means the table needs no tombstones.
+ * 
+ * @param limiter The limiter.
+ * */
+void limiterEvict(struct limiter* limiter)
+{
+    uint32_t mask = limiter->slots - 1;
+    uint32_t hole = limiter->oldest;
+    uint32_t next = hole;
+
+    limiterUnlink(limiter, hole);
+    limiter->entries[hole].used = false;
+    limiter->count--;
+    limiter->evictions++;
+
+    while (true) {
+
+        next = (next + 1) & mask;
+
+        struct limiter_entry* entry = &limiter->entries[next];
+
+        if (!entry->used) {
+            return;
+        }
+
+        // an entry whose home lies between the hole and itself must stay put
+        uint32_t home = limiterHome(limiter, entry->addr);
+
+        if (((next - home) & mask) < ((next - hole) & mask)) {
+            continue;
+        }
+
+        // move it into the hole and point its neighbours at its new slot
+        limiter->entries[hole] = *entry;
+        entry->used = false;
+
+        if (entry->newer != LIMITER_NONE) {
+            limiter->entries[entry->newer].older = hole;
+        } else {
+            limiter->newest = hole;
+        }
+
+        if (entry->older != LIMITER_NONE) {
+            limiter->entries[entry->older].newer = hole;
+        } else {
+            limiter->oldest = hole;
+        }
+
+        hole = next;
+    }
+}
+
+/**
+ * Decides whether a request from an address should be answered. Each
+ * address has a bucket of up to burst tokens that fills at rate tokens
+ * per second, and each answered request takes a token.
+ * 
+ * @param limiter The limiter.
+ * @param addr The address the request came from.
+ * @param now The time from the monotonic clock, in nanoseconds.
+ * @return True if the request should be answered.
+ * */
+bool limiterAllow(struct limiter* limiter, struct in_addr addr, uint64_t now)
+{
+    uint32_t slot = limiterFind(limiter, addr.s_addr);
+    struct limiter_entry* entry = &limiter->entries[slot];
+
+    if (entry->used) {
+
+        // top the bucket up for the time since it was last seen
+        entry->tokens += (now - entry->refilled) * limiter->rate / 1e9;
+        entry->refilled = now;
+
+        if (entry->tokens > limiter->burst) {
+            entry->tokens = limiter->burst;
+        }
+
+        limiterUnlink(limiter, slot);
+
+    } else {
+
+        // make room by forgetting whoever has been quiet the longest
+        if (limiter->count == limiter->capacity) {
+            limiterEvict(limiter);
+            slot = limiterFind(limiter, addr.s_addr);
+            entry = &limiter->entries[slot];
+        }
+
+        entry->addr = addr.s_addr;
+        entry->used = true;
+        entry->tokens = limiter->burst;
+        entry->refilled = now;
+        limiter->count++;
+    }
+
+    limiterTouch(limiter, slot);
+
+    if (entry->tokens >= 1) {
+        entry->tokens -= 1;
+        return true;
+    }
+
+    limiter->limited++;
+
+    return false;
+}
@@ -0,0 +1,59 @@
+// limiter.h
+
+#ifndef LIMITER_H
+#define LIMITER_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// the default number of slots in each worker's table, a power of two
+#define DEFAULT_LIMITER_SLOTS 65536
+
+// marks the end of the least recently used list
+#define LIMITER_NONE 0xFFFFFFFF
+
+// The token bucket of a single client address
+struct limiter_entry {
+
+    // the address in network byte order, and whether the slot holds one
+    uint32_t addr;
+    bool used;
+
+    // the neighbours in the least recently used list, by slot
+    uint32_t newer;
+    uint32_t older;
+
+    // the tokens left and when they were last topped up, in nanoseconds
+    double tokens;
+    uint64_t refilled;
+};
+
+// A fixed size open addressing table of token buckets, one per client
+// address, that forgets the least recently seen address when it fills up
+struct limiter {
+
+    struct limiter_entry* entries;
+    uint32_t slots;
+
+    // the most addresses kept before the oldest is evicted, and how many are kept now
+    uint32_t capacity;
+    uint32_t count;
+
+    // the most and least recently seen addresses
+    uint32_t newest;
+    uint32_t oldest;
+
+    // the tokens added per second and the most that can be saved up
+    double rate;
+    double burst;
+
+    // the requests refused and the addresses forgotten to make room
+    uint64_t limited;
+    uint64_t evictions;
+};
+
+void limiterInit(struct limiter* limiter, uint32_t slots, double rate, double burst);
+bool limiterAllow(struct limiter* limiter, struct in_addr addr, uint64_t now);
+
+#endif
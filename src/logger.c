@@ -0,0 +1,189 @@
+// logger.c
+
+#include <arpa/inet.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clock.h"
+#include "logger.h"
+#include "protocol.h"
+#include "utils.h"
+
+// The descriptions of each outcome, indexed by the OUTCOME_ definitions
+const char* OUTCOMES[5] = {
+    "response sent",
+    "response failed to send",
+    "invalid request - packet discarded",
+    "network error - packet discarded",
+    "client over its rate limit - packet discarded"
+};
+
+/**
+ * Allocates a ring for each worker and starts the writer thread.
+ * 
+ * @param logger The logger to start.
+ * @param ring_count The number of rings, one per worker.
+ * */
+void loggerStart(struct logger* logger, unsigned int ring_count)
+{
+    logger->ring_count = ring_count;
+    logger->rings = aligned_alloc(64, ring_count * sizeof(struct log_ring));
+
+    if (logger->rings == NULL) {
+        error("could not allocate the log rings", 3);
+    }
+
+    memset(logger->rings, 0, ring_count * sizeof(struct log_ring));
+
+    logger->show_worker = ring_count > 1;
+    logger->running = true;
+
+    if (pthread_create(&logger->thread, NULL, runLogger, logger) != 0) {
+        error("could not start the logger", 3);
+    }
+}
+
+/**
+ * Stops the writer thread once it has written out every record.
+ * 
+ * @param logger The logger to stop.
+ * */
+void loggerStop(struct logger* logger)
+{
+    __atomic_store_n(&logger->running, false, __ATOMIC_RELEASE);
+    pthread_join(logger->thread, NULL);
+}
+
+/**
+ * Adds a record to a ring. This never blocks, if the ring is full the
+ * record is dropped and counted instead.
+ * Must only be called by the worker that owns the ring.
+ * 
+ * @param ring The ring.
+ * @param record The record to copy into the ring.
+ * @return False if the record was dropped.
+ * */
+bool logPush(struct log_ring* ring, struct log_record* record)
+{
+    uint64_t head = ring->head;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == LOG_RING_SIZE) {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    ring->records[head & (LOG_RING_SIZE - 1)] = *record;
+
+    // publish the record only after it has been copied
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/**
+ * Formats a record as a line of text, e.g.
+ * 2018-06-10 12:45:00 - 127.0.0.1 - English date requested - response sent
+ * 
+ * @param record The record.
+ * @param show_worker If true, the worker is included.
+ * @param line The buffer to format the line into.
+ * @param n The size of the buffer.
+ * @return The length of the line.
+ * */
+size_t logFormat(struct log_record* record, bool show_worker, char* line, size_t n)
+{
+    // the formatted time is reused for every record within the same second
+    static time_t last_second = -1;
+    static char time_string[32];
+
+    char client_ip_address_string[INET_ADDRSTRLEN];
+    char worker_string[16] = {0};
+    char request_string[48] = {0};
+
+    if (record->time.tv_sec != last_second) {
+        struct tm info;
+
+        clockLocalTime(record->time.tv_sec, &info);
+        strftime(time_string, sizeof(time_string), "%F %H:%M:%S", &info);
+        last_second = record->time.tv_sec;
+    }
+
+    if (record->local) {
+        strcpy(client_ip_address_string, "local");
+    } else {
+        inet_ntop(AF_INET, &record->client_addr, client_ip_address_string, INET_ADDRSTRLEN);
+    }
+
+    if (show_worker) {
+        sprintf(worker_string, " - worker %u", record->worker);
+    }
+
+    // only valid requests have a language and type worth printing
+    if (record->request_type != 0) {
+        sprintf(request_string, "%s %s requested - ",
+            getLangName(record->language_code), getRequestTypeString(record->request_type));
+    }
+
+    return snprintf(line, n, "%s%s - %s - %s%s\n", time_string, worker_string,
+        client_ip_address_string, request_string, OUTCOMES[record->outcome]);
+}
+
+/**
+ * The writer thread. Drains every ring into a buffer and writes the
+ * buffer to stdout in one go, sleeping whenever there is nothing to do.
+ * 
+ * @param arg The logger.
+ * @return NULL once the logger has been stopped and the rings are empty.
+ * */
+void* runLogger(void* arg)
+{
+    struct logger* logger = (struct logger*) arg;
+
+    // holds a batch of formatted lines
+    static char buffer[LOG_BUFFER_LEN];
+
+    struct timespec idle = { 0, LOG_IDLE_NS };
+
+    while (true) {
+
+        // read the flag first so that a final pass always follows the stop
+        bool running = __atomic_load_n(&logger->running, __ATOMIC_ACQUIRE);
+        size_t length = 0;
+
+        for (unsigned int r = 0; r < logger->ring_count; r++) {
+
+            struct log_ring* ring = &logger->rings[r];
+            uint64_t tail = ring->tail;
+            uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+            for (; tail != head; tail++) {
+
+                // flush the buffer when the next line might not fit
+                if (LOG_BUFFER_LEN - length < 256) {
+                    fwrite(buffer, 1, length, stdout);
+                    length = 0;
+                }
+
+                length += logFormat(&ring->records[tail & (LOG_RING_SIZE - 1)],
+                    logger->show_worker, buffer + length, LOG_BUFFER_LEN - length);
+            }
+
+            // hand the slots back to the worker
+            __atomic_store_n(&ring->written, ring->written + (tail - ring->tail), __ATOMIC_RELAXED);
+            __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        }
+
+        if (length > 0) {
+            fwrite(buffer, 1, length, stdout);
+            fflush(stdout);
+        } else if (!running) {
+            return NULL;
+        } else {
+            nanosleep(&idle, NULL);
+        }
+    }
+}
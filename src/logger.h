@@ -0,0 +1,81 @@
+// logger.h
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// the number of records each ring can hold, must be a power of two
+#define LOG_RING_SIZE 4096
+
+// how long the writer sleeps when every ring is empty, in nanoseconds
+#define LOG_IDLE_NS 5000000
+
+// the size of the buffer the writer formats a batch of records into
+#define LOG_BUFFER_LEN 65536
+
+// What happened to a request
+#define OUTCOME_SENT 0
+#define OUTCOME_SEND_FAILED 1
+#define OUTCOME_INVALID 2
+#define OUTCOME_NETWORK_ERROR 3
+#define OUTCOME_LIMITED 4
+
+// A fixed-size binary log entry, formatted later by the writer thread
+struct log_record {
+    struct timespec time;
+    struct in_addr client_addr;
+    uint16_t language_code;
+    uint16_t request_type;
+    uint16_t worker;
+    uint8_t outcome;
+
+    // true if the client is on this host and sent the request to a Unix socket
+    bool local;
+};
+
+// A single-producer single-consumer ring of records. The producer only
+// writes head and the consumer only writes tail, and they live on
+// separate cache lines so that the two threads do not contend.
+struct log_ring {
+
+    // the next record to be written, owned by the worker
+    uint64_t head __attribute__((aligned(64)));
+
+    // the records that were thrown away because the ring was full
+    uint64_t dropped;
+
+    // the next record to be read, owned by the writer
+    uint64_t tail __attribute__((aligned(64)));
+
+    // the records that have been written out
+    uint64_t written;
+
+    struct log_record records[LOG_RING_SIZE] __attribute__((aligned(64)));
+};
+
+// The rings of every worker and the thread that drains them
+struct logger {
+    struct log_ring* rings;
+    unsigned int ring_count;
+
+    pthread_t thread;
+
+    // cleared to make the writer drain the rings one last time and exit
+    bool running;
+
+    // if true, the worker is included in each line
+    bool show_worker;
+};
+
+void loggerStart(struct logger* logger, unsigned int ring_count);
+void loggerStop(struct logger* logger);
+bool logPush(struct log_ring* ring, struct log_record* record);
+void* runLogger(void* arg);
+size_t logFormat(struct log_record* record, bool show_worker, char* line, size_t n);
+
+#endif
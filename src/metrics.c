@@ -0,0 +1,370 @@
+// metrics.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "histogram.h"
+#include "logger.h"
+#include "metrics.h"
+#include "utils.h"
+
+// The labels of each request type and outcome in a snapshot
+const char* METRIC_TYPE_NAMES[METRIC_TYPES] = { "unknown", "date", "time", "batch" };
+const char* METRIC_OUTCOME_NAMES[METRIC_OUTCOMES] = {
+    "sent", "send_failed", "invalid", "network_error", "limited"
+};
+
+// The service time percentiles included in a snapshot
+const double METRIC_QUANTILES[] = { 50, 90, 99, 99.9 };
+#define METRIC_QUANTILE_COUNT (sizeof(METRIC_QUANTILES) / sizeof(METRIC_QUANTILES[0]))
+
+/**
+ * Sets up an empty set of counters.
+ *
+ * @param metrics The counters.
+ * @param port_count The number of ports counted.
+ * @param timestamps True if the time datagrams spend in the kernel is recorded.
+ * */
+void metricsInit(struct worker_metrics* metrics, unsigned int port_count, bool timestamps)
+{
+    metrics->port_count = port_count;
+    metrics->ports = aligned_alloc(METRICS_ALIGN, port_count * sizeof(struct port_metrics));
+
+    if (metrics->ports == NULL) {
+        error("could not allocate the metrics", 3);
+    }
+
+    memset(metrics->ports, 0, port_count * sizeof(struct port_metrics));
+
+    for (unsigned int t = 0; t < METRIC_TYPES; t++) {
+        histogramInit(&metrics->service[t]);
+    }
+
+    metrics->queueing = NULL;
+    metrics->sojourn = NULL;
+
+    if (!timestamps) {
+        return;
+    }
+
+    // rounded up to whole cache lines like the rest of the worker's counters
+    size_t length = (port_count * sizeof(struct histogram) + METRICS_ALIGN - 1) / METRICS_ALIGN * METRICS_ALIGN;
+
+    metrics->queueing = aligned_alloc(METRICS_ALIGN, length);
+    metrics->sojourn = aligned_alloc(METRICS_ALIGN, length);
+
+    if (metrics->queueing == NULL || metrics->sojourn == NULL) {
+        error("could not allocate the metrics", 3);
+    }
+
+    for (unsigned int p = 0; p < port_count; p++) {
+        histogramInit(&metrics->queueing[p]);
+        histogramInit(&metrics->sojourn[p]);
+    }
+}
+
+/**
+ * Frees the per-port counters set up by metricsInit().
+ *
+ * @param metrics The counters.
+ * */
+void metricsClose(struct worker_metrics* metrics)
+{
+    free(metrics->ports);
+    free(metrics->queueing);
+    free(metrics->sojourn);
+    metrics->ports = NULL;
+    metrics->queueing = NULL;
+    metrics->sojourn = NULL;
+    metrics->port_count = 0;
+}
+
+/**
+ * Allocates a set of counters for a worker, aligned so that the histograms
+ * do not share a cache line with anything another thread writes.
+ *
+ * @param port_count The number of ports counted.
+ * @param timestamps True if the time datagrams spend in the kernel is recorded.
+ * @return The counters.
+ * */
+struct worker_metrics* metricsCreate(unsigned int port_count, bool timestamps)
+{
+    struct worker_metrics* metrics = aligned_alloc(METRICS_ALIGN, sizeof(struct worker_metrics));
+
+    if (metrics == NULL) {
+        error("could not allocate the metrics", 3);
+    }
+
+    metricsInit(metrics, port_count, timestamps);
+
+    return metrics;
+}
+
+/**
+ * Returns the monotonic clock, which service times are measured with.
+ *
+ * @return The time in nanoseconds.
+ * */
+uint64_t metricsNow()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Returns the realtime clock, which the kernel timestamps datagrams with.
+ *
+ * @return The time in nanoseconds since the epoch.
+ * */
+uint64_t metricsWallClock()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Counts a request. Only the owner of the counters may call this.
+ *
+ * @param metrics The counters.
+ * @param port The index of the port the request arrived on.
+ * @param request_type The type of request, or 0 if it could not be read.
+ * @param outcome What happened to the request, one of the OUTCOME_ definitions.
+ * */
+void metricsCount(struct worker_metrics* metrics, unsigned int port, uint16_t request_type, uint8_t outcome)
+{
+    if (request_type >= METRIC_TYPES) {
+        request_type = 0;
+    }
+
+    metrics->ports[port].outcomes[request_type][outcome]++;
+}
+
+/**
+ * Records how long a request took to answer. Only the owner of the
+ * counters may call this.
+ *
+ * @param metrics The counters.
+ * @param request_type The type of request.
+ * @param nanoseconds The time from receiving the request to sending the response.
+ * */
+void metricsService(struct worker_metrics* metrics, uint16_t request_type, uint64_t nanoseconds)
+{
+    if (request_type >= METRIC_TYPES) {
+        request_type = 0;
+    }
+
+    histogramRecord(&metrics->service[request_type], nanoseconds);
+}
+
+/**
+ * Records how long a datagram waited in the socket queue before the worker
+ * picked it up. Only the owner of the counters may call this.
+ *
+ * @param metrics The counters, which must have been set up with timestamps.
+ * @param port The index of the port the datagram arrived on.
+ * @param arrived When the kernel timestamped the datagram, 0 if it did not.
+ * @param received When the worker received it, from the same clock.
+ * */
+void metricsQueueing(struct worker_metrics* metrics, unsigned int port, uint64_t arrived, uint64_t received)
+{
+    // the realtime clock can be stepped backwards under us
+    if (arrived != 0 && received >= arrived) {
+        histogramRecord(&metrics->queueing[port], received - arrived);
+    }
+}
+
+/**
+ * Records how long it took from a request arriving to its response being
+ * sent. Only the owner of the counters may call this.
+ *
+ * @param metrics The counters, which must have been set up with timestamps.
+ * @param port The index of the port the request arrived on.
+ * @param arrived When the kernel timestamped the request, 0 if it did not.
+ * @param sent When the response was sent, from the same clock.
+ * */
+void metricsSojourn(struct worker_metrics* metrics, unsigned int port, uint64_t arrived, uint64_t sent)
+{
+    if (arrived != 0 && sent >= arrived) {
+        histogramRecord(&metrics->sojourn[port], sent - arrived);
+    }
+}
+
+/**
+ * Adds a histogram that another thread is still recording into to one of
+ * our own, reading each field once with a relaxed load.
+ *
+ * @param dst The histogram to add to.
+ * @param src The histogram being recorded into.
+ * */
+void metricsMerge(struct histogram* dst, struct histogram* src)
+{
+    uint64_t min = __atomic_load_n(&src->min, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += __atomic_load_n(&src->counts[i], __ATOMIC_RELAXED);
+    }
+
+    dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+
+    if (min < dst->min) {
+        dst->min = min;
+    }
+
+    if (max > dst->max) {
+        dst->max = max;
+    }
+}
+
+/**
+ * Adds a worker's counters to a snapshot while the worker carries on.
+ * Each counter is read once with a relaxed load, so the snapshot may be a
+ * few requests behind but never holds a torn value.
+ *
+ * @param total The snapshot, which must count the same ports.
+ * @param metrics The worker's counters.
+ * */
+void metricsCollect(struct worker_metrics* total, struct worker_metrics* metrics)
+{
+    for (unsigned int p = 0; p < total->port_count; p++) {
+        for (unsigned int t = 0; t < METRIC_TYPES; t++) {
+            for (unsigned int o = 0; o < METRIC_OUTCOMES; o++) {
+                total->ports[p].outcomes[t][o] +=
+                    __atomic_load_n(&metrics->ports[p].outcomes[t][o], __ATOMIC_RELAXED);
+            }
+        }
+
+        total->ports[p].overflows += __atomic_load_n(&metrics->ports[p].overflows, __ATOMIC_RELAXED);
+
+        if (total->queueing != NULL && metrics->queueing != NULL) {
+            metricsMerge(&total->queueing[p], &metrics->queueing[p]);
+            metricsMerge(&total->sojourn[p], &metrics->sojourn[p]);
+        }
+    }
+
+    for (unsigned int t = 0; t < METRIC_TYPES; t++) {
+        metricsMerge(&total->service[t], &metrics->service[t]);
+    }
+}
+
+/**
+ * Returns the number of datagrams a port received, which is every request
+ * counted apart from the receives that failed.
+ *
+ * @param metrics The counters.
+ * @param port The index of the port.
+ * @return The number of datagrams.
+ * */
+uint64_t metricsReceived(struct worker_metrics* metrics, unsigned int port)
+{
+    uint64_t received = 0;
+
+    for (unsigned int t = 0; t < METRIC_TYPES; t++) {
+        for (unsigned int o = 0; o < METRIC_OUTCOMES; o++) {
+            if (o != OUTCOME_NETWORK_ERROR) {
+                received += metrics->ports[port].outcomes[t][o];
+            }
+        }
+    }
+
+    return received;
+}
+
+/**
+ * Writes a snapshot as text, one "name{labels} value" line per counter in
+ * the Prometheus exposition format. Counters that are still zero are left
+ * out, and if the text does not fit the lines that do not fit are dropped.
+ *
+ * @param metrics The snapshot.
+ * @param ports The name of each port counted, its number or the path of a Unix socket.
+ * @param text Where to write the text, which is not terminated.
+ * @param n The size of text.
+ * @return The length of the text.
+ * */
+size_t metricsFormat(struct worker_metrics* metrics, char* ports[], char* text, size_t n)
+{
+    // room for a Unix socket path as the port
+    char line[320];
+    size_t length = 0;
+    int line_len;
+
+    // appends a line if it fits
+    #define METRICS_LINE(...) \
+        line_len = snprintf(line, sizeof(line), __VA_ARGS__); \
+        if (line_len > 0 && length + line_len <= n) { \
+            memcpy(text + length, line, line_len); \
+            length += line_len; \
+        }
+
+    for (unsigned int p = 0; p < metrics->port_count; p++) {
+
+        uint64_t received = metricsReceived(metrics, p);
+
+        if (received > 0) {
+            METRICS_LINE("dt_received_total{port=\"%s\"} %lu\n", ports[p], received);
+        }
+
+        for (unsigned int t = 0; t < METRIC_TYPES; t++) {
+            for (unsigned int o = 0; o < METRIC_OUTCOMES; o++) {
+
+                uint64_t count = metrics->ports[p].outcomes[t][o];
+
+                if (count == 0) {
+                    continue;
+                }
+
+                METRICS_LINE("dt_requests_total{port=\"%s\",type=\"%s\",outcome=\"%s\"} %lu\n",
+                    ports[p], METRIC_TYPE_NAMES[t], METRIC_OUTCOME_NAMES[o], count);
+            }
+        }
+
+        if (metrics->ports[p].overflows > 0) {
+            METRICS_LINE("dt_overflows_total{port=\"%s\"} %lu\n", ports[p], metrics->ports[p].overflows);
+        }
+
+        if (metrics->queueing == NULL) {
+            continue;
+        }
+
+        for (unsigned int q = 0; q < METRIC_QUANTILE_COUNT && metrics->queueing[p].count > 0; q++) {
+            METRICS_LINE("dt_queueing_ns{port=\"%s\",quantile=\"%g\"} %lu\n", ports[p],
+                METRIC_QUANTILES[q] / 100, histogramPercentile(&metrics->queueing[p], METRIC_QUANTILES[q]));
+        }
+
+        for (unsigned int q = 0; q < METRIC_QUANTILE_COUNT && metrics->sojourn[p].count > 0; q++) {
+            METRICS_LINE("dt_sojourn_ns{port=\"%s\",quantile=\"%g\"} %lu\n", ports[p],
+                METRIC_QUANTILES[q] / 100, histogramPercentile(&metrics->sojourn[p], METRIC_QUANTILES[q]));
+        }
+    }
+
+    for (unsigned int t = 0; t < METRIC_TYPES; t++) {
+
+        struct histogram* hist = &metrics->service[t];
+
+        if (hist->count == 0) {
+            continue;
+        }
+
+        for (unsigned int q = 0; q < METRIC_QUANTILE_COUNT; q++) {
+            METRICS_LINE("dt_service_ns{type=\"%s\",quantile=\"%g\"} %lu\n", METRIC_TYPE_NAMES[t],
+                METRIC_QUANTILES[q] / 100, histogramPercentile(hist, METRIC_QUANTILES[q]));
+        }
+
+        METRICS_LINE("dt_service_ns_sum{type=\"%s\"} %lu\n", METRIC_TYPE_NAMES[t], hist->sum);
+        METRICS_LINE("dt_service_ns_count{type=\"%s\"} %lu\n", METRIC_TYPE_NAMES[t], hist->count);
+    }
+
+    #undef METRICS_LINE
+
+    return length;
+}
@@ -0,0 +1,66 @@
+// metrics.h
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "histogram.h"
+
+// the size of a cache line, no two threads' counters share one
+#define METRICS_ALIGN 64
+
+// the request types counted, with 0 for requests whose type could not be read
+// and REQ_BATCH for batch requests
+#define METRIC_TYPES 4
+
+// the outcomes counted, one for each OUTCOME_ definition
+#define METRIC_OUTCOMES 5
+
+// What happened to the requests that arrived on one port, by request type
+// and outcome, padded out so that each port has its own cache lines
+struct port_metrics {
+    uint64_t outcomes[METRIC_TYPES][METRIC_OUTCOMES];
+
+    // the datagrams the kernel dropped because the socket's receive queue
+    // was full, as last reported with a datagram by SO_RXQ_OVFL
+    uint64_t overflows;
+} __attribute__((aligned(METRICS_ALIGN)));
+
+// The counters of a single worker. Only the worker writes them, so they
+// are plain increments, and anyone may read them at any time with relaxed
+// loads. A snapshot sums them into a set of its own.
+struct worker_metrics {
+
+    // the counters of each port, in the same order as the listeners
+    struct port_metrics* ports;
+    unsigned int port_count;
+
+    // the time from receiving each answered request to handing its
+    // response to the kernel, by request type
+    struct histogram service[METRIC_TYPES] __attribute__((aligned(METRICS_ALIGN)));
+
+    // the time from the kernel timestamping each datagram to the worker
+    // picking it up, and to its response being sent, by port, or NULL if
+    // the sockets do not timestamp their datagrams
+    struct histogram* queueing;
+    struct histogram* sojourn;
+};
+
+void metricsInit(struct worker_metrics* metrics, unsigned int port_count, bool timestamps);
+void metricsClose(struct worker_metrics* metrics);
+struct worker_metrics* metricsCreate(unsigned int port_count, bool timestamps);
+uint64_t metricsNow();
+uint64_t metricsWallClock();
+void metricsCount(struct worker_metrics* metrics, unsigned int port, uint16_t request_type, uint8_t outcome);
+void metricsService(struct worker_metrics* metrics, uint16_t request_type, uint64_t nanoseconds);
+void metricsQueueing(struct worker_metrics* metrics, unsigned int port, uint64_t arrived, uint64_t received);
+void metricsSojourn(struct worker_metrics* metrics, unsigned int port, uint64_t arrived, uint64_t sent);
+void metricsMerge(struct histogram* dst, struct histogram* src);
+void metricsCollect(struct worker_metrics* total, struct worker_metrics* metrics);
+uint64_t metricsReceived(struct worker_metrics* metrics, unsigned int port);
+size_t metricsFormat(struct worker_metrics* metrics, char* ports[], char* text, size_t n);
+
+#endif
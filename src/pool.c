@@ -0,0 +1,92 @@
+// pool.c
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+#include "utils.h"
+
+/**
+ * Allocates the buffers of a pool, all of them free.
+ * 
+ * @param pool The pool to initialise.
+ * @param count The number of buffers.
+ * @param buffer_len The length of each buffer, which is rounded up to a whole number of cache lines.
+ * */
+void poolInit(struct packet_pool* pool, unsigned int count, size_t buffer_len)
+{
+    memset(pool, 0, sizeof(struct packet_pool));
+
+    pool->buffer_len = (buffer_len + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+    pool->count = count;
+    pool->memory = aligned_alloc(POOL_ALIGN, pool->buffer_len * count);
+    pool->free = calloc(count, sizeof(uint8_t*));
+
+    if (pool->memory == NULL || pool->free == NULL) {
+        error("could not allocate the packet pool", 3);
+    }
+
+    // fault every page in now, so that they are placed on the node of the
+    // thread that made the pool rather than of whoever first receives into them
+    memset(pool->memory, 0, pool->buffer_len * count);
+
+    // the first buffer ends up on top of the stack
+    for (unsigned int i = 0; i < count; i++) {
+        pool->free[i] = pool->memory + (size_t) (count - 1 - i) * pool->buffer_len;
+    }
+
+    pool->free_count = count;
+}
+
+/**
+ * Takes up to n buffers from the pool.
+ * 
+ * @param pool The pool.
+ * @param buffers Where the buffers are to be stored.
+ * @param n The number of buffers wanted.
+ * @return The number of buffers taken, which is less than n if the pool ran out.
+ * */
+unsigned int poolAlloc(struct packet_pool* pool, uint8_t* buffers[], unsigned int n)
+{
+    unsigned int taken = n < pool->free_count ? n : pool->free_count;
+
+    if (taken < n) {
+        pool->exhausted++;
+    }
+
+    pool->free_count -= taken;
+    memcpy(buffers, &pool->free[pool->free_count], taken * sizeof(uint8_t*));
+
+    pool->allocations += taken;
+
+    if (pool->count - pool->free_count > pool->high_water) {
+        pool->high_water = pool->count - pool->free_count;
+    }
+
+    return taken;
+}
+
+/**
+ * Returns buffers to the pool.
+ * 
+ * @param pool The pool the buffers were taken from.
+ * @param buffers The buffers.
+ * @param n The number of buffers.
+ * */
+void poolFree(struct packet_pool* pool, uint8_t* buffers[], unsigned int n)
+{
+    memcpy(&pool->free[pool->free_count], buffers, n * sizeof(uint8_t*));
+    pool->free_count += n;
+}
+
+/**
+ * Returns the number of buffers that have been taken and not returned.
+ * 
+ * @param pool The pool.
+ * @return The number of buffers in use.
+ * */
+unsigned int poolInUse(struct packet_pool* pool)
+{
+    return pool->count - pool->free_count;
+}
@@ -0,0 +1,38 @@
+// pool.h
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// buffers are rounded up to whole cache lines so that no two share one
+#define POOL_ALIGN 64
+
+// A fixed set of equally sized packet buffers owned by a single thread.
+// Everything is allocated up front, so taking and returning buffers never
+// calls malloc() and never takes a lock.
+struct packet_pool {
+
+    // the buffers, one aligned block carved into count pieces
+    uint8_t* memory;
+    size_t buffer_len;
+    unsigned int count;
+
+    // the buffers that are free, used as a stack so the warmest is reused first
+    uint8_t** free;
+    unsigned int free_count;
+
+    // the most buffers that have been taken at once, the buffers handed
+    // out, and the requests that got fewer buffers than they asked for
+    unsigned int high_water;
+    uint64_t allocations;
+    uint64_t exhausted;
+};
+
+void poolInit(struct packet_pool* pool, unsigned int count, size_t buffer_len);
+unsigned int poolAlloc(struct packet_pool* pool, uint8_t* buffers[], unsigned int n);
+void poolFree(struct packet_pool* pool, uint8_t* buffers[], unsigned int n);
+unsigned int poolInUse(struct packet_pool* pool);
+
+#endif
@@ -2,27 +2,118 @@
 
 #include <stdio.h>
 #include <ctype.h>
+#include <string.h>
 #include <time.h>
 
+#include "clock.h"
 #include "protocol.h"
 
-// The phrases to send as a response. Written as templates to be filled with sprintf.
+// Measures a string literal at compile time
+#define FRAGMENT(s) { s, sizeof(s) - 1 }
+
+// The phrases to send as a response, written as sprintf templates.
+// dtRes() writes them from PHRASE_PARTS, these define what it must produce.
 const char* PHRASES[3][2] = {
     { "Today's date is %s %02u, %04u", "The current time is %02u:%02u" },
     { "Ko te ra o tenei ra ko %s %02u, %04u", "Ko te wa o tenei wa %02u:%02u" },
     { "Heute ist der %02u. %s %04u", "Die Uhrzeit ist %02u:%02u" }
 };
 
-// The names of the months as strings. Some UTF codes are required for Maori and German.
-const char* MONTHS[3][12] = {
-    { "January", "February", "March", "April", "May", "June",
-        "July", "August", "September", "October", "November", "December"},
-    { "Kohit\u0101tea", "Hui-tanguru", "Pout\u016B-te-rangi", "Paenga-wh\u0101wh\u0101", "Haratua", "Pipiri",
-        "H\u014Dngongoi", "Here-turi-k\u014Dk\u0101", "Mahuru", "Whiringa-\u0101-nuku", "Whiringa-\u0101-rangi", "Hakihea" },
-    { "Januar", "Februar", "M\u00E4rz", "April", "Mai", "Juni",
-        "Juli", "August", "September", "Oktober", "November", "Dezember" }
+// The names of the months as measured strings. Some UTF codes are required for Maori and German.
+const struct fragment MONTHS[3][12] = {
+    { FRAGMENT("January"), FRAGMENT("February"), FRAGMENT("March"), FRAGMENT("April"),
+        FRAGMENT("May"), FRAGMENT("June"), FRAGMENT("July"), FRAGMENT("August"),
+        FRAGMENT("September"), FRAGMENT("October"), FRAGMENT("November"), FRAGMENT("December") },
+    { FRAGMENT("Kohit\u0101tea"), FRAGMENT("Hui-tanguru"), FRAGMENT("Pout\u016B-te-rangi"),
+        FRAGMENT("Paenga-wh\u0101wh\u0101"), FRAGMENT("Haratua"), FRAGMENT("Pipiri"),
+        FRAGMENT("H\u014Dngongoi"), FRAGMENT("Here-turi-k\u014Dk\u0101"), FRAGMENT("Mahuru"),
+        FRAGMENT("Whiringa-\u0101-nuku"), FRAGMENT("Whiringa-\u0101-rangi"), FRAGMENT("Hakihea") },
+    { FRAGMENT("Januar"), FRAGMENT("Februar"), FRAGMENT("M\u00E4rz"), FRAGMENT("April"),
+        FRAGMENT("Mai"), FRAGMENT("Juni"), FRAGMENT("Juli"), FRAGMENT("August"),
+        FRAGMENT("September"), FRAGMENT("Oktober"), FRAGMENT("November"), FRAGMENT("Dezember") }
+};
+
+// The fields written after each fragment of a phrase
+#define FIELD_END 0
+#define FIELD_MONTH 1
+#define FIELD_DAY 2
+#define FIELD_YEAR 3
+#define FIELD_HOUR 4
+#define FIELD_MINUTE 5
+
+// A literal piece of a phrase followed by the field that comes after it.
+// Every phrase ends with a field, so a FIELD_END part marks the end.
+struct phrase_part {
+    struct fragment text;
+    uint8_t field;
 };
 
+// The PHRASES split at each of their fields
+const struct phrase_part PHRASE_PARTS[3][2][4] = {
+    {
+        { { FRAGMENT("Today's date is "), FIELD_MONTH }, { FRAGMENT(" "), FIELD_DAY },
+            { FRAGMENT(", "), FIELD_YEAR }, { FRAGMENT(""), FIELD_END } },
+        { { FRAGMENT("The current time is "), FIELD_HOUR }, { FRAGMENT(":"), FIELD_MINUTE },
+            { FRAGMENT(""), FIELD_END } }
+    },
+    {
+        { { FRAGMENT("Ko te ra o tenei ra ko "), FIELD_MONTH }, { FRAGMENT(" "), FIELD_DAY },
+            { FRAGMENT(", "), FIELD_YEAR }, { FRAGMENT(""), FIELD_END } },
+        { { FRAGMENT("Ko te wa o tenei wa "), FIELD_HOUR }, { FRAGMENT(":"), FIELD_MINUTE },
+            { FRAGMENT(""), FIELD_END } }
+    },
+    {
+        { { FRAGMENT("Heute ist der "), FIELD_DAY }, { FRAGMENT(". "), FIELD_MONTH },
+            { FRAGMENT(" "), FIELD_YEAR }, { FRAGMENT(""), FIELD_END } },
+        { { FRAGMENT("Die Uhrzeit ist "), FIELD_HOUR }, { FRAGMENT(":"), FIELD_MINUTE },
+            { FRAGMENT(""), FIELD_END } }
+    }
+};
+
+// Every number from 00 to 99 as two digits
+const char DIGITS[200] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/**
+ * Writes a number as decimal digits with leading zeros, like %02u or %04u.
+ * 
+ * @param text Where to write the digits.
+ * @param value The number.
+ * @param width The fewest digits to write, either 2 or 4.
+ * @return The number of digits written.
+ * */
+static size_t writeNumber(char* text, unsigned int value, size_t width)
+{
+    // the common cases come straight from the table
+    if (value < 100 && width == 2) {
+        memcpy(text, &DIGITS[value * 2], 2);
+        return 2;
+    }
+
+    if (value < 10000 && width == 4) {
+        memcpy(text, &DIGITS[(value / 100) * 2], 2);
+        memcpy(text + 2, &DIGITS[(value % 100) * 2], 2);
+        return 4;
+    }
+
+    // anything wider than the field is written a digit at a time
+    char digits[10];
+    size_t count = 0;
+
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    for (size_t i = 0; i < count; i++) {
+        text[i] = digits[count - 1 - i];
+    }
+
+    return count;
+}
+
 /**
  * Creates a DT Request packet and puts it into a uint8_t array.
  * 
@@ -31,13 +122,13 @@ const char* MONTHS[3][12] = {
  * 
  * @param pkt A pointer to the packet.
  * @param n The size of the array. Must be REQ_PKT_LEN.
- * @param reqType Must be REQ_DATE or REQ_TIME.
+ * @param reqType Must be REQ_DATE or REQ_TIME, optionally with REQ_FLAG_COMPACT set.
  * @return The length of the packet.
  * */
 size_t dtReq(uint8_t pkt[], size_t n, uint16_t reqType)
 {
 
-    if (validReqType(reqType) && n == REQ_PKT_LEN) {
+    if (validReqType(reqType & ~REQ_FLAG_COMPACT) && n == REQ_PKT_LEN) {
 
         pkt[0] = (uint8_t)(MAGIC_NO >> 8);
         pkt[1] = (uint8_t)(MAGIC_NO & 0xFF);
@@ -54,7 +145,7 @@ size_t dtReq(uint8_t pkt[], size_t n, uint16_t reqType)
 }
 
 /**
- * Returns the request type of a DT Request packet.
+ * Returns the request type of a DT Request packet, without its flags.
  * No checking is performed beforehand.
  * 
  * @param pkt An array of uint8 values making up the packet.
@@ -63,7 +154,20 @@ size_t dtReq(uint8_t pkt[], size_t n, uint16_t reqType)
  * */
 uint16_t dtReqType(uint8_t pkt[], size_t n)
 {
-    return ((pkt[4] << 8) | pkt[5]);
+    return ((pkt[4] << 8) | pkt[5]) & ~REQ_FLAG_COMPACT;
+}
+
+/**
+ * Returns true if a DT Request packet asks for a compact response.
+ * No checking is performed beforehand.
+ * 
+ * @param pkt An array of uint8 values making up the packet.
+ * @param n The size of the array. Must be REQ_PKT_LEN.
+ * @return True if REQ_FLAG_COMPACT is set.
+ * */
+bool dtReqCompact(uint8_t pkt[], size_t n)
+{
+    return (((pkt[4] << 8) | pkt[5]) & REQ_FLAG_COMPACT) != 0;
 }
 
 /**
@@ -146,6 +250,9 @@ bool validLangCode(uint16_t langCode)
 
 /**
  * Constructs a DT Response packet.
+ * The text is assembled directly in the packet from PHRASE_PARTS, the
+ * measured MONTHS and the DIGITS table. It is byte for byte what
+ * sprintf() would produce from PHRASES.
  * 
  * @param pkt A pointer to the packet.
  * @param n The size of the packet. Must be equal to RES_PKT_LEN.
@@ -166,6 +273,11 @@ size_t dtRes(uint8_t pkt[], size_t n, uint16_t reqType, uint16_t langCode, uint1
         return 0;
     }
 
+    // only the date phrases name the month
+    if (reqType == REQ_DATE && (month < 1 || month > 12)) {
+        return 0;
+    }
+
     // write most of the data to the packet
     pkt[0] = (uint8_t)(MAGIC_NO >> 8);
     pkt[1] = (uint8_t)(MAGIC_NO & 0xFF);
@@ -180,38 +292,41 @@ size_t dtRes(uint8_t pkt[], size_t n, uint16_t reqType, uint16_t langCode, uint1
     pkt[10] = hour;
     pkt[11] = minute;
 
-    // get the template phrase and the month as a string
-    char* phrase = (char*)PHRASES[langCode - 1][reqType - 1];
-    
-    char* monthStr = (char*)MONTHS[langCode - 1][month - 1];
-
-    char text[RES_TEXT_LEN] = {0};
-    int length = 0;
-
-    if (reqType == REQ_DATE) {
-        // german has its values out of order, so handle it seperately
-        if (langCode == LANG_GER) {
-            length = sprintf(text, phrase, day, monthStr, year);
-        } else {
-            length = sprintf(text, phrase, monthStr, day, year);
+    // the text is written straight into the packet after the header
+    char* text = (char*) &pkt[13];
+    const struct phrase_part* parts = PHRASE_PARTS[langCode - 1][reqType - 1];
+    size_t length = 0;
+
+    // write each fragment of the phrase followed by its field
+    for (int p = 0; parts[p].field != FIELD_END; p++) {
+
+        memcpy(text + length, parts[p].text.text, parts[p].text.length);
+        length += parts[p].text.length;
+
+        switch (parts[p].field) {
+            case FIELD_MONTH:
+                memcpy(text + length, MONTHS[langCode - 1][month - 1].text,
+                    MONTHS[langCode - 1][month - 1].length);
+                length += MONTHS[langCode - 1][month - 1].length;
+                break;
+            case FIELD_DAY:
+                length += writeNumber(text + length, day, 2);
+                break;
+            case FIELD_YEAR:
+                length += writeNumber(text + length, year, 4);
+                break;
+            case FIELD_HOUR:
+                length += writeNumber(text + length, hour, 2);
+                break;
+            case FIELD_MINUTE:
+                length += writeNumber(text + length, minute, 2);
+                break;
         }
-    } else {
-        length = sprintf(text, phrase, hour, minute);
-    }
-    
-    // an error occurred during sprintf
-    if (length < 0) {
-        return 0;
     }
 
     // write the length to the packet
     pkt[12] = (uint8_t)length;
 
-    // fill the rest of the packet with the text
-    for (int i = 0; i < length; i++) {
-        pkt[13 + i] = text[i];
-    }
-
     return 13 + length;
 
 }
@@ -227,13 +342,12 @@ size_t dtRes(uint8_t pkt[], size_t n, uint16_t reqType, uint16_t langCode, uint1
  * */
 size_t dtResNow(uint8_t pkt[], size_t n, uint16_t reqType, uint16_t langCode)
 {
-    struct tm* now;
-    time_t raw_time;
+    struct tm now;
 
-    time(&raw_time);
-    now = localtime(&raw_time);
-    
-    return dtRes(pkt, n, reqType, langCode, now->tm_year + 1900, now->tm_mon + 1, now->tm_mday, now->tm_hour, now->tm_min);
+    // the cached clock avoids calling localtime() for every packet
+    clockNow(&now);
+
+    return dtRes(pkt, n, reqType, langCode, now.tm_year + 1900, now.tm_mon + 1, now.tm_mday, now.tm_hour, now.tm_min);
 }
 
 /**
@@ -288,6 +402,56 @@ bool dtResValid(uint8_t pkt[], size_t n)
     return true;
 }
 
+/**
+ * Constructs a compact DT Response packet, the fields of a response with
+ * no text. Clients that do not know the compact form read it as a
+ * response whose text is empty.
+ * 
+ * @param pkt A pointer to the packet.
+ * @param n The size of the packet. Must be at least RES_HEADER_LEN.
+ * @param langCode The language of the port that answered. Must be valid.
+ * @param year The year to return.
+ * @param month The month to return.
+ * @param day The day to return.
+ * @param hour The hour to return.
+ * @param minute The minute to return.
+ * @return The length of the packet, or 0 if the arguments were invalid.
+ * */
+size_t dtResCompact(uint8_t pkt[], size_t n, uint16_t langCode, uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute)
+{
+    if (!validLangCode(langCode) || n < RES_HEADER_LEN) {
+        return 0;
+    }
+
+    pkt[0] = (uint8_t)(MAGIC_NO >> 8);
+    pkt[1] = (uint8_t)(MAGIC_NO & 0xFF);
+    pkt[2] = (uint8_t)(PACKET_RES >> 8);
+    pkt[3] = (uint8_t)(PACKET_RES & 0xFF);
+    pkt[4] = (uint8_t)(langCode >> 8);
+    pkt[5] = (uint8_t)(langCode & 0xFF);
+    pkt[6] = (uint8_t)(year >> 8);
+    pkt[7] = (uint8_t)(year & 0xFF);
+    pkt[8] = month;
+    pkt[9] = day;
+    pkt[10] = hour;
+    pkt[11] = minute;
+    pkt[12] = 0;
+
+    return RES_HEADER_LEN;
+}
+
+/**
+ * Returns true if the packet is a valid compact DT Response packet.
+ * 
+ * @param pkt The packet.
+ * @param n The size of the packet.
+ * @return True if the packet is valid and has no text.
+ * */
+bool dtResCompactValid(uint8_t pkt[], size_t n)
+{
+    return n == RES_HEADER_LEN && dtResValid(pkt, n);
+}
+
 /**
  * Returns the language code in the packet.
  * No checking is done beforehand.
@@ -397,6 +561,336 @@ void dtResText(uint8_t pkt[], size_t n, char text[], size_t* textLen)
     text[*textLen] = 0;
 }
 
+/**
+ * Creates a stats request packet, which asks the admin port of a server
+ * for a snapshot of its counters.
+ *
+ * @param pkt The packet.
+ * @param n The size of the array. Must be STATS_REQ_LEN.
+ * @return The length of the packet, or 0 if n was wrong.
+ * */
+size_t dtStatsReq(uint8_t pkt[], size_t n)
+{
+    if (n != STATS_REQ_LEN) {
+        return 0;
+    }
+
+    pkt[0] = (uint8_t)(MAGIC_NO >> 8);
+    pkt[1] = (uint8_t)(MAGIC_NO & 0xFF);
+    pkt[2] = (uint8_t)(PACKET_STATS_REQ >> 8);
+    pkt[3] = (uint8_t)(PACKET_STATS_REQ & 0xFF);
+
+    return n;
+}
+
+/**
+ * Returns true if the packet is a valid stats request packet.
+ *
+ * @param pkt The packet.
+ * @param n The size of the packet.
+ * @return True if the packet is valid.
+ * */
+bool dtStatsReqValid(uint8_t pkt[], size_t n)
+{
+    return n == STATS_REQ_LEN && dtPktMagicNo(pkt, n) == MAGIC_NO &&
+        dtPktType(pkt, n) == PACKET_STATS_REQ;
+}
+
+/**
+ * Creates a stats response packet holding a snapshot as text. The text
+ * is not terminated, it runs to the end of the packet.
+ *
+ * @param pkt The packet.
+ * @param n The size of the array, at most STATS_RES_MAX_LEN is used.
+ * @param text The snapshot.
+ * @param textLen The length of the snapshot, which is cut short if it does not fit.
+ * @return The length of the packet, or 0 if there is no room for the header.
+ * */
+size_t dtStatsRes(uint8_t pkt[], size_t n, const char* text, size_t textLen)
+{
+    if (n > STATS_RES_MAX_LEN) {
+        n = STATS_RES_MAX_LEN;
+    }
+
+    if (n < STATS_HEADER_LEN) {
+        return 0;
+    }
+
+    if (textLen > n - STATS_HEADER_LEN) {
+        textLen = n - STATS_HEADER_LEN;
+    }
+
+    pkt[0] = (uint8_t)(MAGIC_NO >> 8);
+    pkt[1] = (uint8_t)(MAGIC_NO & 0xFF);
+    pkt[2] = (uint8_t)(PACKET_STATS_RES >> 8);
+    pkt[3] = (uint8_t)(PACKET_STATS_RES & 0xFF);
+    memcpy(pkt + STATS_HEADER_LEN, text, textLen);
+
+    return STATS_HEADER_LEN + textLen;
+}
+
+/**
+ * Returns true if the packet is a valid stats response packet.
+ *
+ * @param pkt The packet.
+ * @param n The size of the packet.
+ * @return True if the packet is valid.
+ * */
+bool dtStatsResValid(uint8_t pkt[], size_t n)
+{
+    return n >= STATS_HEADER_LEN && n <= STATS_RES_MAX_LEN &&
+        dtPktMagicNo(pkt, n) == MAGIC_NO && dtPktType(pkt, n) == PACKET_STATS_RES;
+}
+
+/**
+ * Creates a batch request packet, which asks for several responses in
+ * one datagram.
+ *
+ * @param pkt The packet.
+ * @param n The size of the array, at least BATCH_HEADER_LEN + count * BATCH_QUERY_LEN.
+ * @param reqTypes The type of each query, REQ_DATE or REQ_TIME.
+ * @param langCodes The language of each query.
+ * @param count The number of queries, from 1 to BATCH_MAX_QUERIES.
+ * @return The length of the packet, or 0 if a query or the count was invalid.
+ * */
+size_t dtBatchReq(uint8_t pkt[], size_t n, uint16_t reqTypes[], uint16_t langCodes[], unsigned int count)
+{
+    size_t length = BATCH_HEADER_LEN + count * BATCH_QUERY_LEN;
+
+    if (count < 1 || count > BATCH_MAX_QUERIES || n < length) {
+        return 0;
+    }
+
+    pkt[0] = (uint8_t)(MAGIC_NO >> 8);
+    pkt[1] = (uint8_t)(MAGIC_NO & 0xFF);
+    pkt[2] = (uint8_t)(PACKET_BATCH_REQ >> 8);
+    pkt[3] = (uint8_t)(PACKET_BATCH_REQ & 0xFF);
+    pkt[4] = (uint8_t)count;
+
+    for (unsigned int q = 0; q < count; q++) {
+
+        uint8_t* query = &pkt[BATCH_HEADER_LEN + q * BATCH_QUERY_LEN];
+
+        if (!validReqType(reqTypes[q]) || !validLangCode(langCodes[q])) {
+            return 0;
+        }
+
+        query[0] = (uint8_t)(reqTypes[q] >> 8);
+        query[1] = (uint8_t)(reqTypes[q] & 0xFF);
+        query[2] = (uint8_t)(langCodes[q] >> 8);
+        query[3] = (uint8_t)(langCodes[q] & 0xFF);
+    }
+
+    return length;
+}
+
+/**
+ * Returns true if the packet is a valid batch request packet. A batch of
+ * more than BATCH_MAX_QUERIES is never valid, so that its response always
+ * fits in BATCH_RES_MAX_LEN.
+ *
+ * @param pkt The packet.
+ * @param n The size of the packet.
+ * @return True if the packet is valid.
+ * */
+bool dtBatchReqValid(uint8_t pkt[], size_t n)
+{
+    unsigned int count;
+
+    if (n < BATCH_HEADER_LEN || dtPktMagicNo(pkt, n) != MAGIC_NO || dtPktType(pkt, n) != PACKET_BATCH_REQ) {
+        return false;
+    }
+
+    count = dtBatchCount(pkt, n);
+
+    if (count < 1 || count > BATCH_MAX_QUERIES || n != BATCH_HEADER_LEN + count * BATCH_QUERY_LEN) {
+        return false;
+    }
+
+    for (unsigned int q = 0; q < count; q++) {
+        if (!validReqType(dtBatchReqType(pkt, n, q)) || !validLangCode(dtBatchReqLangCode(pkt, n, q))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Returns the number of queries in a batch request, or of records in a
+ * batch response. No checking is done beforehand.
+ *
+ * @param pkt The packet.
+ * @param n The size of the packet.
+ * @return The count.
+ * */
+unsigned int dtBatchCount(uint8_t pkt[], size_t n)
+{
+    return pkt[4];
+}
+
+/**
+ * Returns the request type of a query in a batch request.
+ * No checking is done beforehand.
+ *
+ * @param pkt The packet.
+ * @param n The size of the packet.
+ * @param index The index of the query.
+ * @return The request type.
+ * */
+uint16_t dtBatchReqType(uint8_t pkt[], size_t n, unsigned int index)
+{
+    uint8_t* query = &pkt[BATCH_HEADER_LEN + index * BATCH_QUERY_LEN];
+
+    return ((query[0] << 8) | query[1]);
+}
+
+/**
+ * Returns the language of a query in a batch request.
+ * No checking is done beforehand.
+ *
+ * @param pkt The packet.
+ * @param n The size of the packet.
+ * @param index The index of the query.
+ * @return The language code.
+ * */
+uint16_t dtBatchReqLangCode(uint8_t pkt[], size_t n, unsigned int index)
+{
+    uint8_t* query = &pkt[BATCH_HEADER_LEN + index * BATCH_QUERY_LEN];
+
+    return ((query[2] << 8) | query[3]);
+}
+
+/**
+ * Writes the header of a batch response, which the records follow.
+ *
+ * @param pkt The packet.
+ * @param n The size of the array, at least BATCH_HEADER_LEN.
+ * @param count The number of records, from 1 to BATCH_MAX_QUERIES.
+ * @return The length of the header, or 0 if the count was invalid.
+ * */
+size_t dtBatchResHeader(uint8_t pkt[], size_t n, unsigned int count)
+{
+    if (count < 1 || count > BATCH_MAX_QUERIES || n < BATCH_HEADER_LEN) {
+        return 0;
+    }
+
+    pkt[0] = (uint8_t)(MAGIC_NO >> 8);
+    pkt[1] = (uint8_t)(MAGIC_NO & 0xFF);
+    pkt[2] = (uint8_t)(PACKET_BATCH_RES >> 8);
+    pkt[3] = (uint8_t)(PACKET_BATCH_RES & 0xFF);
+    pkt[4] = (uint8_t)count;
+
+    return BATCH_HEADER_LEN;
+}
+
+/**
+ * Constructs a batch response packet, with a record built by dtRes() for
+ * each query.
+ *
+ * @param pkt The packet.
+ * @param n The size of the array, BATCH_RES_MAX_LEN always fits.
+ * @param reqTypes The type of each query.
+ * @param langCodes The language of each query.
+ * @param count The number of queries, from 1 to BATCH_MAX_QUERIES.
+ * @param year The year to return.
+ * @param month The month to return.
+ * @param day The day to return.
+ * @param hour The hour to return.
+ * @param minute The minute to return.
+ * @return The length of the packet, or 0 if a query was invalid or the records did not fit.
+ * */
+size_t dtBatchRes(uint8_t pkt[], size_t n, uint16_t reqTypes[], uint16_t langCodes[], unsigned int count, uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute)
+{
+    uint8_t record[RES_PKT_LEN];
+    size_t length = dtBatchResHeader(pkt, n, count);
+
+    if (length == 0) {
+        return 0;
+    }
+
+    for (unsigned int q = 0; q < count; q++) {
+
+        size_t record_length = dtRes(record, RES_PKT_LEN, reqTypes[q], langCodes[q], year, month, day, hour, minute);
+
+        if (record_length == 0 || length + record_length > n) {
+            return 0;
+        }
+
+        memcpy(pkt + length, record, record_length);
+        length += record_length;
+    }
+
+    return length;
+}
+
+/**
+ * Returns true if the packet is a valid batch response packet, with every
+ * record a valid DT Response packet and nothing after the last one.
+ *
+ * @param pkt The packet.
+ * @param n The size of the packet.
+ * @return True if the packet is valid.
+ * */
+bool dtBatchResValid(uint8_t pkt[], size_t n)
+{
+    unsigned int count;
+    size_t offset = BATCH_HEADER_LEN;
+
+    if (n < BATCH_HEADER_LEN || n > BATCH_RES_MAX_LEN ||
+        dtPktMagicNo(pkt, n) != MAGIC_NO || dtPktType(pkt, n) != PACKET_BATCH_RES) {
+        return false;
+    }
+
+    count = dtBatchCount(pkt, n);
+
+    if (count < 1 || count > BATCH_MAX_QUERIES) {
+        return false;
+    }
+
+    for (unsigned int r = 0; r < count; r++) {
+
+        size_t length;
+
+        if (offset + RES_HEADER_LEN > n) {
+            return false;
+        }
+
+        length = RES_HEADER_LEN + dtResLength(pkt + offset, n - offset);
+
+        if (offset + length > n || !dtResValid(pkt + offset, length)) {
+            return false;
+        }
+
+        offset += length;
+    }
+
+    return offset == n;
+}
+
+/**
+ * Finds a record in a batch response, which can then be read with the
+ * DT Response functions. No checking is done beforehand.
+ *
+ * @param pkt The packet.
+ * @param n The size of the packet.
+ * @param index The index of the record.
+ * @param length Where the length of the record is to be stored.
+ * @return The offset of the record in the packet.
+ * */
+size_t dtBatchResRecord(uint8_t pkt[], size_t n, unsigned int index, size_t* length)
+{
+    size_t offset = BATCH_HEADER_LEN;
+
+    for (unsigned int r = 0; r < index; r++) {
+        offset += RES_HEADER_LEN + dtResLength(pkt + offset, n - offset);
+    }
+
+    *length = RES_HEADER_LEN + dtResLength(pkt + offset, n - offset);
+
+    return offset;
+}
+
 /**
  * Dumps the packet data to stdout.
  * 
@@ -463,6 +957,12 @@ size_t dtPktLength(uint8_t pkt[])
         return REQ_PKT_LEN;
     } else if (pktType == PACKET_RES) {
         return (13 + dtResLength(pkt, RES_PKT_LEN));
+    } else if (pktType == PACKET_BATCH_REQ) {
+        return BATCH_HEADER_LEN + dtBatchCount(pkt, BATCH_REQ_MAX_LEN) * BATCH_QUERY_LEN;
+    } else if (pktType == PACKET_BATCH_RES && dtBatchCount(pkt, BATCH_RES_MAX_LEN) > 0) {
+        size_t length;
+        size_t offset = dtBatchResRecord(pkt, BATCH_RES_MAX_LEN, dtBatchCount(pkt, BATCH_RES_MAX_LEN) - 1, &length);
+        return offset + length;
     } else {
         return 0;
     }
@@ -483,6 +983,7 @@ char* getRequestTypeString(uint16_t reqType)
     switch (reqType) {
         case REQ_DATE: return "date";
         case REQ_TIME: return "time";
+        case REQ_BATCH: return "batch";
         default: return "";
     }
 }
\ No newline at end of file
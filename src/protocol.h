@@ -11,6 +11,10 @@
 #define MAGIC_NO 0x497E
 #define PACKET_REQ 0x0001
 #define PACKET_RES 0x0002
+#define PACKET_STATS_REQ 0x0003
+#define PACKET_STATS_RES 0x0004
+#define PACKET_BATCH_REQ 0x0005
+#define PACKET_BATCH_RES 0x0006
 
 #define MIN_PORT_NO 1024
 #define MAX_PORT_NO 64000
@@ -19,14 +23,46 @@
 #define REQ_TIME 0x0002
 #define REQ_PKT_LEN 6
 
+// set in the request type of a DT Request to ask for a compact response,
+// the header alone with no text, which is a valid DT Response of RES_HEADER_LEN
+#define REQ_FLAG_COMPACT 0x8000
+
+// never sent in a DT Request, stands for a batch request in counters and logs
+#define REQ_BATCH 0x0003
+
+#define RES_HEADER_LEN 13
 #define RES_TEXT_LEN 255
-#define RES_PKT_LEN (13 + RES_TEXT_LEN)
+#define RES_PKT_LEN (RES_HEADER_LEN + RES_TEXT_LEN)
+
+// a stats request is only the header, the response is followed by text
+#define STATS_REQ_LEN 4
+#define STATS_HEADER_LEN 4
+#define STATS_RES_MAX_LEN 65507
+
+// a batch request is a header holding the number of queries, then the
+// request type and language of each, and its response is the same header
+// followed by a whole DT Response packet for each query in turn
+#define BATCH_HEADER_LEN 5
+#define BATCH_QUERY_LEN 4
+#define BATCH_MAX_QUERIES 6
+#define BATCH_REQ_MAX_LEN (BATCH_HEADER_LEN + BATCH_MAX_QUERIES * BATCH_QUERY_LEN)
+#define BATCH_RES_MAX_LEN (BATCH_HEADER_LEN + BATCH_MAX_QUERIES * RES_PKT_LEN)
 
 // Language code definitions
 #define LANG_ENG 0x0001
 #define LANG_MAO 0x0002
 #define LANG_GER 0x0003
 
+// A string and its length, measured ahead of time
+struct fragment {
+    const char* text;
+    size_t length;
+};
+
+// The response templates and month names for each language
+extern const char* PHRASES[3][2];
+extern const struct fragment MONTHS[3][12];
+
 // Helper functions
 bool validLangCode(uint16_t langCode);
 bool validReqType(uint16_t reqType);
@@ -43,11 +79,14 @@ size_t dtPktLength(uint8_t pkt[]);
 size_t dtReq(uint8_t pkt[], size_t n, uint16_t reqType);
 uint16_t dtReqType(uint8_t pkt[], size_t n);
 bool dtReqValid(uint8_t pkt[], size_t n);
+bool dtReqCompact(uint8_t pkt[], size_t n);
 
 // DT Response functions
 size_t dtRes(uint8_t pkt[], size_t n, uint16_t reqType, uint16_t langCode, uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute);
 size_t dtResNow(uint8_t pkt[], size_t n, uint16_t reqType, uint16_t langCode);
 bool dtResValid(uint8_t pkt[], size_t n);
+size_t dtResCompact(uint8_t pkt[], size_t n, uint16_t langCode, uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute);
+bool dtResCompactValid(uint8_t pkt[], size_t n);
 uint16_t dtResLangCode(uint8_t pkt[], size_t n);
 uint16_t dtResYear(uint8_t pkt[], size_t n);
 uint8_t dtResMonth(uint8_t pkt[], size_t n);
@@ -57,4 +96,21 @@ uint8_t dtResMinute(uint8_t pkt[], size_t n);
 uint8_t dtResLength(uint8_t pkt[], size_t n);
 void dtResText(uint8_t pkt[], size_t n, char text[], size_t* textLen);
 
+// Stats functions
+size_t dtStatsReq(uint8_t pkt[], size_t n);
+bool dtStatsReqValid(uint8_t pkt[], size_t n);
+size_t dtStatsRes(uint8_t pkt[], size_t n, const char* text, size_t textLen);
+bool dtStatsResValid(uint8_t pkt[], size_t n);
+
+// Batch functions
+size_t dtBatchReq(uint8_t pkt[], size_t n, uint16_t reqTypes[], uint16_t langCodes[], unsigned int count);
+bool dtBatchReqValid(uint8_t pkt[], size_t n);
+unsigned int dtBatchCount(uint8_t pkt[], size_t n);
+uint16_t dtBatchReqType(uint8_t pkt[], size_t n, unsigned int index);
+uint16_t dtBatchReqLangCode(uint8_t pkt[], size_t n, unsigned int index);
+size_t dtBatchResHeader(uint8_t pkt[], size_t n, unsigned int count);
+size_t dtBatchRes(uint8_t pkt[], size_t n, uint16_t reqTypes[], uint16_t langCodes[], unsigned int count, uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute);
+bool dtBatchResValid(uint8_t pkt[], size_t n);
+size_t dtBatchResRecord(uint8_t pkt[], size_t n, unsigned int index, size_t* length);
+
 #endif
@@ -0,0 +1,80 @@
+// scheduler.c
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "scheduler.h"
+#include "utils.h"
+
+/**
+ * Allocates an empty queue for a number of sockets.
+ * 
+ * @param scheduler The scheduler to initialise.
+ * @param capacity The number of sockets.
+ * */
+void schedulerInit(struct scheduler* scheduler, unsigned int capacity)
+{
+    scheduler->ring = calloc(capacity, sizeof(unsigned int));
+    scheduler->queued = calloc(capacity, sizeof(bool));
+    scheduler->capacity = capacity;
+    scheduler->head = 0;
+    scheduler->count = 0;
+    scheduler->peak = 0;
+
+    if (scheduler->ring == NULL || scheduler->queued == NULL) {
+        error("could not allocate the scheduler", 3);
+    }
+}
+
+/**
+ * Adds a socket to the back of the queue unless it is already waiting.
+ * 
+ * @param scheduler The scheduler.
+ * @param index The index of the listener.
+ * */
+void schedulerPush(struct scheduler* scheduler, unsigned int index)
+{
+    if (scheduler->queued[index]) {
+        return;
+    }
+
+    scheduler->queued[index] = true;
+    scheduler->ring[(scheduler->head + scheduler->count) % scheduler->capacity] = index;
+    scheduler->count++;
+
+    if (scheduler->count > scheduler->peak) {
+        scheduler->peak = scheduler->count;
+    }
+}
+
+/**
+ * Removes the socket at the front of the queue.
+ * 
+ * @param scheduler The scheduler.
+ * @param index A pointer where the index of the listener is to be stored.
+ * @return False if the queue was empty.
+ * */
+bool schedulerPop(struct scheduler* scheduler, unsigned int* index)
+{
+    if (scheduler->count == 0) {
+        return false;
+    }
+
+    *index = scheduler->ring[scheduler->head];
+    scheduler->queued[*index] = false;
+    scheduler->head = (scheduler->head + 1) % scheduler->capacity;
+    scheduler->count--;
+
+    return true;
+}
+
+/**
+ * Returns the number of sockets waiting to be serviced.
+ * 
+ * @param scheduler The scheduler.
+ * @return The number of sockets in the queue.
+ * */
+unsigned int schedulerPending(struct scheduler* scheduler)
+{
+    return scheduler->count;
+}
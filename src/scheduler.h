@@ -0,0 +1,32 @@
+// scheduler.h
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A round-robin queue of the sockets that still have datagrams waiting.
+// Each socket appears at most once, so the queue never holds more than
+// the number of sockets.
+struct scheduler {
+
+    // the listener indices in the order they will be serviced
+    unsigned int* ring;
+    unsigned int capacity;
+    unsigned int head;
+    unsigned int count;
+
+    // true for each listener index that is currently in the ring
+    bool* queued;
+
+    // the most sockets that have been waiting at once
+    unsigned int peak;
+};
+
+void schedulerInit(struct scheduler* scheduler, unsigned int capacity);
+void schedulerPush(struct scheduler* scheduler, unsigned int index);
+bool schedulerPop(struct scheduler* scheduler, unsigned int* index);
+unsigned int schedulerPending(struct scheduler* scheduler);
+
+#endif
@@ -1,248 +1,2983 @@
 // server.c
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <linux/errqueue.h>
+#include <linux/io_uring.h>
+#include <linux/sock_diag.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdarg.h>
 #include <string.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "announcer.h"
+#include "cache.h"
+#include "clock.h"
+#include "handoff.h"
+#include "limiter.h"
+#include "logger.h"
+#include "metrics.h"
 #include "protocol.h"
+#include "scheduler.h"
 #include "server.h"
+#include "timepage.h"
+#include "uring.h"
 #include "utils.h"
 
-// the socket descriptors
+// the workers, each with its own sockets, cache and buffers
 // these must be global in order to safely close them on SIGINT
-int socket_fds[3];
+struct worker* workers;
+unsigned int worker_count;
+
+// the ports to listen on, each worker binds its own socket for every one
+struct listener* listeners;
+unsigned int listener_count;
+
+// formats and writes the request log away from the workers
+struct logger logger;
+
+// an eventfd that becomes readable when the workers should stop
+int shutdown_fd;
+
+// passed once every worker has allocated its state, before anyone reads it
+pthread_barrier_t workers_ready;
+
+// the loopback socket that answers stats requests and the thread that reads it
+int admin_fd = -1;
+pthread_t admin_thread;
+
+// sends the responses to a multicast group each minute, if asked to
+struct announcer announcer;
+
+// publishes the responses in shared memory each minute, if asked to
+struct time_page_writer time_page;
+
+// set once the sockets belong to a new server, which also keeps the time page
+bool handed_over = false;
+
+// the arguments the server was started with, which an upgrade starts the new binary with
+int server_argc;
+char** server_argv;
 
 /**
- * Usage: server <english port> <te reo maori port> <german port>
+ * Usage: server [options] <english ports> <te reo maori ports> <german ports>
+ * 
+ * Each language takes a comma separated list of ports and port ranges, e.g. 5000,5010-5019.
  * */
 int main(int argc, char** argv)
 {
-    uint16_t ports[3] = {0};
+    // batching is the default, the single packet path is kept for comparison
+    struct server_options options = {
+        .batch_size = DEFAULT_BATCH_SIZE,
+        .single = false,
+        .uring = false,
+        .zerocopy = false,
+        .pool_buffers = DEFAULT_POOL_BUFFERS,
+        .limit = false,
+        .limit_slots = DEFAULT_LIMITER_SLOTS,
+        .admin_port = 0,
+        .announce = false,
+        .announce_interface = { .s_addr = INADDR_ANY },
+        .announce_ttl = DEFAULT_ANNOUNCE_TTL,
+        .time_page = NULL,
+        .unix_listener_count = 0,
+        .timestamps = false,
+        .busy_poll = 0,
+        .cpu_count = 0,
+        .incoming_cpu = false,
+        .background_cpu_count = 0,
+        .takeover_fd = -1,
+        .workers = 1,
+        .quota = DEFAULT_QUOTA
+    };
+
+    server_argc = argc;
+    server_argv = argv;
+
+    // read the options, this leaves optind pointing at the first port
+    readOptions(argc, argv, &options);
+
+    // a socket can only be steered to a CPU that its worker is pinned to
+    if (options.incoming_cpu && options.cpu_count == 0) {
+        error("--incoming-cpu needs the workers to be pinned with --cpus", 1);
+    }
 
     // validate the arguments
-    if (argc != 4) {
-        error("server must receive exactly 3 arguments", 1);
+    if (argc - optind != 3) {
+        error("server must receive exactly 3 ports", 1);
     }
 
-    // read the ports into the ports array
-    if (!readPorts(argv, ports)) {
-        char msg[52] = {0};
-        sprintf(msg, "ports must be between %u and %u (inclusive)", MIN_PORT_NO, MAX_PORT_NO);
+    // read the ports into the listeners array, checking that they are unique
+    if (!readPorts(argv + optind - 1, &listeners, &listener_count)) {
+        char msg[80] = {0};
+        sprintf(msg, "ports must be unique and between %u and %u (inclusive)", MIN_PORT_NO, MAX_PORT_NO);
         error(msg, 1);
     }
 
-    // check that the ports are unique
-    if (ports[0] == ports[1] || ports[0] == ports[2] || ports[1] == ports[2]) {
-        error("port numbers must be unique", 1);
-    }
+    // the Unix sockets are served alongside the ports
+    addUnixListeners(&options, listeners, &listener_count);
 
-    // handle some signals so that the sockets can shutdown gracefully
-    signal(SIGINT, handleSignal);
+    // give each port its share of every turn
+    if (!applyQuotas(&options, listeners, listener_count)) {
+        error("quotas must be given for ports that are being served", 1);
+    }
 
     // serve on the specified ports
-    serve(ports);
+    serve(listeners, listener_count, &options);
 
     return EXIT_SUCCESS;
 }
 
 /**
- * Gracefully shutdown the server by closing the sockets.
+ * Handles a signal received by the main thread.
+ * SIGUSR1 prints the statistics, anything else gracefully
+ * shuts down the server by stopping the workers and closing the sockets.
  * 
  * @param sig The signal sent to the program.
  * */
 void handleSignal(int sig)
 {
+    // used to wake every worker at once
+    uint64_t wake = 1;
+
+    if (sig == SIGUSR1) {
+        printStats();
+        return;
+    }
+
+    // only returns if the new server did not take over
+    if (sig == SIGHUP) {
+        upgrade();
+        return;
+    }
+
+    // wake the workers up and wait for them to leave their loops
+    if (write(shutdown_fd, &wake, sizeof(wake)) < 0) {
+        error("could not stop the workers", 4);
+    }
+
+    for (unsigned int w = 0; w < worker_count; w++) {
+        pthread_join(workers[w].thread, NULL);
+    }
+
+    // write out whatever the workers logged before they stopped
+    loggerStop(&logger);
+
+    printStats();
+
     printf("Closing sockets...\n");
 
     // close the sockets one at a time
-    for (int i = 0; i < 3; i++) {
-        close(socket_fds[i]);
+    for (unsigned int w = 0; w < worker_count; w++) {
+        for (unsigned int i = 0; i < listener_count; i++) {
+            close(workers[w].listeners[i].fd);
+        }
+
+        close(workers[w].epoll_fd);
+        cacheClose(workers[w].cache);
+    }
+
+    // a new server keeps serving on the Unix sockets, under the same paths
+    for (unsigned int i = 0; i < listener_count && !handed_over; i++) {
+        if (listeners[i].path != NULL) {
+            unlink(listeners[i].path);
+        }
+    }
+
+    close(shutdown_fd);
+
+    if (admin_fd >= 0) {
+        close(admin_fd);
+    }
+
+    if (workers[0].options->announce) {
+        announcerClose(&announcer);
+    }
+
+    if (workers[0].options->time_page != NULL) {
+        timepageClose(&time_page, !handed_over);
     }
 
     exit(0);
 }
 
 /**
- * Serves on all three ports.
- * 
- * @param The list of ports to serve on.
+ * Upgrades the server without missing a datagram. The binary on disk is
+ * started with the same arguments and handed every worker's sockets over a
+ * Unix socket, so it never binds them itself. Once it says it is serving,
+ * this server stops its workers, which finish what they were doing, and
+ * exits. Anything still queued on the sockets is read by the new server.
+ * If the new server fails to start this one carries on.
  * */
-void serve(uint16_t ports[])
+void upgrade()
 {
+    // this end stays here, the other is inherited by the new server
+    int pair[2];
+    char fd_text[16];
 
-    // holds the server address information
-    struct sockaddr_in server_addr[3];
+    // the arguments without any earlier --takeover, and the sockets to hand over
+    char** upgrade_argv = calloc(server_argc + 3, sizeof(char*));
+    int* sockets = calloc(worker_count * listener_count, sizeof(int));
+    uint16_t* ports = calloc(worker_count * listener_count, sizeof(uint16_t));
+    unsigned int count = 0, arg = 0;
+    pid_t pid;
 
-    // create three sockets for the three ports
-    for (int i = 0; i < 3; i++) {
+    if (upgrade_argv == NULL || sockets == NULL || ports == NULL) {
+        error("could not allocate the upgrade", 3);
+    }
 
-        // required for setsockopt(), set it to 1 to allow us to reuse local addresses
-        int option_value = 1;
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) < 0) {
+        printf("Could not upgrade: %s\n", strerror(errno));
+        fflush(stdout);
+        free(upgrade_argv);
+        free(sockets);
+        free(ports);
+        return;
+    }
+
+    sprintf(fd_text, "%d", pair[1]);
 
-        socket_fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+    upgrade_argv[arg++] = server_argv[0];
+    upgrade_argv[arg++] = "--takeover";
+    upgrade_argv[arg++] = fd_text;
 
-        if (socket_fds[i] < 0) {
-            error("could not create a socket", 2);
+    for (int a = 1; a < server_argc; a++) {
+        if (strcmp(server_argv[a], "--takeover") == 0) {
+            a++;
+        } else if (strncmp(server_argv[a], "--takeover=", 11) != 0) {
+            upgrade_argv[arg++] = server_argv[a];
         }
+    }
 
-        // lets us reuse the port after killing the server.
-        setsockopt(socket_fds[i], SOL_SOCKET, SO_REUSEADDR,
-            (const void *) &option_value, sizeof(int));
+    for (unsigned int w = 0; w < worker_count; w++) {
+        for (unsigned int i = 0; i < listener_count; i++) {
+            sockets[count] = workers[w].listeners[i].fd;
+            ports[count++] = listeners[i].port;
+        }
+    }
 
-        // fill out the s_addr struct with information about how we want to serve data
-        memset((char *) &server_addr[i], 0, sizeof(server_addr[i]));
-        server_addr[i].sin_family = AF_INET;
-        server_addr[i].sin_addr.s_addr = INADDR_ANY;
-        server_addr[i].sin_port = htons(ports[i]);
+    fflush(stdout);
 
-        // attempt to bind to the port number
-        if (bind(socket_fds[i], (struct sockaddr *) &server_addr[i], sizeof(server_addr[i])) < 0) {
-            error("could not bind to socket", 2);
-        }
+    pid = fork();
+
+    // only async signal safe calls are made between fork() and exec()
+    if (pid == 0) {
+        sigset_t none;
 
-        // print some information and listen
-        printf("Listening on port %u for %s requests...\n", ports[i], getLangName(i + 1));
+        sigemptyset(&none);
+        pthread_sigmask(SIG_SETMASK, &none, NULL);
+        fcntl(pair[1], F_SETFD, 0);
 
-        listen(socket_fds[i], 5);
-    
+        execvp(upgrade_argv[0], upgrade_argv);
+        _exit(127);
     }
 
-    // loop forever
-    while (true) {
+    close(pair[1]);
 
-        // holds the client address information
-        struct sockaddr_in client_addr;
+    if (pid < 0 || !handoffSend(pair[0], sockets, ports, count) || !handoffWait(pair[0], HANDOFF_TIMEOUT)) {
 
-        // the length of the client address data struct
-        socklen_t client_addr_len = sizeof(client_addr);
+        // a new server that is late must not start serving alongside this one
+        if (pid > 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+        }
 
-        // holds the IP address of the client
-        char client_ip_address_string[INET_ADDRSTRLEN];
+        printf("Upgrade failed, the new server did not take over\n");
+        fflush(stdout);
 
-        // the active socket that received the request
-        // used to determine the port number and to send a response
-        int active_socket_fd = -1;
+        close(pair[0]);
+        free(upgrade_argv);
+        free(sockets);
+        free(ports);
+        return;
+    }
+
+    printf("Handed %u sockets to process %d, draining\n", count, pid);
+    fflush(stdout);
 
-        // the type of request we are handling, read from the request packet
-        uint16_t request_type = 0;
+    close(pair[0]);
 
-        // the language the user requested the response in
-        // this is based on the port they connect to
-        uint16_t language_code = 0;
+    handed_over = true;
 
-        // holds the number of bytes received by the server for a request
-        int bytes_received;
+    // the same as being told to stop, except the sockets live on in the new server
+    handleSignal(SIGTERM);
+}
 
-        // the buffer to place the received data
-        uint8_t buffer[256];
+/**
+ * Receives the sockets of an old server that is being upgraded, checking
+ * that it listens on the same ports with the same number of workers.
+ * 
+ * @param fd The Unix socket the old server hands the sockets over on.
+ * @param ports The ports this server listens on.
+ * @param port_count The number of ports.
+ * @param workers The number of workers.
+ * @return The sockets, port by port for each worker in turn.
+ * */
+int* takeOver(int fd, struct listener ports[], unsigned int port_count, unsigned int workers)
+{
+    int* sockets = calloc(workers * port_count, sizeof(int));
+    uint16_t* socket_ports = calloc(workers * port_count, sizeof(uint16_t));
 
-        // the buffer to hold the response data
-        uint8_t response[RES_PKT_LEN];
+    if (sockets == NULL || socket_ports == NULL) {
+        error("could not allocate the sockets to take over", 3);
+    }
 
-        // holds information on which sockets to wait for while selecting
-        fd_set socket_set;
+    if (!handoffReceive(fd, sockets, socket_ports, workers * port_count)) {
+        error("could not take over the old server's sockets, it must run as many workers on as many ports", 2);
+    }
 
-        // reset the socket_set struct
-        FD_ZERO(&socket_set);
-        for (int i = 0; i < 3; i++) {
-            FD_SET(socket_fds[i], &socket_set);
+    for (unsigned int w = 0; w < workers; w++) {
+        for (unsigned int i = 0; i < port_count; i++) {
+            if (socket_ports[w * port_count + i] != ports[i].port) {
+                error("the old server listens on different ports", 1);
+            }
         }
+    }
+
+    free(socket_ports);
+
+    return sockets;
+}
+
+/**
+ * Prints the counters kept by the server, summed over all of the workers.
+ * The counters are only written by their own worker so they are read
+ * without stopping anyone.
+ * */
+void printStats()
+{
+    uint64_t rebuilds = 0, postponed = 0, hits = 0, logged = 0, dropped = 0;
+    uint64_t zerocopy_sends = 0, zerocopy_completed = 0, zerocopy_copied = 0;
+    uint64_t limited = 0, evictions = 0, tracked = 0;
+    unsigned int peak = 0, pool_high_water = 0;
+    uint64_t pool_allocations = 0, pool_exhausted = 0;
+    uint64_t spin_wakeups = 0, sleep_wakeups = 0, spin_ns = 0, sleep_ns = 0;
+
+    // the service times of every worker
+    struct worker_metrics total;
+
+    metricsInit(&total, listener_count, workers[0].options->timestamps);
 
-        // perform the select
-        int selectResult = select(max(socket_fds, 3) + 1, &socket_set, NULL, NULL, NULL);
+    for (unsigned int w = 0; w < worker_count; w++) {
+        metricsCollect(&total, workers[w].metrics);
+
+        rebuilds += __atomic_load_n(&workers[w].cache->rebuilds, __ATOMIC_RELAXED);
+        postponed += __atomic_load_n(&workers[w].cache->postponed, __ATOMIC_RELAXED);
+        hits += __atomic_load_n(&workers[w].cache->hits, __ATOMIC_RELAXED);
+        logged += __atomic_load_n(&workers[w].log->written, __ATOMIC_RELAXED);
+        dropped += __atomic_load_n(&workers[w].log->dropped, __ATOMIC_RELAXED);
+
+        pool_allocations += __atomic_load_n(&workers[w].pool.allocations, __ATOMIC_RELAXED);
+        limited += __atomic_load_n(&workers[w].limiter.limited, __ATOMIC_RELAXED);
+        evictions += __atomic_load_n(&workers[w].limiter.evictions, __ATOMIC_RELAXED);
+        tracked += __atomic_load_n(&workers[w].limiter.count, __ATOMIC_RELAXED);
+        pool_exhausted += __atomic_load_n(&workers[w].pool.exhausted, __ATOMIC_RELAXED);
+        spin_wakeups += __atomic_load_n(&workers[w].spin_wakeups, __ATOMIC_RELAXED);
+        sleep_wakeups += __atomic_load_n(&workers[w].sleep_wakeups, __ATOMIC_RELAXED);
+        spin_ns += __atomic_load_n(&workers[w].spin_ns, __ATOMIC_RELAXED);
+        sleep_ns += __atomic_load_n(&workers[w].sleep_ns, __ATOMIC_RELAXED);
+
+        unsigned int worker_high_water = __atomic_load_n(&workers[w].pool.high_water, __ATOMIC_RELAXED);
+        if (worker_high_water > pool_high_water) {
+            pool_high_water = worker_high_water;
+        }
 
-        // if there was an error selecting
-        if (selectResult == -1) {
-            error("select failed", 4);
+        unsigned int worker_peak = __atomic_load_n(&workers[w].scheduler.peak, __ATOMIC_RELAXED);
+        if (worker_peak > peak) {
+            peak = worker_peak;
         }
+    }
 
-        // iterate through the pollfd values until one is ready to receive data
-        // store the socket descriptor and the language code
-        for (int i = 0; i < 3; i++) {
+    printf("Response cache: %lu rebuilds, %lu postponed while in flight, %lu hits\n", rebuilds, postponed, hits);
+    printf("Clock: %lu local time conversions\n", clockRefreshes());
+    printf("Request log: %lu written, %lu dropped\n", logged, dropped);
+    printf("Packet pool: at most %u of %u buffers in use at once, %lu taken, %lu requests came up short\n",
+        pool_high_water, workers[0].options->pool_buffers, pool_allocations, pool_exhausted);
+    if (workers[0].options->limit) {
+        printf("Rate limiter: %lu requests limited, %lu of %u addresses tracked, %lu evicted\n",
+            limited, tracked, workers[0].limiter.capacity * worker_count, evictions);
+    }
 
-            if (FD_ISSET(socket_fds[i], &socket_set)) {
+    printf("Scheduler: at most %u of %u sockets waiting at once\n", peak, listener_count);
 
-                active_socket_fd = socket_fds[i];
-                language_code = i + 1;
+    // how often spinning paid off and what it cost
+    if (workers[0].options->busy_poll > 0) {
+        printf("Busy poll: %lu wakeups while spinning, %lu after sleeping (%.1f%% spun), %.3f s spinning, %.3f s asleep\n",
+            spin_wakeups, sleep_wakeups,
+            spin_wakeups + sleep_wakeups > 0 ? 100.0 * spin_wakeups / (spin_wakeups + sleep_wakeups) : 0.0,
+            spin_ns / 1e9, sleep_ns / 1e9);
+    }
 
-                // break when we find a readable socket descriptor
-                // of course this means that English will have priority over 
-                // Maori will have priority over German
-                break;
+    // the time from receiving each request to sending its answer
+    for (uint16_t type = REQ_DATE; type <= REQ_BATCH; type++) {
+        struct histogram* service = &total.service[type];
+
+        printf("Service time (%s): %lu answered, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+            getRequestTypeString(type), service->count, histogramPercentile(service, 50) / 1e3,
+            histogramPercentile(service, 99) / 1e3, service->count > 0 ? service->max / 1e3 : 0.0);
+    }
+
+    // the service counts of each port and the bytes still queued in the kernel
+    for (unsigned int i = 0; i < listener_count; i++) {
+
+        uint64_t received = 0, turns = 0, deferrals = 0, queued = 0;
+        char name[LISTENER_NAME_LEN];
+
+        for (unsigned int w = 0; w < worker_count; w++) {
+
+            struct listener* listener = &workers[w].listeners[i];
+
+            // the receive queue memory of the socket, read from the kernel
+            uint32_t meminfo[SK_MEMINFO_VARS] = {0};
+            socklen_t meminfo_len = sizeof(meminfo);
+
+            received += __atomic_load_n(&listener->received, __ATOMIC_RELAXED);
+            zerocopy_sends += __atomic_load_n(&listener->zerocopy_sends, __ATOMIC_RELAXED);
+            zerocopy_completed += __atomic_load_n(&listener->zerocopy_completed, __ATOMIC_RELAXED);
+            zerocopy_copied += __atomic_load_n(&listener->zerocopy_copied, __ATOMIC_RELAXED);
+            turns += __atomic_load_n(&listener->turns, __ATOMIC_RELAXED);
+            deferrals += __atomic_load_n(&listener->deferrals, __ATOMIC_RELAXED);
+
+            if (getsockopt(listener->fd, SOL_SOCKET, SO_MEMINFO, meminfo, &meminfo_len) == 0) {
+                queued += meminfo[SK_MEMINFO_RMEM_ALLOC];
             }
         }
 
-        // receive data from the client
-        bytes_received = recvfrom(active_socket_fd, buffer, sizeof(buffer), 0,
-            (struct sockaddr *) &client_addr, &client_addr_len);
-
-        // get the IP address of the client as a string
-        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip_address_string, INET_ADDRSTRLEN);
+        listenerName(&listeners[i], name, sizeof(name));
 
-        // print the date, time and the ip address of the client
-        printCurrentDateTimeString();
-        printf(" - %s - ", client_ip_address_string);
+        printf("Port %s (%s): quota %u, %lu received in %lu turns, %lu turns cut short, %lu bytes queued\n",
+            name, getLangName(listeners[i].language_code), listeners[i].quota, received, turns, deferrals, queued);
 
-        // if an error occurred during reading the information, print an error
-        if (bytes_received < 0) {
-            printf("network error - packet discarded\n");
-            continue;
+        // where the time went between the kernel receiving a request and the response being sent
+        if (total.queueing != NULL) {
+            printf("Port %s timestamps: queued p50 %.1f us, p99 %.1f us, sent p50 %.1f us, p99 %.1f us after arrival, "
+                "%lu dropped on a full queue\n", name,
+                histogramPercentile(&total.queueing[i], 50) / 1e3, histogramPercentile(&total.queueing[i], 99) / 1e3,
+                histogramPercentile(&total.sojourn[i], 50) / 1e3, histogramPercentile(&total.sojourn[i], 99) / 1e3,
+                total.ports[i].overflows);
         }
+    }
 
-        // handle the data
-        if (!dtReqValid(buffer, bytes_received)) {
+    metricsClose(&total);
 
-            printf("invalid request - packet discarded\n");
+    if (workers[0].options->zerocopy) {
+        printf("Zero copy: %lu sends, %lu completed, %lu copied by the kernel anyway\n",
+            zerocopy_sends, zerocopy_completed, zerocopy_copied);
+    }
 
-        } else {
+    if (workers[0].options->announce) {
+        printf("Announcements: %lu minutes announced, %lu datagrams failed to send\n",
+            __atomic_load_n(&announcer.announcements, __ATOMIC_RELAXED),
+            __atomic_load_n(&announcer.failures, __ATOMIC_RELAXED));
+    }
+
+    if (workers[0].options->time_page != NULL) {
+        printf("Time page: %lu minutes published\n", __atomic_load_n(&time_page.page->published, __ATOMIC_RELAXED));
+    }
+
+    fflush(stdout);
+}
 
-            // print some more information
-            request_type = dtReqType(buffer, bytes_received);
+/**
+ * Creates a socket bound to a port.
+ * 
+ * @param port The port to bind to.
+ * @param reuse_port True if other workers will bind to the same port.
+ * @param incoming_cpu The CPU whose datagrams the socket takes, or -1 for any.
+ * @param options The options saying which socket features are used.
+ * @return The socket descriptor.
+ * */
+int createSocket(uint16_t port, bool reuse_port, int incoming_cpu, struct server_options* options)
+{
+    // holds the server address information
+    struct sockaddr_in server_addr;
 
-            printf("%s %s requested - ", getLangName(language_code), getRequestTypeString(request_type));
+    // required for setsockopt(), set it to 1 to allow us to reuse local addresses
+    int option_value = 1;
 
-            // zero the response packet buffer
-            memset(response, 0, RES_PKT_LEN);
+    // the socket is non-blocking because it is drained until EAGAIN, and it
+    // is only passed on to an upgraded server deliberately, never by exec
+    int socket_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 
-            // construct the response packet
-            size_t b = dtResNow(response, RES_PKT_LEN, request_type, language_code);
+    if (socket_fd < 0) {
+        error("could not create a socket", 2);
+    }
 
-            // attempt to sent the response packet
-            if (sendto(active_socket_fd, response, b, 0, (struct sockaddr *) &client_addr, client_addr_len) < 0) {
-                printf("response failed to send\n");
-            } else {
-                printf("response sent\n");
-            }
+    // lets us reuse the port after killing the server.
+    setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR,
+        (const void *) &option_value, sizeof(int));
+
+    // lets the kernel spread the datagrams for this port across the workers
+    if (reuse_port && setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT,
+        (const void *) &option_value, sizeof(int)) < 0) {
+        error("could not reuse the port", 2);
+    }
+
+    configureSocket(socket_fd, incoming_cpu, options);
+
+    // fill out the s_addr struct with information about how we want to serve data
+    memset((char *) &server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+
+    // attempt to bind to the port number
+    if (bind(socket_fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
+        error("could not bind to socket", 2);
+    }
+
+    return socket_fd;
+}
+
+/**
+ * Turns on the socket features that the options ask for. This is done for
+ * new sockets before they are bound, and for the sockets taken over from an
+ * old server, which were bound by it.
+ * 
+ * @param socket_fd The socket.
+ * @param incoming_cpu The CPU whose datagrams the socket takes, or -1 for any.
+ * @param options The options saying which socket features are used.
+ * */
+void configureSocket(int socket_fd, int incoming_cpu, struct server_options* options)
+{
+    // io_uring tracks its own zero copy sends
+    bool zerocopy = options->zerocopy && !options->uring;
+
+    int option_value = 1;
+
+    // MSG_ZEROCOPY is only for UDP, Unix sockets always copy
+    int domain = AF_INET;
+    socklen_t domain_len = sizeof(domain);
+
+    getsockopt(socket_fd, SOL_SOCKET, SO_DOMAIN, &domain, &domain_len);
+    zerocopy = zerocopy && domain == AF_INET;
 
+    // without this the kernel ignores MSG_ZEROCOPY
+    if (zerocopy && setsockopt(socket_fd, SOL_SOCKET, SO_ZEROCOPY,
+        (const void *) &option_value, sizeof(int)) < 0) {
+        error("could not enable zero copy sends", 2);
+    }
+
+    // each datagram then carries the time it arrived and the drops so far as control messages
+    if (options->timestamps && (setsockopt(socket_fd, SOL_SOCKET, SO_TIMESTAMPNS,
+        (const void *) &option_value, sizeof(int)) < 0 ||
+        setsockopt(socket_fd, SOL_SOCKET, SO_RXQ_OVFL,
+        (const void *) &option_value, sizeof(int)) < 0)) {
+        error("could not enable receive timestamps", 2);
+    }
+
+    // have the kernel poll the device queue for a while rather than wait for an
+    // interrupt, raising the limit above net.core.busy_read needs CAP_NET_ADMIN
+    if (options->busy_poll > 0) {
+
+        int busy_poll = options->busy_poll;
+
+        if (setsockopt(socket_fd, SOL_SOCKET, SO_BUSY_POLL,
+            (const void *) &busy_poll, sizeof(int)) < 0) {
+            error("could not enable busy polling", 2);
         }
 
+        // only a hint, and older kernels do not know it
+        setsockopt(socket_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+            (const void *) &option_value, sizeof(int));
     }
 
+    // of the sockets sharing the port, the kernel then prefers the one whose
+    // CPU handled the datagram's interrupt, so it never crosses to another core
+    if (incoming_cpu >= 0 && setsockopt(socket_fd, SOL_SOCKET, SO_INCOMING_CPU,
+        (const void *) &incoming_cpu, sizeof(int)) < 0) {
+        error("could not steer the socket to its CPU", 2);
+    }
 }
 
 /**
- * Reads the ports from argv and puts them into the ports array.
+ * Creates a Unix datagram socket bound to a path, for clients on the same
+ * host. Anything left at the path by a server that did not stop cleanly is
+ * removed first, and any local user may send to the socket, as they may to
+ * the ports.
  * 
- * @param arv The arguments passed into main.
- * @param ports The array to populate with ports.
- * @return True if all ports were valid.
+ * @param path The path to bind to.
+ * @param options The options saying which socket features are used.
+ * @return The socket descriptor.
  * */
-bool readPorts(char** argv, uint16_t* ports)
+int createUnixSocket(char* path, struct server_options* options)
 {
-    for (int i = 0; i < 3; i++) {
-        ports[i] = atoi(argv[i+1]);
-        if (ports[i] < MIN_PORT_NO ||
-            ports[i] > MAX_PORT_NO) {
-            return false;
+    struct sockaddr_un server_addr;
+    struct stat path_stat;
+
+    int socket_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (socket_fd < 0) {
+        error("could not create a Unix socket", 2);
+    }
+
+    configureSocket(socket_fd, -1, options);
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sun_family = AF_UNIX;
+    strcpy(server_addr.sun_path, path);
+
+    // only a socket left behind by a server that stopped is replaced, anything else is a mistake
+    if (lstat(path, &path_stat) == 0) {
+        if (!S_ISSOCK(path_stat.st_mode)) {
+            char msg[160] = {0};
+            snprintf(msg, sizeof(msg), "%s exists and is not a socket, so it was not replaced", path);
+            error(msg, 1);
         }
+
+        unlink(path);
     }
-    return true;
+
+    // the socket takes its permissions from the umask, like any other file the server creates
+    if (bind(socket_fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
+        error("could not bind to the Unix socket path", 2);
+    }
+
+    return socket_fd;
+}
+
+/**
+ * Creates the socket that answers stats requests. It is bound to the
+ * loopback address so that only local tools can read the counters, and
+ * it blocks since the admin thread has nothing else to do.
+ *
+ * @param port The port to bind to.
+ * @return The socket descriptor.
+ * */
+int createAdminSocket(uint16_t port)
+{
+    struct sockaddr_in admin_addr;
+
+    int option_value = 1;
+
+    int socket_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+    if (socket_fd < 0) {
+        error("could not create the admin socket", 2);
+    }
+
+    setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR,
+        (const void *) &option_value, sizeof(int));
+
+    memset((char *) &admin_addr, 0, sizeof(admin_addr));
+    admin_addr.sin_family = AF_INET;
+    admin_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    admin_addr.sin_port = htons(port);
+
+    if (bind(socket_fd, (struct sockaddr *) &admin_addr, sizeof(admin_addr)) < 0) {
+        error("could not bind to the admin socket", 2);
+    }
+
+    return socket_fd;
+}
+
+/**
+ * Answers stats requests on the admin socket with a snapshot of the
+ * counters. Anything that is not a stats request is ignored.
+ *
+ * @param arg Unused.
+ * @return Never returns, the thread ends with the process.
+ * */
+void* runAdmin(void* arg)
+{
+    // the snapshot is written straight into the response after the header
+    uint8_t* response = malloc(STATS_RES_MAX_LEN);
+    char* text = malloc(STATS_RES_MAX_LEN);
+
+    if (response == NULL || text == NULL) {
+        error("could not allocate the stats response", 3);
+    }
+
+    while (true) {
+
+        uint8_t request[REQ_BUFFER_LEN];
+        struct sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        size_t length;
+
+        ssize_t received = recvfrom(admin_fd, request, sizeof(request), 0,
+            (struct sockaddr *) &client_addr, &client_addr_len);
+
+        if (received < 0 || !dtStatsReqValid(request, received)) {
+            continue;
+        }
+
+        length = writeSnapshot(text, STATS_RES_MAX_LEN - STATS_HEADER_LEN);
+        length = dtStatsRes(response, STATS_RES_MAX_LEN, text, length);
+
+        // a tool that has already given up is not worth waiting for
+        sendto(admin_fd, response, length, MSG_DONTWAIT,
+            (struct sockaddr *) &client_addr, client_addr_len);
+    }
+
+    return NULL;
+}
+
+/**
+ * Sums the counters of every worker while they carry on serving and
+ * writes the totals as text.
+ *
+ * @param text Where to write the text, which is not terminated.
+ * @param n The size of text.
+ * @return The length of the text.
+ * */
+size_t writeSnapshot(char* text, size_t n)
+{
+    struct worker_metrics total;
+    char** ports = calloc(listener_count, sizeof(char*));
+    char* names = calloc(listener_count, LISTENER_NAME_LEN);
+    size_t length;
+
+    if (ports == NULL || names == NULL) {
+        error("could not allocate the snapshot", 3);
+    }
+
+    for (unsigned int i = 0; i < listener_count; i++) {
+        ports[i] = names + i * LISTENER_NAME_LEN;
+        listenerName(&listeners[i], ports[i], LISTENER_NAME_LEN);
+    }
+
+    metricsInit(&total, listener_count, workers[0].options->timestamps);
+
+    for (unsigned int w = 0; w < worker_count; w++) {
+        metricsCollect(&total, workers[w].metrics);
+    }
+
+    length = metricsFormat(&total, ports, text, n);
+
+    metricsClose(&total);
+    free(ports);
+    free(names);
+
+    return length;
 }
+
+/**
+ * Serves on all of the ports. Each worker gets its own socket for every
+ * port and runs in its own thread while the main thread waits for signals.
+ * 
+ * @param ports The ports to serve on and their languages.
+ * @param port_count The number of ports.
+ * @param options The options controlling how requests are received and sent.
+ * */
+void serve(struct listener ports[], unsigned int port_count, struct server_options* options)
+{
+    // the signals handled by the main thread
+    sigset_t signals;
+
+    // the signal that was received
+    int sig;
+
+    // the sockets handed over by an old server, worker by worker, or NULL to bind new ones
+    int* inherited = NULL;
+
+    // block the signals before starting any thread, the logger included, so that only this thread sees them
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    worker_count = options->workers;
+    workers = calloc(worker_count, sizeof(struct worker));
+
+    if (workers == NULL) {
+        error("could not allocate the workers", 3);
+    }
+
+    shutdown_fd = eventfd(0, EFD_CLOEXEC);
+
+    if (shutdown_fd < 0) {
+        error("could not create the shutdown event", 2);
+    }
+
+    // each worker gets its own ring in the request log
+    loggerStart(&logger, worker_count);
+
+    // the logger stays off the workers' CPUs
+    if (options->background_cpu_count > 0) {
+
+        cpu_set_t background;
+
+        fillCpuSet(&background, options->background_cpus, options->background_cpu_count);
+
+        if (pthread_setaffinity_np(logger.thread, sizeof(background), &background) != 0) {
+            error("could not pin the logger to the background CPUs", 3);
+        }
+    }
+
+    if (options->takeover_fd >= 0) {
+        inherited = takeOver(options->takeover_fd, ports, port_count, worker_count);
+    }
+
+    // bind every socket up front so that errors are reported before serving
+    for (unsigned int w = 0; w < worker_count; w++) {
+
+        workers[w].id = w;
+        workers[w].options = options;
+        workers[w].log = &logger.rings[w];
+        workers[w].listener_count = port_count;
+        workers[w].listeners = calloc(port_count, sizeof(struct listener));
+
+        if (workers[w].listeners == NULL) {
+            error("could not allocate the listeners", 3);
+        }
+
+        // the CPU whose interrupts this worker's sockets take their datagrams from
+        int incoming_cpu = options->incoming_cpu ? (int) options->cpus[w % options->cpu_count] : -1;
+
+        for (unsigned int i = 0; i < port_count; i++) {
+            workers[w].listeners[i] = ports[i];
+
+            if (inherited != NULL) {
+                workers[w].listeners[i].fd = inherited[w * port_count + i];
+                configureSocket(workers[w].listeners[i].fd, ports[i].path == NULL ? incoming_cpu : -1, options);
+            } else if (ports[i].path != NULL && w > 0) {
+                // a Unix socket has no SO_REUSEPORT, so every worker reads the one socket through its own descriptor
+                workers[w].listeners[i].fd = fcntl(workers[0].listeners[i].fd, F_DUPFD_CLOEXEC, 0);
+
+                if (workers[w].listeners[i].fd < 0) {
+                    error("could not share a Unix socket with a worker", 2);
+                }
+            } else if (ports[i].path != NULL) {
+                workers[w].listeners[i].fd = createUnixSocket(ports[i].path, options);
+            } else {
+                workers[w].listeners[i].fd = createSocket(ports[i].port, worker_count > 1, incoming_cpu, options);
+            }
+
+            // io_uring tracks its own zero copy sends, and Unix sockets always copy
+            if (options->zerocopy && !options->uring && ports[i].path == NULL) {
+                workers[w].listeners[i].zerocopy_generations = malloc(ZEROCOPY_INFLIGHT);
+
+                if (workers[w].listeners[i].zerocopy_generations == NULL) {
+                    error("could not allocate the zero copy slots", 3);
+                }
+
+                memset(workers[w].listeners[i].zerocopy_generations, ZEROCOPY_FREE, ZEROCOPY_INFLIGHT);
+            }
+        }
+
+        // the sockets are registered once, the workers never touch the interest list again
+        workers[w].epoll_fd = createEventLoop(&workers[w]);
+
+        schedulerInit(&workers[w].scheduler, port_count);
+    }
+
+    for (unsigned int i = 0; i < port_count; i++) {
+        if (ports[i].path != NULL) {
+            printf("Listening on %s for %s requests...\n", ports[i].path, getLangName(ports[i].language_code));
+        } else {
+            printf("Listening on port %u for %s requests...\n", ports[i].port, getLangName(ports[i].language_code));
+        }
+    }
+
+    if (options->uring) {
+        printf("Serving with io_uring multishot receives");
+    } else if (options->single) {
+        printf("Serving one datagram at a time");
+    } else {
+        printf("Serving up to %u datagrams per system call", options->batch_size);
+    }
+
+    printf(" with %u worker%s", worker_count, worker_count == 1 ? "" : "s");
+
+    if (options->zerocopy) {
+        printf(", sending responses of %u bytes or more without a copy", options->zerocopy_threshold);
+    }
+
+    if (options->busy_poll > 0) {
+        printf(", spinning for up to %u us before sleeping", options->busy_poll);
+    }
+
+    if (options->incoming_cpu) {
+        printf(", each socket taking the datagrams steered to its worker's CPU");
+    }
+
+    printf("\n");
+
+    if (options->admin_port != 0) {
+        admin_fd = createAdminSocket(options->admin_port);
+        printf("Answering stats requests on 127.0.0.1 port %u\n", options->admin_port);
+    }
+
+    if (options->announce) {
+        char group[INET_ADDRSTRLEN];
+
+        announcerInit(&announcer, &options->announce_group, options->announce_interface, options->announce_ttl);
+
+        inet_ntop(AF_INET, &options->announce_group.sin_addr, group, sizeof(group));
+        printf("Announcing every minute to %s port %u\n", group, ntohs(options->announce_group.sin_port));
+    }
+
+    // a server taking over shares the page with the old one until it exits
+    if (options->time_page != NULL) {
+        timepageCreate(&time_page, options->time_page, options->takeover_fd < 0);
+        printf("Publishing every minute to the time page %s\n", options->time_page);
+    }
+
+    fflush(stdout);
+
+    pthread_barrier_init(&workers_ready, NULL, worker_count + 1);
+
+    for (unsigned int w = 0; w < worker_count; w++) {
+
+        pthread_attr_t attr;
+
+        pthread_attr_init(&attr);
+
+        // the worker starts on its CPU so that everything it touches is allocated there
+        if (options->cpu_count > 0) {
+
+            cpu_set_t cpu;
+
+            fillCpuSet(&cpu, &options->cpus[w % options->cpu_count], 1);
+
+            if (pthread_attr_setaffinity_np(&attr, sizeof(cpu), &cpu) != 0) {
+                error("could not pin a worker to its CPU", 3);
+            }
+        }
+
+        if (pthread_create(&workers[w].thread, &attr, runWorker, &workers[w]) != 0) {
+            error("could not start a worker", 3);
+        }
+
+        pthread_attr_destroy(&attr);
+    }
+
+    // nothing reads the workers' counters until they have been allocated
+    pthread_barrier_wait(&workers_ready);
+
+    // the workers are serving, so the old server can stop
+    if (inherited != NULL) {
+
+        if (!handoffReady(options->takeover_fd)) {
+            error("the old server gave up on the upgrade", 2);
+        }
+
+        close(options->takeover_fd);
+        free(inherited);
+
+        printf("Took over %u sockets from the old server\n", worker_count * port_count);
+        fflush(stdout);
+    }
+
+    if (options->cpu_count > 0) {
+        for (unsigned int w = 0; w < worker_count; w++) {
+            printf("Worker %u on CPU %u, memory node %u\n", w, workers[w].cpu, workers[w].node);
+        }
+
+        fflush(stdout);
+    }
+
+    // the snapshots are taken on their own thread so the workers never wait for them
+    if (admin_fd >= 0) {
+
+        pthread_attr_t attr;
+
+        pthread_attr_init(&attr);
+
+        if (options->background_cpu_count > 0) {
+
+            cpu_set_t background;
+
+            fillCpuSet(&background, options->background_cpus, options->background_cpu_count);
+
+            if (pthread_attr_setaffinity_np(&attr, sizeof(background), &background) != 0) {
+                error("could not pin the admin thread to the background CPUs", 3);
+            }
+        }
+
+        if (pthread_create(&admin_thread, &attr, runAdmin, NULL) != 0) {
+            error("could not start the admin thread", 3);
+        }
+
+        pthread_attr_destroy(&attr);
+    }
+
+    // the announcements are ready to go once the workers are serving the same minute
+    if (options->announce) {
+
+        announcerStart(&announcer);
+
+        if (options->background_cpu_count > 0) {
+
+            cpu_set_t background;
+
+            fillCpuSet(&background, options->background_cpus, options->background_cpu_count);
+
+            if (pthread_setaffinity_np(announcer.thread, sizeof(background), &background) != 0) {
+                error("could not pin the announcer to the background CPUs", 3);
+            }
+        }
+    }
+
+    if (options->time_page != NULL) {
+
+        timepageStart(&time_page);
+
+        if (options->background_cpu_count > 0) {
+
+            cpu_set_t background;
+
+            fillCpuSet(&background, options->background_cpus, options->background_cpu_count);
+
+            if (pthread_setaffinity_np(time_page.thread, sizeof(background), &background) != 0) {
+                error("could not pin the time page writer to the background CPUs", 3);
+            }
+        }
+    }
+
+    // this thread only prints stats and handles signals, so it joins the other background threads
+    if (options->background_cpu_count > 0) {
+
+        cpu_set_t background;
+
+        fillCpuSet(&background, options->background_cpus, options->background_cpu_count);
+
+        if (pthread_setaffinity_np(pthread_self(), sizeof(background), &background) != 0) {
+            error("could not pin the main thread to the background CPUs", 3);
+        }
+    }
+
+    // handle signals until we are told to stop
+    while (true) {
+        if (sigwait(&signals, &sig) == 0) {
+            handleSignal(sig);
+        }
+    }
+}
+
+/**
+ * Creates the epoll instance of a worker and registers its sockets,
+ * the shutdown event and (once the worker starts) its cache timer.
+ * The sockets are edge triggered and the event data holds the index of
+ * the listener so no lookup is needed when it becomes readable.
+ * 
+ * @param worker The worker.
+ * @return The epoll descriptor.
+ * */
+int createEventLoop(struct worker* worker)
+{
+    struct epoll_event event = {0};
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (epoll_fd < 0) {
+        error("could not create the event loop", 2);
+    }
+
+    for (unsigned int i = 0; i < worker->listener_count; i++) {
+        event.events = EPOLLIN | EPOLLET;
+        event.data.u32 = i;
+
+        // every worker waits on the same Unix socket, so only wake one of them per datagram
+        if (worker->listeners[i].path != NULL && worker_count > 1) {
+            event.events |= EPOLLEXCLUSIVE;
+        }
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, worker->listeners[i].fd, &event) < 0) {
+            error("could not add a socket to the event loop", 2);
+        }
+    }
+
+    // the shutdown event is level triggered and never reset so that every worker sees it
+    event.events = EPOLLIN;
+    event.data.u32 = EVENT_SHUTDOWN;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, shutdown_fd, &event) < 0) {
+        error("could not add the shutdown event to the event loop", 2);
+    }
+
+    return epoll_fd;
+}
+
+/**
+ * The receive/respond loop of a single worker. Nothing in here is
+ * shared with the other workers.
+ * 
+ * @param arg The worker.
+ * @return NULL once the server is shutting down.
+ * */
+void* runWorker(void* arg)
+{
+    struct worker* worker = (struct worker*) arg;
+    struct server_options* options = worker->options;
+
+    // the events returned by each wait
+    struct epoll_event events[MAX_EVENTS];
+
+    // used to register the cache timer
+    struct epoll_event event = {0};
+
+    // allocate everything on this worker's node, then let the main thread carry on
+    initWorker(worker);
+    pthread_barrier_wait(&workers_ready);
+
+    event.events = EPOLLIN;
+    event.data.u32 = EVENT_CACHE_TIMER;
+
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->cache->timer_fd, &event) < 0) {
+        error("could not add the cache timer to the event loop", 2);
+    }
+
+    // serve from io_uring until shutdown, or fall back to epoll if the kernel cannot
+    if (options->uring) {
+        if (serveUring(worker)) {
+            return NULL;
+        }
+
+        if (worker->id == 0) {
+            printf("io_uring is unavailable (%s), falling back to epoll\n", strerror(errno));
+            fflush(stdout);
+        }
+    }
+
+    // the preallocated buffers for the batched path
+    if (!options->single) {
+        worker->batch = createBatch(options->batch_size);
+    }
+
+    // loop until the server shuts down
+    while (true) {
+
+        // only block when no socket is still waiting for its turn, and only pause
+        // before its turn while the kernel is short of memory
+        int timeout = schedulerPending(&worker->scheduler) > 0 ? worker->receive_backoff : -1;
+
+        int ready = timeout == -1 && options->busy_poll > 0 ?
+            busyWait(worker, events) :
+            epoll_wait(worker->epoll_fd, events, MAX_EVENTS, timeout);
+
+        if (ready == -1 && errno == EINTR) {
+            continue;
+        }
+
+        // if there was an error waiting
+        if (ready == -1) {
+            error("epoll_wait failed", 4);
+        }
+
+        for (int e = 0; e < ready; e++) {
+
+            uint32_t index = events[e].data.u32;
+
+            if (index == EVENT_SHUTDOWN) {
+                return NULL;
+            }
+
+            // rebuild the responses when the minute rolls over
+            if (index == EVENT_CACHE_TIMER) {
+                cacheHandleTimer(worker->cache);
+                continue;
+            }
+
+            // the error queue holds the completions of zero copy sends
+            if (events[e].events & EPOLLERR) {
+                zerocopyDrain(worker, &worker->listeners[index]);
+            }
+
+            // queue the socket behind the ones that are already waiting
+            if (events[e].events & EPOLLIN) {
+                schedulerPush(&worker->scheduler, index);
+            }
+        }
+
+        // give every waiting socket one turn
+        serveTurn(worker);
+
+    }
+
+}
+
+/**
+ * Allocates the state that only a worker touches. It runs on the worker's
+ * own thread, after it has been pinned, so that the kernel places each
+ * page on the worker's memory node when it is first written. The pool is
+ * written in full for that reason rather than left to fault in later.
+ * 
+ * @param worker The worker.
+ * */
+void initWorker(struct worker* worker)
+{
+    struct server_options* options = worker->options;
+
+    // where the pages below end up
+    if (getcpu(&worker->cpu, &worker->node) < 0) {
+        error("could not read the worker's CPU", 3);
+    }
+
+    // build the responses for this minute, then once per minute from the timer
+    worker->cache = malloc(sizeof(struct response_cache));
+
+    if (worker->cache == NULL) {
+        error("could not allocate the response cache", 3);
+    }
+
+    cacheInit(worker->cache);
+
+    // every buffer the worker receives into is allocated now
+    poolInit(&worker->pool, options->pool_buffers, PACKET_BUFFER_LEN);
+
+    // SO_REUSEPORT spreads an address's flows over every worker, so each worker gets
+    // an even share of the limit, and still lets a whole request through
+    if (options->limit) {
+        double burst = options->limit_burst / options->workers;
+
+        limiterInit(&worker->limiter, options->limit_slots, options->limit_rate / options->workers,
+            burst >= 1 ? burst : 1);
+    }
+
+    // the counters are padded out to their own cache lines
+    worker->metrics = metricsCreate(worker->listener_count, options->timestamps);
+}
+
+/**
+ * Waits for events by polling the epoll instance without blocking until
+ * something is ready or the busy poll budget runs out, and only then goes
+ * to sleep. Spinning saves the wakeup latency of the scheduler at the cost
+ * of a CPU, and the wakeups and time of each kind are counted so that the
+ * trade can be judged.
+ * 
+ * @param worker The worker.
+ * @param events Where the events are to be stored, MAX_EVENTS of them.
+ * @return The number of events, or -1 on error.
+ * */
+int busyWait(struct worker* worker, struct epoll_event events[])
+{
+    uint64_t budget = (uint64_t) worker->options->busy_poll * 1000;
+    uint64_t start = metricsNow();
+    uint64_t now = start;
+    int ready;
+
+    do {
+        ready = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, 0);
+
+        if (ready != 0) {
+            worker->spin_wakeups++;
+            worker->spin_ns += metricsNow() - start;
+            return ready;
+        }
+
+        now = metricsNow();
+
+    } while (now - start < budget);
+
+    worker->spin_ns += now - start;
+
+    ready = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, -1);
+
+    worker->sleep_wakeups++;
+    worker->sleep_ns += metricsNow() - now;
+
+    return ready;
+}
+
+/**
+ * Services every waiting socket once, in round-robin order. Each socket
+ * receives at most its quota of datagrams, then goes to the back of the
+ * queue if it still has more. This stops a flooded port from starving
+ * the others while they wait for the flood to be drained.
+ * 
+ * @param worker The worker.
+ * */
+void serveTurn(struct worker* worker)
+{
+    // only the sockets that are waiting now get a turn, requeued ones wait for the next
+    unsigned int waiting = schedulerPending(&worker->scheduler);
+
+    // true if a socket could not be read for want of kernel memory
+    bool short_of_memory = false;
+
+    for (unsigned int k = 0; k < waiting; k++) {
+
+        unsigned int index;
+        struct listener* listener;
+
+        // the number of datagrams this socket may still receive this turn
+        unsigned int budget;
+
+        // true once the socket returns EAGAIN
+        bool empty = false;
+
+        schedulerPop(&worker->scheduler, &index);
+
+        listener = &worker->listeners[index];
+        budget = listener->quota;
+
+        while (budget > 0) {
+
+            int received = worker->options->single ?
+                serveSingle(worker, listener) :
+                serveBatch(worker, listener, budget);
+
+            // a failed socket is left until it is readable again rather than retried in a loop
+            if (received == 0 || received == SERVE_FAILED) {
+                empty = true;
+                break;
+            }
+
+            if (received == SERVE_BACKOFF) {
+                short_of_memory = true;
+                break;
+            }
+
+            // out of buffers, so try again next turn
+            if (received < 0) {
+                break;
+            }
+
+            budget -= received;
+        }
+
+        listener->received += listener->quota - budget;
+        listener->turns++;
+
+        // the socket is edge triggered so it must be revisited until it is empty
+        if (!empty) {
+            listener->deferrals++;
+            schedulerPush(&worker->scheduler, index);
+        }
+    }
+
+    // back off for longer each turn the kernel stays short of memory rather than spin on it
+    if (short_of_memory) {
+        worker->receive_backoff = worker->receive_backoff == 0 ? 1 : worker->receive_backoff * 2;
+
+        if (worker->receive_backoff > MAX_RECEIVE_BACKOFF) {
+            worker->receive_backoff = MAX_RECEIVE_BACKOFF;
+        }
+    } else {
+        worker->receive_backoff = 0;
+    }
+}
+
+/**
+ * Receives a single request and sends a single response.
+ * 
+ * @param worker The worker that owns the socket.
+ * @param listener The readable socket and the language to respond in.
+ * @return The number of datagrams received, 0 once the socket is empty, SERVE_REQUEUE
+ *         if there was no buffer to receive into, SERVE_BACKOFF if the kernel was
+ *         short of memory or SERVE_FAILED if the receive failed.
+ * */
+int serveSingle(struct worker* worker, struct listener* listener)
+{
+    // the readable socket
+    int socket_fd = listener->fd;
+
+    // the language is based on the port the request arrived on
+    uint16_t language_code = listener->language_code;
+
+    // holds the client address information
+    union client_address client_addr;
+
+    // the length of the client address data struct
+    socklen_t client_addr_len = sizeof(client_addr);
+
+    // the type of request we are handling, read from the request packet
+    uint16_t request_type = 0;
+
+    // holds the number of bytes received by the server for a request
+    int bytes_received;
+
+    // the buffer to place the received data, from the worker's pool
+    uint8_t* buffer;
+
+    // the segments of the precomputed response, gathered by the kernel
+    struct iovec segments[CACHE_MAX_SEGMENTS];
+    struct msghdr response = {0};
+    size_t b;
+
+    // true if the response is sent without a copy
+    bool zerocopy;
+
+    // when the request was received, for its service time
+    uint64_t received_at;
+
+    // the header to receive into and the control messages the kernel adds to it
+    struct msghdr request = {0};
+    struct iovec request_iovec;
+    uint8_t control[RX_CONTROL_LEN];
+
+    // when the kernel received the request, if it was timestamped
+    uint64_t arrived = 0;
+
+    if (poolAlloc(&worker->pool, &buffer, 1) == 0) {
+        return SERVE_REQUEUE;
+    }
+
+    request_iovec.iov_base = buffer;
+    request_iovec.iov_len = REQ_BUFFER_LEN;
+    request.msg_name = &client_addr;
+    request.msg_namelen = client_addr_len;
+    request.msg_iov = &request_iovec;
+    request.msg_iovlen = 1;
+
+    if (worker->options->timestamps) {
+        request.msg_control = control;
+        request.msg_controllen = sizeof(control);
+    }
+
+    // receive data from the client, straight away again if a signal interrupted it
+    do {
+        bytes_received = recvmsg(socket_fd, &request, 0);
+    } while (bytes_received < 0 && errno == EINTR);
+
+    client_addr_len = request.msg_namelen;
+
+    // if an error occurred during reading the information, print an error
+    if (bytes_received < 0) {
+        poolFree(&worker->pool, &buffer, 1);
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+
+        // a shortage of kernel memory passes, so the socket is tried again a little later
+        if (errno == ENOMEM || errno == ENOBUFS) {
+            return SERVE_BACKOFF;
+        }
+
+        union client_address unknown = {0};
+
+        // anything else is logged once and the socket waits to be woken again
+        logRequest(worker, listener, &unknown, 0, OUTCOME_NETWORK_ERROR);
+        return SERVE_FAILED;
+    }
+
+    received_at = metricsNow();
+
+    if (worker->options->timestamps) {
+        arrived = readArrival(worker, listener, &request);
+        metricsQueueing(worker->metrics, listener - worker->listeners, arrived, metricsWallClock());
+    }
+
+    // handle the data
+    b = buildResponse(worker, buffer, bytes_received, &client_addr, language_code, &request_type,
+        segments, &response.msg_iovlen);
+
+    // the response is in the cache so the request is no longer needed
+    poolFree(&worker->pool, &buffer, 1);
+
+    if (b == 0) {
+        logRequest(worker, listener, &client_addr, request_type,
+            request_type == 0 ? OUTCOME_INVALID : OUTCOME_LIMITED);
+        return 1;
+    }
+
+    response.msg_name = &client_addr;
+    response.msg_namelen = client_addr_len;
+    response.msg_iov = segments;
+
+    zerocopy = zerocopyAvailable(worker, listener, b, 1);
+
+    // attempt to sent the response packet
+    if (sendmsg(socket_fd, &response, zerocopy ? MSG_ZEROCOPY : 0) < 0) {
+        logRequest(worker, listener, &client_addr, request_type, OUTCOME_SEND_FAILED);
+    } else {
+        if (zerocopy) {
+            zerocopyRecord(worker, listener, 1);
+        }
+
+        metricsService(worker->metrics, request_type, metricsNow() - received_at);
+
+        if (worker->options->timestamps) {
+            metricsSojourn(worker->metrics, listener - worker->listeners, arrived, metricsWallClock());
+        }
+
+        logRequest(worker, listener, &client_addr, request_type, OUTCOME_SENT);
+    }
+
+    return 1;
+}
+
+/**
+ * Allocates the message headers used by serveBatch(). The headers are
+ * pointed at their addresses once so that the hot path only needs to
+ * fill in lengths and the buffers taken from the pool.
+ * 
+ * @param size The maximum number of datagrams per system call.
+ * @return The batch.
+ * */
+struct batch* createBatch(unsigned int size)
+{
+    struct batch* batch = calloc(1, sizeof(struct batch));
+
+    if (batch == NULL) {
+        error("could not allocate the batch", 3);
+    }
+
+    batch->size = size;
+    batch->rx_msgs = calloc(size, sizeof(struct mmsghdr));
+    batch->rx_iovecs = calloc(size, sizeof(struct iovec));
+    batch->rx_buffers = calloc(size, sizeof(uint8_t*));
+    batch->client_addrs = calloc(size, sizeof(union client_address));
+    batch->rx_control = calloc(size, RX_CONTROL_LEN);
+    batch->rx_arrivals = calloc(size, sizeof(uint64_t));
+    batch->tx_msgs = calloc(size, sizeof(struct mmsghdr));
+    batch->rx_types = calloc(size, sizeof(uint16_t));
+    batch->tx_iovecs = calloc(size * CACHE_MAX_SEGMENTS, sizeof(struct iovec));
+    batch->tx_index = calloc(size, sizeof(int));
+    batch->tx_sent = calloc(size, sizeof(bool));
+
+    if (batch->rx_msgs == NULL || batch->rx_iovecs == NULL ||
+        batch->rx_buffers == NULL || batch->client_addrs == NULL ||
+        batch->rx_control == NULL || batch->rx_arrivals == NULL || batch->rx_types == NULL ||
+        batch->tx_msgs == NULL || batch->tx_iovecs == NULL ||
+        batch->tx_index == NULL ||
+        batch->tx_sent == NULL) {
+        error("could not allocate the batch", 3);
+    }
+
+    // point each receive header at its address, the buffers are filled in for each receive
+    for (unsigned int i = 0; i < size; i++) {
+        batch->rx_iovecs[i].iov_len = REQ_BUFFER_LEN;
+        batch->rx_msgs[i].msg_hdr.msg_iov = &batch->rx_iovecs[i];
+        batch->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->rx_msgs[i].msg_hdr.msg_name = &batch->client_addrs[i];
+        batch->rx_msgs[i].msg_hdr.msg_control = &batch->rx_control[i * RX_CONTROL_LEN];
+
+        batch->tx_msgs[i].msg_hdr.msg_iov = &batch->tx_iovecs[i * CACHE_MAX_SEGMENTS];
+    }
+
+    return batch;
+}
+
+/**
+ * Receives up to a batch of requests with recvmmsg() and sends
+ * all of the responses with sendmmsg().
+ * 
+ * @param worker The worker that owns the socket and the batch.
+ * @param listener The readable socket and the language to respond in.
+ * @param limit The most datagrams to receive.
+ * @return The number of datagrams received, 0 once the socket is empty, SERVE_REQUEUE
+ *         if there were no buffers to receive into, SERVE_BACKOFF if the kernel was
+ *         short of memory or SERVE_FAILED if the receive failed.
+ * */
+int serveBatch(struct worker* worker, struct listener* listener, unsigned int limit)
+{
+    // the readable socket and the preallocated headers and buffers
+    int socket_fd = listener->fd;
+    struct batch* batch = worker->batch;
+
+    // the language is based on the port the request arrived on
+    uint16_t language_code = listener->language_code;
+
+    // the number of buffers taken from the pool, datagrams received and responses built
+    unsigned int buffers;
+    int received, responses = 0;
+
+    // the number of responses handed to the kernel so far
+    int flushed = 0;
+
+    // the shortest response, which decides whether the batch is sent without a copy
+    size_t shortest = SIZE_MAX;
+    bool zerocopy;
+
+    // when the batch was received and when its responses were sent, every
+    // response in the batch is given the same service time
+    uint64_t received_at, sent_at = 0;
+
+    // the index of the port, and if the kernel timestamps the datagrams,
+    // when the responses were sent by the same clock as the timestamps
+    unsigned int port = listener - worker->listeners;
+    bool timestamps = worker->options->timestamps;
+    uint64_t sent_wall = 0;
+
+    // take a buffer for each datagram that may be received
+    buffers = poolAlloc(&worker->pool, batch->rx_buffers, limit < batch->size ? limit : batch->size);
+
+    if (buffers == 0) {
+        return SERVE_REQUEUE;
+    }
+
+    // the address and control lengths are overwritten by each receive
+    for (unsigned int i = 0; i < buffers; i++) {
+        batch->rx_iovecs[i].iov_base = batch->rx_buffers[i];
+        batch->rx_msgs[i].msg_hdr.msg_namelen = sizeof(union client_address);
+        batch->rx_msgs[i].msg_hdr.msg_controllen = timestamps ? RX_CONTROL_LEN : 0;
+    }
+
+    // drain whatever is queued without blocking
+    do {
+        received = recvmmsg(socket_fd, batch->rx_msgs, buffers, MSG_DONTWAIT, NULL);
+    } while (received < 0 && errno == EINTR);
+
+    if (received < 0) {
+        poolFree(&worker->pool, batch->rx_buffers, buffers);
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+
+        // a shortage of kernel memory passes, so the socket is tried again a little later
+        if (errno == ENOMEM || errno == ENOBUFS) {
+            return SERVE_BACKOFF;
+        }
+
+        union client_address unknown = {0};
+
+        // anything else is logged once and the socket waits to be woken again
+        logRequest(worker, listener, &unknown, 0, OUTCOME_NETWORK_ERROR);
+        return SERVE_FAILED;
+    }
+
+    received_at = metricsNow();
+
+    // the whole batch was picked up at once
+    if (timestamps) {
+        uint64_t picked_up = metricsWallClock();
+
+        for (int i = 0; i < received; i++) {
+            batch->rx_arrivals[i] = readArrival(worker, listener, &batch->rx_msgs[i].msg_hdr);
+            metricsQueueing(worker->metrics, port, batch->rx_arrivals[i], picked_up);
+        }
+    }
+
+    // validate each request and build its response
+    for (int i = 0; i < received; i++) {
+
+        uint16_t request_type;
+
+        // point straight at the segments of the precomputed response rather than copying them
+        size_t b = buildResponse(worker, batch->rx_buffers[i], batch->rx_msgs[i].msg_len,
+            &batch->client_addrs[i], language_code, &request_type, &batch->tx_iovecs[responses * CACHE_MAX_SEGMENTS],
+            &batch->tx_msgs[responses].msg_hdr.msg_iovlen);
+
+        batch->rx_types[i] = request_type;
+
+        if (b == 0) {
+            batch->tx_index[i] = request_type == 0 ? -1 : -2;
+            continue;
+        }
+
+        if (b < shortest) {
+            shortest = b;
+        }
+
+        // respond to the address the request came from
+        batch->tx_msgs[responses].msg_hdr.msg_name = &batch->client_addrs[i];
+        batch->tx_msgs[responses].msg_hdr.msg_namelen = batch->rx_msgs[i].msg_hdr.msg_namelen;
+        batch->tx_sent[responses] = true;
+
+        batch->tx_index[i] = responses++;
+    }
+
+    // the flags apply to every message, so either the whole batch is copied or none of it
+    zerocopy = responses > 0 && zerocopyAvailable(worker, listener, shortest, responses);
+
+    // flush the responses, skipping over any that the kernel refuses
+    while (flushed < responses) {
+
+        int sent = sendmmsg(socket_fd, &batch->tx_msgs[flushed], responses - flushed,
+            zerocopy ? MSG_ZEROCOPY : 0);
+
+        if (sent < 0) {
+            batch->tx_sent[flushed++] = false;
+        } else {
+            flushed += sent;
+
+            if (zerocopy) {
+                zerocopyRecord(worker, listener, sent);
+            }
+        }
+    }
+
+    if (responses > 0) {
+        sent_at = metricsNow();
+    }
+
+    if (responses > 0 && timestamps) {
+        sent_wall = metricsWallClock();
+    }
+
+    // log the outcome of every request in the batch
+    for (int i = 0; i < received; i++) {
+
+        int t = batch->tx_index[i];
+
+        if (t == -1) {
+            logRequest(worker, listener, &batch->client_addrs[i], 0, OUTCOME_INVALID);
+        } else if (t == -2) {
+            logRequest(worker, listener, &batch->client_addrs[i], batch->rx_types[i], OUTCOME_LIMITED);
+        } else {
+            uint16_t request_type = batch->rx_types[i];
+
+            if (batch->tx_sent[t]) {
+                metricsService(worker->metrics, request_type, sent_at - received_at);
+
+                if (timestamps) {
+                    metricsSojourn(worker->metrics, port, batch->rx_arrivals[i], sent_wall);
+                }
+            }
+
+            logRequest(worker, listener, &batch->client_addrs[i], request_type,
+                batch->tx_sent[t] ? OUTCOME_SENT : OUTCOME_SEND_FAILED);
+        }
+    }
+
+    poolFree(&worker->pool, batch->rx_buffers, buffers);
+
+    return received;
+}
+
+/**
+ * Reads the control messages of a received datagram, the time the kernel
+ * received it and the number of datagrams the socket has dropped so far
+ * because its receive queue was full.
+ * 
+ * @param worker The worker that received the datagram.
+ * @param listener The socket it arrived on.
+ * @param msg The header it was received with.
+ * @return When the datagram arrived in nanoseconds of the realtime clock,
+ *         or 0 if the kernel did not timestamp it.
+ * */
+uint64_t readArrival(struct worker* worker, struct listener* listener, struct msghdr* msg)
+{
+    uint64_t arrived = 0;
+    struct cmsghdr* cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+
+        if (cmsg->cmsg_level != SOL_SOCKET) {
+            continue;
+        }
+
+        if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec stamp;
+
+            memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+            arrived = (uint64_t) stamp.tv_sec * 1000000000 + stamp.tv_nsec;
+        } else if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t drops;
+
+            // the count belongs to this worker's socket, so the latest value is the total
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            worker->metrics->ports[listener - worker->listeners].overflows = drops;
+        }
+    }
+
+    return arrived;
+}
+
+/**
+ * Validates a request, checks the client is within its rate limit and
+ * points a gather list at the segments of the precomputed response to it,
+ * its header alone if it asked for a compact response, or for a batch
+ * request at the response to each of its queries. A batch
+ * costs the client a single token, as it is a single datagram.
+ * This is shared by every way of receiving and sending.
+ * 
+ * @param worker The worker whose cache holds the responses.
+ * @param buffer The received datagram.
+ * @param length The length of the datagram.
+ * @param client_addr The address the request came from.
+ * @param language_code The language of the port the request arrived on.
+ * @param request_type Where the type of request is to be stored, 0 if it
+ *                     was invalid or REQ_BATCH for a batch request.
+ * @param segments Where the segments of the response are to be stored.
+ * @param segment_count Where the number of segments is to be stored.
+ * @return The length of the response, or 0 if the request was invalid or
+ *         the client is over its limit.
+ * */
+size_t buildResponse(struct worker* worker, uint8_t* buffer, size_t length, union client_address* client_addr, uint16_t language_code, uint16_t* request_type, struct iovec segments[CACHE_MAX_SEGMENTS], size_t* segment_count)
+{
+    *request_type = 0;
+
+    if (dtReqValid(buffer, length)) {
+        *request_type = dtReqType(buffer, length);
+    } else if (dtBatchReqValid(buffer, length)) {
+        *request_type = REQ_BATCH;
+    } else {
+        return 0;
+    }
+
+    // invalid requests are never answered, so only valid ones spend tokens, and a
+    // client on a Unix socket cannot spoof its address so it is never limited
+    if (worker->options->limit && client_addr->any.sa_family == AF_INET) {
+
+        struct timespec now;
+
+        // the coarse clock is read from the vDSO without a system call
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+        if (!limiterAllow(&worker->limiter, client_addr->in.sin_addr,
+            (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec)) {
+            return 0;
+        }
+    }
+
+    if (*request_type == REQ_BATCH) {
+        return cacheLookupBatch(worker->cache, buffer, length, segments, segment_count);
+    }
+
+    // clients that only read the fields are sent the header alone
+    if (dtReqCompact(buffer, length)) {
+        *segment_count = 1;
+        return cacheLookupCompact(worker->cache, language_code, segments);
+    }
+
+    *segment_count = CACHE_SEGMENTS;
+
+    return cacheLookup(worker->cache, *request_type, language_code, segments);
+}
+
+/**
+ * Decides whether responses should be sent with MSG_ZEROCOPY. Pinning the
+ * pages and reading the completions back costs more than copying a small
+ * datagram, so only responses of at least the threshold length qualify,
+ * and only while there is room to track them.
+ * 
+ * @param worker The worker sending the responses.
+ * @param listener The socket they are sent on.
+ * @param length The length of the shortest response.
+ * @param count The number of responses.
+ * @return True if the responses should be sent without a copy.
+ * */
+bool zerocopyAvailable(struct worker* worker, struct listener* listener, size_t length, unsigned int count)
+{
+    if (listener->zerocopy_generations == NULL || length < worker->options->zerocopy_threshold) {
+        return false;
+    }
+
+    // every slot the sends would take must have completed
+    for (unsigned int k = 0; k < count; k++) {
+        if (listener->zerocopy_generations[(listener->zerocopy_next + k) % ZEROCOPY_INFLIGHT] != ZEROCOPY_FREE) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Records zero copy sends that the kernel accepted. Each one takes the
+ * next sequence number of the socket and pins the cache generation its
+ * segments are in until the kernel says it is done with them.
+ * 
+ * @param worker The worker that sent the responses.
+ * @param listener The socket they were sent on.
+ * @param count The number of sends.
+ * */
+void zerocopyRecord(struct worker* worker, struct listener* listener, unsigned int count)
+{
+    for (unsigned int k = 0; k < count; k++) {
+        listener->zerocopy_generations[listener->zerocopy_next++ % ZEROCOPY_INFLIGHT] = cachePin(worker->cache);
+    }
+
+    listener->zerocopy_sends += count;
+}
+
+/**
+ * Reads the completions of zero copy sends from the error queue of a
+ * socket and unpins the cache generations they were reading. Each
+ * completion covers a range of sequence numbers.
+ * 
+ * @param worker The worker that owns the socket.
+ * @param listener The socket.
+ * */
+void zerocopyDrain(struct worker* worker, struct listener* listener)
+{
+    // room for a single extended error
+    uint8_t control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+
+    if (listener->zerocopy_generations == NULL) {
+        return;
+    }
+
+    while (true) {
+
+        struct msghdr msg = {0};
+        struct cmsghdr* cmsg;
+
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(listener->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            return;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+
+            struct sock_extended_err* err = (struct sock_extended_err*) CMSG_DATA(cmsg);
+
+            if (cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR ||
+                err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            // the range is inclusive and the sequence numbers wrap
+            for (uint32_t seq = err->ee_info; seq != err->ee_data + 1; seq++) {
+
+                uint8_t* slot = &listener->zerocopy_generations[seq % ZEROCOPY_INFLIGHT];
+
+                if (*slot != ZEROCOPY_FREE) {
+                    cacheUnpin(worker->cache, *slot);
+                    *slot = ZEROCOPY_FREE;
+                }
+
+                listener->zerocopy_completed++;
+
+                // the device could not send from the pages, so the kernel copied them after all
+                if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    listener->zerocopy_copied++;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Serves every socket of a worker from an io_uring instance. Each socket
+ * has a multishot recvmsg() that picks a buffer from the provided buffer
+ * ring for every datagram, so receiving costs no system calls at all, and
+ * the responses to each round of completions are submitted as sendmsg()
+ * entries along with the wait for the next round.
+ * 
+ * The quotas do not apply, as the kernel completes the receives in the
+ * order the datagrams arrive rather than a socket at a time.
+ * 
+ * @param worker The worker.
+ * @return True once the server is shutting down, false straight away if
+ *         the kernel does not support the io_uring features that are needed.
+ * */
+bool serveUring(struct worker* worker)
+{
+    struct uring ring;
+
+    // the receive header only says how much room to leave for the client address
+    struct msghdr receive_msg = {0};
+
+    // the receive buffers handed to the kernel, taken from the worker's pool
+    uint8_t** buffers;
+    unsigned int buffer_count;
+
+    // the sends, indexed by the buffer their request arrived in
+    struct uring_send* sends;
+
+    // the sockets whose multishot receive has stopped and must be rearmed
+    bool* rearm;
+
+    // the buffers waiting on a send, the kernel has the rest
+    unsigned int buffers_out = 0;
+
+    // until a datagram arrives a failed receive means multishot is not supported
+    bool receiving = false;
+
+    // true once the server is stopping, the receives are cancelled and the
+    // worker only waits for the requests it already has to be answered
+    bool draining = false;
+
+    // true if responses may be sent without a copy, which needs a newer kernel
+    bool zerocopy;
+
+    if (!uringInit(&ring, URING_ENTRIES)) {
+        return false;
+    }
+
+    buffers = calloc(URING_BUFFERS, sizeof(uint8_t*));
+
+    if (buffers == NULL) {
+        error("could not allocate the io_uring buffers", 3);
+    }
+
+    // the buffer ring must be a power of two, so give back whatever is over
+    buffer_count = poolAlloc(&worker->pool, buffers, URING_BUFFERS);
+
+    while (buffer_count & (buffer_count - 1)) {
+        poolFree(&worker->pool, &buffers[--buffer_count], 1);
+    }
+
+    // each buffer holds the recvmsg() header, the client address and the request
+    if (buffer_count == 0 ||
+        !uringInitBuffers(&ring, buffers, buffer_count, worker->pool.buffer_len, URING_BUFFER_GROUP)) {
+        int saved_errno = buffer_count == 0 ? ENOBUFS : errno;
+        poolFree(&worker->pool, buffers, buffer_count);
+        free(buffers);
+        uringClose(&ring);
+        errno = saved_errno;
+        return false;
+    }
+
+    zerocopy = worker->options->zerocopy && uringSupports(&ring, IORING_OP_SENDMSG_ZC);
+
+    sends = calloc(buffer_count, sizeof(struct uring_send));
+    rearm = calloc(worker->listener_count, sizeof(bool));
+
+    if (sends == NULL || rearm == NULL) {
+        error("could not allocate the io_uring sends", 3);
+    }
+
+    receive_msg.msg_namelen = sizeof(union client_address);
+    receive_msg.msg_controllen = worker->options->timestamps ? RX_CONTROL_LEN : 0;
+
+    for (unsigned int id = 0; id < buffer_count; id++) {
+        sends[id].msg.msg_iov = sends[id].segments;
+        sends[id].msg.msg_name = uringBuffer(&ring, id) + sizeof(struct io_uring_recvmsg_out);
+    }
+
+    for (unsigned int i = 0; i < worker->listener_count; i++) {
+        uringArmReceive(&ring, worker->listeners[i].fd, &receive_msg, i);
+    }
+
+    uringArmPoll(&ring, worker->cache->timer_fd, URING_CACHE_TIMER);
+    uringArmPoll(&ring, shutdown_fd, URING_SHUTDOWN);
+
+    while (true) {
+
+        unsigned int head;
+        struct io_uring_cqe* cqe;
+
+        // when this round of completions was reaped, which times every request in it,
+        // and the same by the clock the kernel timestamps datagrams with
+        uint64_t now, wall = 0;
+
+        // submit this round's sends and wait for at least one completion
+        uringWait(worker, &ring);
+
+        now = metricsNow();
+
+        if (worker->options->timestamps) {
+            wall = metricsWallClock();
+        }
+
+        head = uringCqHead(&ring);
+
+        while ((cqe = uringNextCqe(&ring, &head)) != NULL) {
+
+            uint64_t kind = cqe->user_data >> 32;
+            uint32_t index = cqe->user_data & 0xFFFFFFFF;
+
+            // anything left on the sockets is read by whoever serves them next
+            if (kind == URING_SHUTDOWN) {
+                draining = true;
+
+                for (unsigned int i = 0; i < worker->listener_count; i++) {
+                    uringCancelReceive(&ring, i);
+                }
+
+                continue;
+            }
+
+            if (kind == URING_CANCEL) {
+                continue;
+            }
+
+            // rebuild the responses when the minute rolls over
+            if (kind == URING_CACHE_TIMER) {
+                cacheHandleTimer(worker->cache);
+                uringArmPoll(&ring, worker->cache->timer_fd, URING_CACHE_TIMER);
+                continue;
+            }
+
+            if (kind == URING_SEND) {
+
+                struct uring_send* send = &sends[index];
+                struct listener* listener = &worker->listeners[send->listener];
+
+                // the kernel has finished with the pages of a zero copy send, which is
+                // the only point its buffer and cache generation can be given back
+                if (cqe->flags & IORING_CQE_F_NOTIF) {
+
+                    if (!send->notifying) {
+                        continue;
+                    }
+
+                    send->notifying = false;
+                    listener->zerocopy_completed++;
+
+                    if (cqe->res & IORING_NOTIF_USAGE_ZC_COPIED) {
+                        listener->zerocopy_copied++;
+                    }
+
+                    cacheUnpin(worker->cache, send->generation);
+                    uringRecycleBuffer(&ring, index);
+                    buffers_out--;
+                    continue;
+                }
+
+                if (cqe->res >= 0) {
+                    metricsService(worker->metrics, send->request_type, now - send->received_at);
+
+                    if (worker->options->timestamps) {
+                        metricsSojourn(worker->metrics, send->listener, send->arrived, wall);
+                    }
+                }
+
+                logRequest(worker, listener, send->msg.msg_name, send->request_type,
+                    cqe->res < 0 ? OUTCOME_SEND_FAILED : OUTCOME_SENT);
+
+                // a zero copy send keeps its segments until the notification follows,
+                // even if the send itself failed
+                if (cqe->flags & IORING_CQE_F_MORE) {
+                    send->notifying = true;
+                } else {
+                    cacheUnpin(worker->cache, send->generation);
+                    uringRecycleBuffer(&ring, index);
+                    buffers_out--;
+                }
+
+                continue;
+            }
+
+            // otherwise a datagram has arrived, or the receive has stopped
+            struct listener* listener = &worker->listeners[index];
+
+            if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                rearm[index] = true;
+            }
+
+            if (cqe->res < 0) {
+
+                union client_address unknown = {0};
+
+                // the kernel is too old for multishot receives
+                if (cqe->res == -EINVAL && !receiving) {
+                    uringAdvance(&ring, head);
+                    uringClose(&ring);
+                    poolFree(&worker->pool, buffers, buffer_count);
+                    free(buffers);
+                    free(sends);
+                    free(rearm);
+                    errno = EINVAL;
+                    return false;
+                }
+
+                // running out of buffers only stops the receive until some are recycled
+                if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+                    logRequest(worker, listener, &unknown, 0, OUTCOME_NETWORK_ERROR);
+                }
+
+                continue;
+            }
+
+            receiving = true;
+
+            uint16_t id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            uint8_t* buffer = uringBuffer(&ring, id);
+            struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*) buffer;
+            struct uring_send* send = &sends[id];
+
+            size_t b;
+
+            listener->received++;
+
+            // the control messages follow the room left for the address
+            if (worker->options->timestamps) {
+                struct msghdr control = {0};
+
+                control.msg_control = buffer + sizeof(struct io_uring_recvmsg_out) + sizeof(union client_address);
+                control.msg_controllen = out->controllen;
+
+                send->arrived = readArrival(worker, listener, &control);
+                metricsQueueing(worker->metrics, index, send->arrived, wall);
+            }
+
+            // the request follows the header and the room left for the address and control messages
+            b = buildResponse(worker, buffer + sizeof(struct io_uring_recvmsg_out) + sizeof(union client_address) +
+                receive_msg.msg_controllen, out->payloadlen, send->msg.msg_name, listener->language_code,
+                &send->request_type, send->segments, &send->msg.msg_iovlen);
+
+            if (b == 0) {
+                logRequest(worker, listener, send->msg.msg_name, send->request_type,
+                    send->request_type == 0 ? OUTCOME_INVALID : OUTCOME_LIMITED);
+                uringRecycleBuffer(&ring, id);
+                continue;
+            }
+
+            // the send points into the cache, which must not be rebuilt under it
+            send->generation = cachePin(worker->cache);
+            send->listener = index;
+            send->zerocopy = zerocopy && b >= worker->options->zerocopy_threshold && listener->path == NULL;
+
+            // the path of a Unix client is only as long as the kernel says it is
+            send->msg.msg_namelen = out->namelen < sizeof(union client_address) ? out->namelen : sizeof(union client_address);
+            send->received_at = now;
+
+            if (send->zerocopy) {
+                listener->zerocopy_sends++;
+            }
+
+            uringQueueSend(&ring, listener->fd, send, id);
+            buffers_out++;
+        }
+
+        uringAdvance(&ring, head);
+
+        // leave once every receive has stopped and every response has been sent
+        if (draining) {
+
+            bool stopped = buffers_out == 0;
+
+            for (unsigned int i = 0; i < worker->listener_count; i++) {
+                stopped = stopped && rearm[i];
+            }
+
+            if (stopped) {
+                uringClose(&ring);
+                poolFree(&worker->pool, buffers, buffer_count);
+                free(buffers);
+                free(sends);
+                free(rearm);
+                return true;
+            }
+
+            continue;
+        }
+
+        // restart the receives that stopped, once there are buffers for them
+        for (unsigned int i = 0; i < worker->listener_count && buffers_out < buffer_count; i++) {
+            if (rearm[i]) {
+                rearm[i] = false;
+                uringArmReceive(&ring, worker->listeners[i].fd, &receive_msg, i);
+            }
+        }
+    }
+}
+
+/**
+ * Submits the queued entries and waits for at least one completion. With
+ * busy polling the completion queue is watched in memory, without entering
+ * the kernel, until something completes or the budget runs out.
+ * 
+ * @param worker The worker that owns the ring.
+ * @param ring The ring.
+ * */
+void uringWait(struct worker* worker, struct uring* ring)
+{
+    uint64_t budget = (uint64_t) worker->options->busy_poll * 1000;
+    uint64_t start, now;
+
+    if (budget == 0) {
+        if (uringSubmit(ring, 1) < 0 && errno != EINTR) {
+            error("io_uring_enter failed", 4);
+        }
+        return;
+    }
+
+    if (uringSubmit(ring, 0) < 0 && errno != EINTR) {
+        error("io_uring_enter failed", 4);
+    }
+
+    start = metricsNow();
+    now = start;
+
+    do {
+        if (uringPeek(ring) > 0) {
+            worker->spin_wakeups++;
+            worker->spin_ns += metricsNow() - start;
+            return;
+        }
+
+        now = metricsNow();
+
+    } while (now - start < budget);
+
+    worker->spin_ns += now - start;
+
+    if (uringSubmit(ring, 1) < 0 && errno != EINTR) {
+        error("io_uring_enter failed", 4);
+    }
+
+    worker->sleep_wakeups++;
+    worker->sleep_ns += metricsNow() - now;
+}
+
+/**
+ * Returns the next free submission queue entry, submitting the queue
+ * first if it is full.
+ * 
+ * @param ring The ring.
+ * @return The entry.
+ * */
+struct io_uring_sqe* uringNextSqe(struct uring* ring)
+{
+    struct io_uring_sqe* sqe = uringGetSqe(ring);
+
+    if (sqe == NULL) {
+
+        if (uringSubmit(ring, 0) < 0 && errno != EINTR) {
+            error("io_uring_enter failed", 4);
+        }
+
+        sqe = uringGetSqe(ring);
+
+        if (sqe == NULL) {
+            error("the io_uring submission queue is full", 4);
+        }
+    }
+
+    return sqe;
+}
+
+/**
+ * Queues a multishot recvmsg() on a socket that selects its buffers
+ * from the provided buffer ring.
+ * 
+ * @param ring The ring.
+ * @param fd The socket.
+ * @param msg The header saying how much room to leave for the client address.
+ * @param index The index of the listener.
+ * */
+void uringArmReceive(struct uring* ring, int fd, struct msghdr* msg, unsigned int index)
+{
+    struct io_uring_sqe* sqe = uringNextSqe(ring);
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = URING_RECEIVE << 32 | index;
+}
+
+/**
+ * Queues the cancellation of the multishot receive of a socket, which then
+ * completes for the last time with -ECANCELED.
+ * 
+ * @param ring The ring.
+ * @param index The index of the socket's listener.
+ * */
+void uringCancelReceive(struct uring* ring, unsigned int index)
+{
+    struct io_uring_sqe* sqe = uringNextSqe(ring);
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = URING_RECEIVE << 32 | index;
+    sqe->user_data = URING_CANCEL << 32;
+}
+
+/**
+ * Queues a one shot poll for a descriptor becoming readable.
+ * 
+ * @param ring The ring.
+ * @param fd The descriptor.
+ * @param kind The kind of completion, URING_CACHE_TIMER or URING_SHUTDOWN.
+ * */
+void uringArmPoll(struct uring* ring, int fd, uint64_t kind)
+{
+    struct io_uring_sqe* sqe = uringNextSqe(ring);
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = kind << 32;
+}
+
+/**
+ * Queues a response. The responses go to different clients and need no
+ * order, so each send stands alone and one that fails leaves the rest of
+ * the round to be sent. A zero copy
+ * send completes twice, once when it is sent and again when the kernel
+ * is done with the segments.
+ * 
+ * @param ring The ring.
+ * @param fd The socket the request arrived on.
+ * @param send The response and the address to send it to.
+ * @param id The buffer the request arrived in.
+ * */
+void uringQueueSend(struct uring* ring, int fd, struct uring_send* send, uint16_t id)
+{
+    struct io_uring_sqe* sqe = uringNextSqe(ring);
+
+    sqe->opcode = send->zerocopy ? IORING_OP_SENDMSG_ZC : IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) &send->msg;
+    sqe->len = 1;
+    sqe->user_data = URING_SEND << 32 | id;
+
+    // ask the notification to say whether the kernel had to copy after all
+    if (send->zerocopy) {
+        sqe->ioprio = IORING_SEND_ZC_REPORT_USAGE;
+    }
+}
+
+/**
+ * Counts a request and records it and what happened to it in the worker's
+ * log ring. The line is formatted and written later by the logger thread,
+ * and if the ring is full the record is dropped rather than waiting.
+ * 
+ * @param worker The worker that handled the request.
+ * @param listener The port the request arrived on.
+ * @param client_addr The address the request came from.
+ * @param request_type The type of request, or 0 if it could not be read.
+ * @param outcome What happened to the request, one of the OUTCOME_ definitions.
+ * */
+void logRequest(struct worker* worker, struct listener* listener, union client_address* client_addr, uint16_t request_type, uint8_t outcome)
+{
+    struct log_record record;
+
+    metricsCount(worker->metrics, listener - worker->listeners, request_type, outcome);
+
+    // the coarse clock is read from the vDSO without a system call
+    clock_gettime(CLOCK_REALTIME_COARSE, &record.time);
+
+    record.local = client_addr->any.sa_family == AF_UNIX;
+    record.client_addr = record.local ? (struct in_addr) { 0 } : client_addr->in.sin_addr;
+    record.language_code = listener->language_code;
+    record.request_type = request_type;
+    record.worker = worker->id;
+    record.outcome = outcome;
+
+    logPush(worker->log, &record);
+}
+
+/**
+ * Reads the ports from argv and puts them into the listeners array.
+ * The first, second and third port arguments are for English, Maori and
+ * German respectively and each is a comma separated list of ports and
+ * port ranges.
+ * 
+ * @param argv The arguments passed into main, starting just before the ports.
+ * @param listeners A pointer where the allocated array of listeners is to be stored.
+ * @param count A pointer where the number of listeners is to be stored.
+ * @return True if all ports were valid and unique.
+ * */
+bool readPorts(char** argv, struct listener** listeners, unsigned int* count)
+{
+    // marks the ports that have already been seen
+    static bool seen[MAX_PORT_NO + 1];
+
+    *count = 0;
+    *listeners = calloc(MAX_PORT_NO - MIN_PORT_NO + 1 + MAX_UNIX_LISTENERS, sizeof(struct listener));
+
+    if (*listeners == NULL) {
+        error("could not allocate the listeners", 3);
+    }
+
+    for (int i = 0; i < 3; i++) {
+
+        char* list = argv[i + 1];
+        char* end;
+
+        do {
+            // read either a single port or the start of a range
+            long first = strtol(list, &end, 10);
+            long last = first;
+
+            if (end == list) {
+                return false;
+            }
+
+            if (*end == '-') {
+                list = end + 1;
+                last = strtol(list, &end, 10);
+
+                if (end == list) {
+                    return false;
+                }
+            }
+
+            if (first < MIN_PORT_NO || last > MAX_PORT_NO || first > last) {
+                return false;
+            }
+
+            for (long port = first; port <= last; port++) {
+
+                if (seen[port]) {
+                    return false;
+                }
+
+                seen[port] = true;
+
+                (*listeners)[*count].fd = -1;
+                (*listeners)[*count].port = port;
+                (*listeners)[*count].language_code = i + 1;
+                (*listeners)[*count].quota = DEFAULT_QUOTA;
+                (*count)++;
+            }
+
+            list = end + 1;
+
+        } while (*end == ',');
+
+        // anything else after the last port is an error
+        if (*end != '\0') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Sets the quota of every listener, using the per-port quotas given on
+ * the command line and the default quota for every other port.
+ * 
+ * @param options The options holding the quotas.
+ * @param listeners The listeners to update.
+ * @param count The number of listeners.
+ * @return False if a quota was given for a port that is not being served.
+ * */
+bool applyQuotas(struct server_options* options, struct listener* listeners, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        listeners[i].quota = options->quota;
+    }
+
+    for (unsigned int q = 0; q < options->port_quota_count; q++) {
+
+        bool found = false;
+
+        for (unsigned int i = 0; i < count; i++) {
+            if (listeners[i].port == options->port_quotas[q].port) {
+                listeners[i].quota = options->port_quotas[q].quota;
+                found = true;
+            }
+        }
+
+        if (!found) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Reads a quota option, either <n> for the default quota or <port>=<n>
+ * for a single port.
+ * 
+ * @param arg The option argument.
+ * @param options The options to populate.
+ * @return True if the quota was valid.
+ * */
+bool readQuota(char* arg, struct server_options* options)
+{
+    char* end;
+    long value = strtol(arg, &end, 10);
+
+    // a default quota
+    if (*end == '\0') {
+        options->quota = value;
+        return value > 0;
+    }
+
+    if (*end != '=' || options->port_quota_count == MAX_PORT_QUOTAS) {
+        return false;
+    }
+
+    struct port_quota* port_quota = &options->port_quotas[options->port_quota_count++];
+
+    port_quota->port = value;
+    value = strtol(end + 1, &end, 10);
+    port_quota->quota = value;
+
+    return *end == '\0' && value > 0;
+}
+
+/**
+ * Reads a rate limit option, <rate> or <rate>:<burst> where rate is the
+ * requests per second each client may make and burst is the most it may
+ * make at once. The burst is the same as the rate if it is not given.
+ * 
+ * @param arg The option argument.
+ * @param options The options to populate.
+ * @return True if the limit was valid.
+ * */
+bool readLimit(char* arg, struct server_options* options)
+{
+    char* end;
+
+    options->limit = true;
+    options->limit_rate = strtod(arg, &end);
+    options->limit_burst = options->limit_rate;
+
+    if (*end == ':') {
+        options->limit_burst = strtod(end + 1, &end);
+    }
+
+    return *end == '\0' && options->limit_rate > 0 && options->limit_burst >= 1;
+}
+
+/**
+ * Reads the group to announce to, a multicast address and a port
+ * separated by a colon, e.g. 239.255.0.1:5100.
+ * 
+ * @param arg The option argument.
+ * @param options The options to populate.
+ * @return True if the group was valid.
+ * */
+bool readAnnounce(char* arg, struct server_options* options)
+{
+    char address[INET_ADDRSTRLEN] = {0};
+    char* port = strchr(arg, ':');
+    long port_no;
+
+    if (port == NULL || port - arg >= INET_ADDRSTRLEN) {
+        return false;
+    }
+
+    memcpy(address, arg, port - arg);
+    port_no = strtol(port + 1, &port, 10);
+
+    memset(&options->announce_group, 0, sizeof(options->announce_group));
+    options->announce_group.sin_family = AF_INET;
+    options->announce_group.sin_port = htons(port_no);
+    options->announce = true;
+
+    return *port == '\0' && port_no >= MIN_PORT_NO && port_no <= MAX_PORT_NO &&
+        inet_pton(AF_INET, address, &options->announce_group.sin_addr) == 1 &&
+        IN_MULTICAST(ntohl(options->announce_group.sin_addr.s_addr));
+}
+
+/**
+ * Checks the name of the time page, which like any shared memory object
+ * is a slash followed by a name that contains no other slash, e.g. /dt-time.
+ * 
+ * @param arg The option argument.
+ * @return True if the name was valid.
+ * */
+bool readTimePageName(char* arg)
+{
+    size_t length = strlen(arg);
+
+    return length > 1 && length < NAME_MAX && arg[0] == '/' && strchr(arg + 1, '/') == NULL;
+}
+
+/**
+ * Reads a Unix socket to listen on, a path optionally preceded by the
+ * language it responds in, e.g. mao=/run/dt/mao.sock. A socket without a
+ * language responds in English, and like any port it answers batch
+ * requests in every language, so one socket can serve them all.
+ * 
+ * @param arg The option argument.
+ * @param options The options to populate.
+ * @return True if the socket was valid and there was room for it.
+ * */
+bool readUnixListener(char* arg, struct server_options* options)
+{
+    static const char* languages[] = { "eng=", "mao=", "ger=" };
+
+    struct unix_listener* listener = &options->unix_listeners[options->unix_listener_count];
+
+    if (options->unix_listener_count == MAX_UNIX_LISTENERS) {
+        return false;
+    }
+
+    listener->path = arg;
+    listener->language_code = LANG_ENG;
+
+    for (uint16_t lang = LANG_ENG; lang <= LANG_GER; lang++) {
+        if (strncmp(arg, languages[lang - 1], 4) == 0) {
+            listener->path = arg + 4;
+            listener->language_code = lang;
+        }
+    }
+
+    // the path must fit in a socket address with its terminator
+    if (listener->path[0] == '\0' || strlen(listener->path) >= sizeof(((struct sockaddr_un*) 0)->sun_path)) {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < options->unix_listener_count; i++) {
+        if (strcmp(options->unix_listeners[i].path, listener->path) == 0) {
+            return false;
+        }
+    }
+
+    options->unix_listener_count++;
+
+    return true;
+}
+
+/**
+ * Adds the Unix sockets to the end of the listeners read from the ports,
+ * which readPorts() leaves room for.
+ * 
+ * @param options The options holding the Unix sockets.
+ * @param listeners The listeners to add to.
+ * @param count The number of listeners, which is updated.
+ * */
+void addUnixListeners(struct server_options* options, struct listener* listeners, unsigned int* count)
+{
+    for (unsigned int i = 0; i < options->unix_listener_count; i++) {
+        listeners[*count].fd = -1;
+        listeners[*count].port = 0;
+        listeners[*count].path = options->unix_listeners[i].path;
+        listeners[*count].language_code = options->unix_listeners[i].language_code;
+        (*count)++;
+    }
+}
+
+/**
+ * Writes the name of a listener, its port or unix: followed by the path of
+ * its socket, which is the same form the client takes.
+ * 
+ * @param listener The listener.
+ * @param name Where the name is to be written.
+ * @param n The size of name.
+ * */
+void listenerName(struct listener* listener, char* name, size_t n)
+{
+    if (listener->path != NULL) {
+        snprintf(name, n, "unix:%s", listener->path);
+    } else {
+        snprintf(name, n, "%u", listener->port);
+    }
+}
+
+/**
+ * Reads a list of CPUs, a comma separated list of CPUs and CPU ranges
+ * such as 0,2-3.
+ * 
+ * @param arg The option argument.
+ * @param cpus Where the CPUs are to be stored, at most MAX_WORKERS of them.
+ * @param count Where the number of CPUs is to be stored.
+ * @return True if the list was valid.
+ * */
+bool readCpus(char* arg, unsigned int cpus[], unsigned int* count)
+{
+    char* list = arg;
+    char* end;
+
+    *count = 0;
+
+    do {
+        long first = strtol(list, &end, 10);
+        long last = first;
+
+        if (end == list) {
+            return false;
+        }
+
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+
+            if (end == list) {
+                return false;
+            }
+        }
+
+        if (first < 0 || last >= CPU_SETSIZE || first > last) {
+            return false;
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) {
+
+            if (*count == MAX_WORKERS) {
+                return false;
+            }
+
+            cpus[(*count)++] = cpu;
+        }
+
+        list = end + 1;
+
+    } while (*end == ',');
+
+    return *end == '\0';
+}
+
+/**
+ * Fills a CPU set with a list of CPUs.
+ * 
+ * @param set The set to fill.
+ * @param cpus The CPUs.
+ * @param count The number of CPUs.
+ * */
+void fillCpuSet(cpu_set_t* set, unsigned int cpus[], unsigned int count)
+{
+    CPU_ZERO(set);
+
+    for (unsigned int i = 0; i < count; i++) {
+        CPU_SET(cpus[i], set);
+    }
+}
+
+/**
+ * Reads the options from argv. Options must come before the ports.
+ * 
+ * @param argc The number of arguments passed into main.
+ * @param argv The arguments passed into main.
+ * @param options The options to populate.
+ * */
+void readOptions(int argc, char** argv, struct server_options* options)
+{
+    static struct option long_options[] = {
+        { "batch", required_argument, NULL, 'b' },
+        { "single", no_argument, NULL, 's' },
+        { "uring", no_argument, NULL, 'u' },
+        { "zerocopy", required_argument, NULL, 'z' },
+        { "pool", required_argument, NULL, 'p' },
+        { "limit", required_argument, NULL, 'l' },
+        { "limit-table", required_argument, NULL, 't' },
+        { "workers", required_argument, NULL, 'w' },
+        { "quota", required_argument, NULL, 'q' },
+        { "admin", required_argument, NULL, 'a' },
+        { "timestamps", no_argument, NULL, 'k' },
+        { "busy-poll", required_argument, NULL, 'B' },
+        { "cpus", required_argument, NULL, 'c' },
+        { "incoming-cpu", no_argument, NULL, 'i' },
+        { "background-cpus", required_argument, NULL, 'C' },
+        { "takeover", required_argument, NULL, 'T' },
+        { "announce", required_argument, NULL, 'A' },
+        { "announce-interface", required_argument, NULL, 'I' },
+        { "announce-ttl", required_argument, NULL, 'L' },
+        { "time-page", required_argument, NULL, 'P' },
+        { "unix", required_argument, NULL, 'U' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    int zerocopy_threshold;
+
+    // stop at the first port so that the ports are never mistaken for options
+    while ((opt = getopt_long(argc, argv, "+b:suw:q:z:p:l:t:a:kB:c:iC:A:I:L:P:U:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'b':
+                options->batch_size = atoi(optarg);
+                if (options->batch_size < 1 || options->batch_size > MAX_BATCH_SIZE) {
+                    invalidOption("--batch must be between 1 and %u", MAX_BATCH_SIZE);
+                }
+                break;
+            case 's':
+                options->single = true;
+                break;
+            case 'u':
+                options->uring = true;
+                break;
+            case 'z':
+                options->zerocopy = true;
+                zerocopy_threshold = atoi(optarg);
+                if (zerocopy_threshold < 0 || zerocopy_threshold > BATCH_RES_MAX_LEN) {
+                    invalidOption("--zerocopy must be between 0 and %d bytes", BATCH_RES_MAX_LEN);
+                }
+                options->zerocopy_threshold = zerocopy_threshold;
+                break;
+            case 'p':
+                options->pool_buffers = atoi(optarg);
+                if (options->pool_buffers < 1 || options->pool_buffers > MAX_POOL_BUFFERS) {
+                    invalidOption("--pool must be between 1 and %u", MAX_POOL_BUFFERS);
+                }
+                break;
+            case 'l':
+                if (!readLimit(optarg, options)) {
+                    invalidOption("--limit must be a positive rate, optionally followed by :<burst> of at least 1");
+                }
+                break;
+            case 't':
+                options->limit_slots = atoi(optarg);
+                if (options->limit_slots < 4 || options->limit_slots > MAX_LIMITER_SLOTS ||
+                    (options->limit_slots & (options->limit_slots - 1)) != 0) {
+                    invalidOption("--limit-table must be a power of two between 4 and %u", MAX_LIMITER_SLOTS);
+                }
+                break;
+            case 'w':
+                options->workers = atoi(optarg);
+                if (options->workers < 1 || options->workers > MAX_WORKERS) {
+                    invalidOption("--workers must be between 1 and %u", MAX_WORKERS);
+                }
+                break;
+            case 'B':
+                options->busy_poll = atoi(optarg);
+                if (options->busy_poll < 1 || options->busy_poll > MAX_BUSY_POLL) {
+                    invalidOption("--busy-poll must be between 1 and %u us", MAX_BUSY_POLL);
+                }
+                break;
+            case 'c':
+                if (!readCpus(optarg, options->cpus, &options->cpu_count)) {
+                    invalidOption("--cpus must be a list of CPUs and CPU ranges at most %u long", MAX_WORKERS);
+                }
+                break;
+            case 'i':
+                options->incoming_cpu = true;
+                break;
+            case 'C':
+                if (!readCpus(optarg, options->background_cpus, &options->background_cpu_count)) {
+                    invalidOption("--background-cpus must be a list of CPUs and CPU ranges at most %u long", MAX_WORKERS);
+                }
+                break;
+            case 'T':
+                options->takeover_fd = atoi(optarg);
+                if (options->takeover_fd < 0) {
+                    invalidOption("--takeover must be a file descriptor");
+                }
+                break;
+            case 'A':
+                if (!readAnnounce(optarg, options)) {
+                    invalidOption("--announce must be a multicast group and a port between %u and %u, e.g. 239.255.0.1:5100",
+                        MIN_PORT_NO, MAX_PORT_NO);
+                }
+                break;
+            case 'I':
+                if (inet_pton(AF_INET, optarg, &options->announce_interface) != 1) {
+                    invalidOption("--announce-interface must be an IPv4 address");
+                }
+                break;
+            case 'L':
+                options->announce_ttl = atoi(optarg);
+                if (options->announce_ttl > MAX_ANNOUNCE_TTL) {
+                    invalidOption("--announce-ttl must be at most %u", MAX_ANNOUNCE_TTL);
+                }
+                break;
+            case 'P':
+                if (!readTimePageName(optarg)) {
+                    invalidOption("--time-page must be a name that starts with a slash, e.g. /dt-time");
+                }
+                options->time_page = optarg;
+                break;
+            case 'U':
+                if (!readUnixListener(optarg, options)) {
+                    invalidOption("--unix must be a new path shorter than %zu bytes, for at most %u sockets",
+                        sizeof(((struct sockaddr_un*) 0)->sun_path), MAX_UNIX_LISTENERS);
+                }
+                break;
+            case 'k':
+                options->timestamps = true;
+                break;
+            case 'a':
+                options->admin_port = atoi(optarg);
+                if (options->admin_port < MIN_PORT_NO || options->admin_port > MAX_PORT_NO) {
+                    invalidOption("--admin must be a port between %u and %u", MIN_PORT_NO, MAX_PORT_NO);
+                }
+                break;
+            case 'q':
+                if (!readQuota(optarg, options)) {
+                    invalidOption("--quota must be a positive number, or <port>=<n> for at most %u ports", MAX_PORT_QUOTAS);
+                }
+                break;
+            default:
+                error("usage: server [--batch <n> | --single | --uring] [--zerocopy <bytes>] [--pool <n>] [--limit <rate>[:<burst>]] [--limit-table <n>] [--workers <n>] [--quota [<port>=]<n>]... [--admin <port>] [--timestamps] [--busy-poll <us>] [--cpus <list>] [--incoming-cpu] [--background-cpus <list>] [--takeover <fd>] [--announce <group>:<port>] [--announce-interface <address>] [--announce-ttl <n>] [--time-page <name>] [--unix [<eng|mao|ger>=]<path>]... <english ports> <te reo maori ports> <german ports>", 1);
+        }
+    }
+}
+
+/**
+ * Stops the server with an error saying what an invalid option must be.
+ * 
+ * @param format The requirement, naming the option, as a printf() format.
+ * */
+void invalidOption(const char* format, ...)
+{
+    char msg[256];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(msg, sizeof(msg), format, args);
+    va_end(args);
+
+    error(msg, 1);
+}
\ No newline at end of file
@@ -3,8 +3,380 @@
 #ifndef SERVER_H
 #define SERVER_H
 
-bool readPorts(char** argv, uint16_t* ports);
-void serve(uint16_t ports[]);
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "announcer.h"
+#include "cache.h"
+#include "limiter.h"
+#include "logger.h"
+#include "metrics.h"
+#include "pool.h"
+#include "protocol.h"
+#include "scheduler.h"
+#include "timepage.h"
+#include "uring.h"
+
+// the default number of datagrams drained from a socket per wakeup
+#define DEFAULT_BATCH_SIZE 32
+
+// the largest batch size that may be requested on the command line
+#define MAX_BATCH_SIZE 1024
+
+// the largest number of worker threads that may be requested
+#define MAX_WORKERS 256
+
+// the default number of datagrams a socket may receive per turn
+#define DEFAULT_QUOTA 64
+
+// the largest number of per-port quotas that may be given
+#define MAX_PORT_QUOTAS 64
+
+// the longest a worker may spin waiting for datagrams, in microseconds
+#define MAX_BUSY_POLL 1000000
+
+// what serveSingle() and serveBatch() return when they have no datagrams to count:
+// out of packet buffers, the kernel out of memory, or a receive that failed
+#define SERVE_REQUEUE -1
+#define SERVE_BACKOFF -2
+#define SERVE_FAILED -3
+
+// the longest a worker waits before retrying a socket while the kernel is short of memory, in milliseconds
+#define MAX_RECEIVE_BACKOFF 100
+
+// the most Unix sockets that may be listened on
+#define MAX_UNIX_LISTENERS 8
+
+// the room for the name of a listener, its port or unix: and its path
+#define LISTENER_NAME_LEN (sizeof("unix:") + sizeof(((struct sockaddr_un*) 0)->sun_path))
+
+// the number of events returned by each call to epoll_wait()
+#define MAX_EVENTS 64
+
+// the event data of the descriptors that are not sockets
+#define EVENT_CACHE_TIMER 0xFFFFFFFE
+#define EVENT_SHUTDOWN 0xFFFFFFFF
+
+// the size of the buffer used to receive a request
+#define REQ_BUFFER_LEN 256
+
+// the room for the control messages that come with a received datagram,
+// the kernel receive timestamp and the socket's drop count
+#define RX_CONTROL_LEN (CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t)))
+
+// the size of each buffer in the packet pool, which leaves room in front of
+// the request for the io_uring receive header, the client address and the
+// control messages
+#define PACKET_BUFFER_LEN (sizeof(struct io_uring_recvmsg_out) + sizeof(union client_address) + \
+    RX_CONTROL_LEN + REQ_BUFFER_LEN)
+
+// the default and largest number of packet buffers in each worker's pool
+#define DEFAULT_POOL_BUFFERS 1024
+#define MAX_POOL_BUFFERS 65536
+
+// the largest rate limiter table that may be requested
+#define MAX_LIMITER_SLOTS (1 << 24)
+
+// the number of MSG_ZEROCOPY sends that may be in flight on a socket at once
+#define ZEROCOPY_INFLIGHT 1024
+
+// marks a zero copy slot that is not in flight
+#define ZEROCOPY_FREE 0xFF
+
+// the kinds of io_uring completions, kept in the top half of the user data
+// with the listener or buffer index in the bottom half
+#define URING_RECEIVE 1ULL
+#define URING_SEND 2ULL
+#define URING_CACHE_TIMER 3ULL
+#define URING_SHUTDOWN 4ULL
+#define URING_CANCEL 5ULL
+
+// The address a request came from, a UDP client or a client on the same
+// host that sent it to a Unix socket, which is the path it is bound to
+union client_address {
+    struct sockaddr any;
+    struct sockaddr_in in;
+    struct sockaddr_un un;
+};
+
+// A Unix socket to listen on and the language it responds in
+struct unix_listener {
+    char* path;
+    uint16_t language_code;
+};
+
+// The number of datagrams a port may receive per turn
+struct port_quota {
+    uint16_t port;
+    unsigned int quota;
+};
+
+// Options that control how the server services its sockets
+struct server_options {
+
+    // the number of datagrams received and sent per system call
+    unsigned int batch_size;
+
+    // if true, the one packet at a time recvfrom()/sendto() path is used
+    bool single;
+
+    // if true, io_uring is used instead of epoll when the kernel supports it
+    bool uring;
+
+    // if true, responses of at least the threshold length are sent without a copy
+    bool zerocopy;
+    unsigned int zerocopy_threshold;
+
+    // if true, the kernel timestamps every datagram and reports its drops, so
+    // that the time spent waiting in the socket queue can be measured
+    bool timestamps;
+
+    // if non-zero, each worker spins for this many microseconds waiting for
+    // datagrams before it blocks, and its sockets ask the kernel to busy poll
+    unsigned int busy_poll;
+
+    // the number of worker threads, each with its own SO_REUSEPORT sockets
+    unsigned int workers;
+
+    // the CPUs the workers are pinned to in turn, none if cpu_count is 0
+    unsigned int cpus[MAX_WORKERS];
+    unsigned int cpu_count;
+
+    // if true, each socket only takes the datagrams whose interrupts were
+    // handled on its worker's CPU, which needs the workers to be pinned
+    bool incoming_cpu;
+
+    // the CPUs shared by the logger, the admin thread and the main thread,
+    // kept off the workers' CPUs, or none if background_cpu_count is 0
+    unsigned int background_cpus[MAX_WORKERS];
+    unsigned int background_cpu_count;
+
+    // the Unix socket that an old server hands its sockets over on when this
+    // server is started to upgrade it, or -1 if it binds its own
+    int takeover_fd;
+
+    // the number of packet buffers each worker has
+    unsigned int pool_buffers;
+
+    // if true, each client address may only make rate requests per second,
+    // with up to burst at once, tracked in a table with the given slots
+    bool limit;
+    double limit_rate;
+    double limit_burst;
+    unsigned int limit_slots;
+
+    // the loopback port that answers stats requests, or 0 for none
+    uint16_t admin_port;
+
+    // if true, every response is sent to the multicast group at the start of
+    // each minute, from the given interface and crossing at most ttl routers
+    bool announce;
+    struct sockaddr_in announce_group;
+    struct in_addr announce_interface;
+    unsigned int announce_ttl;
+
+    // the Unix datagram sockets listened on as well as the ports
+    struct unix_listener unix_listeners[MAX_UNIX_LISTENERS];
+    unsigned int unix_listener_count;
+
+    // the name of the shared memory object that clients on the same host
+    // can read every response from, or NULL for none
+    char* time_page;
+
+    // the default number of datagrams per socket per turn and any per-port overrides
+    unsigned int quota;
+    struct port_quota port_quotas[MAX_PORT_QUOTAS];
+    unsigned int port_quota_count;
+};
+
+// Preallocated message headers and buffers used by the batched path
+struct batch {
+
+    // the maximum number of datagrams handled per system call
+    unsigned int size;
+
+    // the headers, buffers and client addresses for received datagrams,
+    // the buffers are taken from the worker's pool for each receive
+    struct mmsghdr* rx_msgs;
+    struct iovec* rx_iovecs;
+    uint8_t** rx_buffers;
+    union client_address* client_addrs;
+
+    // the control messages of each datagram and the time the kernel received it
+    uint8_t* rx_control;
+    uint64_t* rx_arrivals;
+
+    // the request type of each datagram, 0 if it was invalid
+    uint16_t* rx_types;
+
+    // the headers for the responses, each with a gather list of the
+    // segments of a response in the cache
+    struct mmsghdr* tx_msgs;
+    struct iovec* tx_iovecs;
+
+    // the response index of each received datagram, or -1 if it was invalid
+    int* tx_index;
+
+    // the outcome of sending each response
+    bool* tx_sent;
+};
+
+// A response sent by the io_uring path, one for each receive buffer so
+// that the client address can be read straight out of the buffer
+struct uring_send {
+    struct msghdr msg;
+    struct iovec segments[CACHE_MAX_SEGMENTS];
+
+    // the cache generation the segments are in, pinned until the send completes
+    unsigned int generation;
+
+    // the listener the request arrived on and what was asked for
+    unsigned int listener;
+    uint16_t request_type;
+
+    // true if the send was made without a copy, and true from its completion
+    // until its notification, while the slot must not be reused
+    bool zerocopy;
+    bool notifying;
+
+    // when the round of completions holding the request was reaped, and
+    // when the kernel received the request if it was timestamped
+    uint64_t received_at;
+    uint64_t arrived;
+};
+
+// A port that the server listens on and the language it responds in
+struct listener {
+
+    // the socket bound to the port, or -1 if it has not been bound
+    int fd;
+
+    // the port, or 0 for a Unix socket bound to the path
+    uint16_t port;
+    char* path;
+
+    uint16_t language_code;
+
+    // the most datagrams the socket may receive per turn
+    unsigned int quota;
+
+    // the datagrams received, the turns taken and the turns that ended
+    // with datagrams still waiting
+    uint64_t received;
+    uint64_t turns;
+    uint64_t deferrals;
+
+    // the cache generation read by each MSG_ZEROCOPY send in flight, indexed
+    // by the sequence number the kernel gives it, or ZEROCOPY_FREE
+    uint8_t* zerocopy_generations;
+    uint32_t zerocopy_next;
+
+    // the sends made without a copy, their completions and the ones the kernel copied anyway
+    uint64_t zerocopy_sends;
+    uint64_t zerocopy_completed;
+    uint64_t zerocopy_copied;
+};
+
+// A thread that receives and responds on its own socket for every port
+struct worker {
+
+    // the index of the worker, used when logging
+    unsigned int id;
+
+    pthread_t thread;
+
+    // the CPU and memory node the worker was running on once it had set
+    // itself up, which is where everything it allocated was placed
+    unsigned int cpu;
+    unsigned int node;
+
+    // the sockets for every port, registered once with the epoll instance
+    struct listener* listeners;
+    unsigned int listener_count;
+    int epoll_fd;
+
+    // the sockets waiting for their turn
+    struct scheduler scheduler;
+
+    // the precomputed responses, the packet buffers and the batch headers owned
+    // by this worker, all allocated by the worker itself so that they are on its node
+    struct response_cache* cache;
+    struct packet_pool pool;
+    struct batch* batch;
+
+    // the token buckets of the clients this worker has answered
+    struct limiter limiter;
+
+    // how long to wait before the next turn while the kernel is short of memory,
+    // in milliseconds, doubling each turn it still is up to MAX_RECEIVE_BACKOFF
+    int receive_backoff;
+
+    // the waits that ended while spinning and after going to sleep, and the
+    // time spent in each, used to weigh the CPU cost of busy polling
+    uint64_t spin_wakeups;
+    uint64_t sleep_wakeups;
+    uint64_t spin_ns;
+    uint64_t sleep_ns;
+
+    // the ring this worker logs its requests to
+    struct log_ring* log;
+
+    // what happened to every request and how long the answers took
+    struct worker_metrics* metrics;
+
+    struct server_options* options;
+};
+
+bool readPorts(char** argv, struct listener** listeners, unsigned int* count);
+void readOptions(int argc, char** argv, struct server_options* options);
+void invalidOption(const char* format, ...) __attribute__((noreturn, format(printf, 1, 2)));
+bool readQuota(char* arg, struct server_options* options);
+bool readLimit(char* arg, struct server_options* options);
+bool readAnnounce(char* arg, struct server_options* options);
+bool readTimePageName(char* arg);
+bool readUnixListener(char* arg, struct server_options* options);
+void addUnixListeners(struct server_options* options, struct listener* listeners, unsigned int* count);
+void listenerName(struct listener* listener, char* name, size_t n);
+bool readCpus(char* arg, unsigned int cpus[], unsigned int* count);
+void fillCpuSet(cpu_set_t* set, unsigned int cpus[], unsigned int count);
+bool applyQuotas(struct server_options* options, struct listener* listeners, unsigned int count);
+int createSocket(uint16_t port, bool reuse_port, int incoming_cpu, struct server_options* options);
+int createUnixSocket(char* path, struct server_options* options);
+void configureSocket(int socket_fd, int incoming_cpu, struct server_options* options);
+int createAdminSocket(uint16_t port);
+void* runAdmin(void* arg);
+size_t writeSnapshot(char* text, size_t n);
+void serve(struct listener ports[], unsigned int port_count, struct server_options* options);
+int* takeOver(int fd, struct listener ports[], unsigned int port_count, unsigned int workers);
+int createEventLoop(struct worker* worker);
+void* runWorker(void* arg);
+void initWorker(struct worker* worker);
+int busyWait(struct worker* worker, struct epoll_event events[]);
+void serveTurn(struct worker* worker);
+int serveSingle(struct worker* worker, struct listener* listener);
+struct batch* createBatch(unsigned int size);
+int serveBatch(struct worker* worker, struct listener* listener, unsigned int limit);
+uint64_t readArrival(struct worker* worker, struct listener* listener, struct msghdr* msg);
+size_t buildResponse(struct worker* worker, uint8_t* buffer, size_t length, union client_address* client_addr, uint16_t language_code, uint16_t* request_type, struct iovec segments[CACHE_MAX_SEGMENTS], size_t* segment_count);
+bool zerocopyAvailable(struct worker* worker, struct listener* listener, size_t length, unsigned int count);
+void zerocopyRecord(struct worker* worker, struct listener* listener, unsigned int count);
+void zerocopyDrain(struct worker* worker, struct listener* listener);
+bool serveUring(struct worker* worker);
+void uringWait(struct worker* worker, struct uring* ring);
+struct io_uring_sqe* uringNextSqe(struct uring* ring);
+void uringArmReceive(struct uring* ring, int fd, struct msghdr* msg, unsigned int index);
+void uringCancelReceive(struct uring* ring, unsigned int index);
+void uringArmPoll(struct uring* ring, int fd, uint64_t kind);
+void uringQueueSend(struct uring* ring, int fd, struct uring_send* send, uint16_t id);
+void logRequest(struct worker* worker, struct listener* listener, union client_address* client_addr, uint16_t request_type, uint8_t outcome);
 void handleSignal(int sig);
+void upgrade();
+void printStats();
 
-#endif
\ No newline at end of file
+#endif
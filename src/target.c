@@ -0,0 +1,101 @@
+// target.c
+
+#include <netdb.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "target.h"
+
+/**
+ * Checks whether a target is the path of a Unix socket, e.g. unix:/run/dt/eng.sock.
+ * 
+ * @param host The host argument.
+ * @return True if it names a Unix socket.
+ * */
+bool targetIsUnix(char* host)
+{
+    return strncmp(host, TARGET_UNIX_PREFIX, strlen(TARGET_UNIX_PREFIX)) == 0;
+}
+
+/**
+ * Reads a target, either an IPv4 address or hostname and a port, or
+ * unix: followed by the path of a server's Unix socket.
+ * 
+ * @param host The address or hostname, or unix: and the path.
+ * @param port The port, which is not used for a Unix socket and may be NULL.
+ * @param target Where the target is to be stored.
+ * @return True if the target was valid.
+ * */
+bool targetRead(char* host, char* port, struct target* target)
+{
+    struct addrinfo hints;
+    struct addrinfo* address;
+
+    memset(target, 0, sizeof(struct target));
+
+    if (targetIsUnix(host)) {
+
+        struct sockaddr_un* unix_addr = (struct sockaddr_un*) &target->address;
+        char* path = host + strlen(TARGET_UNIX_PREFIX);
+
+        if (path[0] == '\0' || strlen(path) >= sizeof(unix_addr->sun_path)) {
+            return false;
+        }
+
+        unix_addr->sun_family = AF_UNIX;
+        strcpy(unix_addr->sun_path, path);
+        target->length = sizeof(struct sockaddr_un);
+
+        return true;
+    }
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    if (port == NULL || getaddrinfo(host, port, &hints, &address) != 0) {
+        return false;
+    }
+
+    memcpy(&target->address, address->ai_addr, address->ai_addrlen);
+    target->length = address->ai_addrlen;
+
+    freeaddrinfo(address);
+
+    return true;
+}
+
+/**
+ * Creates a datagram socket connected to a target. A Unix socket is bound
+ * to an address the kernel picks in the abstract namespace first, as the
+ * server can only answer a client that has an address.
+ * 
+ * @param target The target.
+ * @param flags Flags for the socket type, e.g. SOCK_NONBLOCK.
+ * @return The socket descriptor, or -1 if it could not be created or connected.
+ * */
+int targetOpen(struct target* target, int flags)
+{
+    sa_family_t family = target->address.ss_family;
+    int fd = socket(family, SOCK_DGRAM | flags, 0);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    // binding just the family asks for an autobound name
+    if (family == AF_UNIX && bind(fd, (struct sockaddr *) &family, sizeof(family)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *) &target->address, target->length) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
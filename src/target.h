@@ -0,0 +1,22 @@
+// target.h
+
+#ifndef TARGET_H
+#define TARGET_H
+
+#include <stdbool.h>
+#include <sys/socket.h>
+
+// marks a target that is the path of a server's Unix socket rather than an address
+#define TARGET_UNIX_PREFIX "unix:"
+
+// Where the client sends its requests, a UDP address and port or a Unix socket
+struct target {
+    struct sockaddr_storage address;
+    socklen_t length;
+};
+
+bool targetIsUnix(char* host);
+bool targetRead(char* host, char* port, struct target* target);
+int targetOpen(struct target* target, int flags);
+
+#endif
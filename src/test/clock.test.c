@@ -0,0 +1,99 @@
+// clock.test.c
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "../clock.h"
+#include "../utils.h"
+
+/**
+ * Returns true if clockLocalTime() agrees with localtime_r() for every
+ * second in a range.
+ * 
+ * @param from The first time to check.
+ * @param to The last time to check.
+ * @return True if every second agreed.
+ * */
+bool agreesWithLocaltime(time_t from, time_t to)
+{
+    for (time_t t = from; t <= to; t++) {
+
+        struct tm expected, actual;
+
+        localtime_r(&t, &expected);
+        clockLocalTime(t, &actual);
+
+        if (expected.tm_year != actual.tm_year || expected.tm_mon != actual.tm_mon ||
+            expected.tm_mday != actual.tm_mday || expected.tm_hour != actual.tm_hour ||
+            expected.tm_min != actual.tm_min || expected.tm_sec != actual.tm_sec ||
+            expected.tm_isdst != actual.tm_isdst) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(void)
+{
+    uint16_t failures = 0;
+
+    // ** clockLocalTime **
+    // check every second either side of the start of NZ daylight time,
+    // 2018-09-30 02:00 NZST became 03:00 NZDT (2018-09-29 14:00 UTC)
+    setenv("TZ", "Pacific/Auckland", 1);
+    tzset();
+
+    if (!agreesWithLocaltime(1538229600 - 3600, 1538229600 + 3600)) {
+        failures++;
+        fail("clockLocalTime", "start of NZ daylight time is wrong");
+    }
+
+    // and the end of it, 2019-04-07 03:00 NZDT became 02:00 NZST (2019-04-06 14:00 UTC)
+    if (!agreesWithLocaltime(1554559200 - 3600, 1554559200 + 3600)) {
+        failures++;
+        fail("clockLocalTime", "end of NZ daylight time is wrong");
+    }
+
+    // check that a change of TZ is seen by the next minute without calling tzset(),
+    // Berlin was on CEST (UTC+2) at the time
+    struct tm changed;
+    setenv("TZ", "Europe/Berlin", 1);
+    clockLocalTime(1554559200 + 3660, &changed);
+
+    if (changed.tm_gmtoff != 7200 || !agreesWithLocaltime(1554559200 + 3660, 1554559200 + 3720)) {
+        failures++;
+        fail("clockLocalTime", "change of TZ was not picked up");
+    }
+
+    // check that going back in time is handled
+    if (!agreesWithLocaltime(1000000000, 1000000120)) {
+        failures++;
+        fail("clockLocalTime", "earlier time is wrong");
+    }
+
+    // ** clockNow **
+    // check that the current time is within a second of localtime()
+    struct tm now;
+    time_t before = time(NULL);
+    clockNow(&now);
+    time_t after = time(NULL);
+
+    time_t seen = mktime(&now);
+    if (seen < before - 1 || seen > after) {
+        failures++;
+        fail("clockNow", "current time is wrong");
+    }
+
+    // ** clockRefreshes **
+    // the cached minute should have been recomputed about once a minute
+    if (clockRefreshes() == 0 || clockRefreshes() > 400) {
+        failures++;
+        fail("clockRefreshes", "refreshes are not once a minute");
+    }
+
+    return failures;
+}
@@ -0,0 +1,247 @@
+// dtclient.test.c
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../dtclient.h"
+#include "../protocol.h"
+#include "../utils.h"
+
+// What a callback was called with
+struct outcome {
+    unsigned int calls;
+    int status;
+    struct dtclient_response response;
+};
+
+/**
+ * Records the outcome of a request in its struct outcome.
+ * */
+void record(struct dtclient* client, int status, struct dtclient_response* response, void* context)
+{
+    struct outcome* outcome = context;
+
+    outcome->calls++;
+    outcome->status = status;
+
+    if (response != NULL) {
+        outcome->response = *response;
+    }
+}
+
+/**
+ * Reads a request on the test server's socket.
+ *
+ * @return The request type, or 0 if no request arrived.
+ * */
+uint16_t receiveRequest(int server, struct sockaddr_in* client_address)
+{
+    uint8_t req[REQ_PKT_LEN];
+    socklen_t length = sizeof(struct sockaddr_in);
+    struct pollfd server_poll = { .fd = server, .events = POLLIN };
+
+    if (poll(&server_poll, 1, 1000) <= 0 ||
+        recvfrom(server, req, REQ_PKT_LEN, 0, (struct sockaddr*) client_address, &length) != REQ_PKT_LEN) {
+        return 0;
+    }
+
+    return dtReqType(req, REQ_PKT_LEN);
+}
+
+/**
+ * Sends a response from the test server's socket, at a fixed minute.
+ * */
+void sendResponse(int server, struct sockaddr_in* client_address, uint16_t reqType, uint16_t langCode)
+{
+    uint8_t pkt[RES_PKT_LEN];
+    size_t length = reqType & REQ_FLAG_COMPACT ?
+        dtResCompact(pkt, RES_PKT_LEN, langCode, 2024, 7, 14, 9, 30) :
+        dtRes(pkt, RES_PKT_LEN, reqType, langCode, 2024, 7, 14, 9, 30);
+
+    sendto(server, pkt, length, 0, (struct sockaddr*) client_address, sizeof(struct sockaddr_in));
+}
+
+/**
+ * Waits for the client's socket to be readable, then processes it.
+ * */
+int processWhenReadable(struct dtclient* client)
+{
+    struct pollfd client_poll = { .fd = dtclientFd(client), .events = POLLIN };
+
+    poll(&client_poll, 1, 1000);
+
+    return dtclientProcess(client);
+}
+
+int main(void)
+{
+    uint16_t failures = 0;
+
+    struct dtclient client;
+    struct dtclient_response response;
+    struct sockaddr_in server_address = { .sin_family = AF_INET };
+    struct sockaddr_in client_address;
+    socklen_t length = sizeof(struct sockaddr_in);
+    struct outcome date = {0}, time = {0}, compact = {0}, late = {0}, expired = {0};
+    struct outcome full[DTCLIENT_MAX_PENDING] = {{0}};
+    char port[8];
+    int server;
+
+    // a server on an ephemeral loopback port that the test answers for by hand
+    server = socket(AF_INET, SOCK_DGRAM, 0);
+    server_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (server < 0 || bind(server, (struct sockaddr*) &server_address, sizeof(server_address)) < 0 ||
+        getsockname(server, (struct sockaddr*) &server_address, &length) < 0) {
+        fail("socket", "could not create the test server");
+        return 1;
+    }
+
+    snprintf(port, sizeof(port), "%u", ntohs(server_address.sin_port));
+
+    // ** dtclientOpen **
+    // check that a bad target is returned as an error rather than exiting
+    if (dtclientOpen(&client, "unix:", NULL) != DTCLIENT_ERR_ADDRESS) {
+        failures++;
+        fail("dtclientOpen", "accepted an empty unix socket path");
+    }
+
+    if (dtclientOpen(&client, "127.0.0.1", port) != DTCLIENT_OK) {
+        fail("dtclientOpen", "could not connect to the test server");
+        return 1;
+    }
+
+    // ** dtclientSend / dtclientProcess **
+    // check that responses answered out of order reach the requests they answer
+    if (dtclientSend(&client, REQ_DATE, record, &date) != DTCLIENT_OK ||
+        dtclientSend(&client, REQ_TIME, record, &time) != DTCLIENT_OK) {
+        failures++;
+        fail("dtclientSend", "could not send two requests");
+    }
+
+    if (receiveRequest(server, &client_address) != REQ_DATE || receiveRequest(server, &client_address) != REQ_TIME) {
+        failures++;
+        fail("dtclientSend", "the requests did not arrive in order");
+    }
+
+    sendResponse(server, &client_address, REQ_TIME, LANG_GER);
+    sendResponse(server, &client_address, REQ_DATE, LANG_GER);
+
+    while (date.calls + time.calls < 2 && processWhenReadable(&client) > 0);
+
+    if (date.calls != 1 || date.status != DTCLIENT_OK || strstr(date.response.text, "Juli") == NULL) {
+        failures++;
+        fail("dtclientProcess", "the date request did not get the date response");
+    }
+
+    if (time.calls != 1 || time.status != DTCLIENT_OK || strcmp(time.response.text, "Die Uhrzeit ist 09:30") != 0 ||
+        time.response.lang_code != LANG_GER || time.response.year != 2024 || time.response.minute != 30) {
+        failures++;
+        fail("dtclientProcess", "the time request did not get the time response");
+    }
+
+    if (client.count != 0 || client.answered != 2) {
+        failures++;
+        fail("dtclientProcess", "answered requests were left waiting");
+    }
+
+    // check that a compact request takes a response with no text
+    dtclientSend(&client, REQ_TIME | REQ_FLAG_COMPACT, record, &compact);
+    receiveRequest(server, &client_address);
+    sendResponse(server, &client_address, REQ_TIME | REQ_FLAG_COMPACT, LANG_ENG);
+    processWhenReadable(&client);
+
+    if (compact.calls != 1 || compact.status != DTCLIENT_OK || compact.response.text_length != 0) {
+        failures++;
+        fail("dtclientProcess", "the compact request was not answered");
+    }
+
+    // ** dtclientNextTimeout **
+    // check that a request times out and that its late response is not taken by a later request
+    dtclientSetTimeout(&client, 20);
+
+    if (dtclientNextTimeout(&client) != -1) {
+        failures++;
+        fail("dtclientNextTimeout", "gave a timeout with no request waiting");
+    }
+
+    dtclientSend(&client, REQ_DATE, record, &expired);
+    receiveRequest(server, &client_address);
+
+    if (dtclientNextTimeout(&client) < 0 || dtclientNextTimeout(&client) > 20) {
+        failures++;
+        fail("dtclientNextTimeout", "gave the wrong timeout for a waiting request");
+    }
+
+    poll(NULL, 0, dtclientNextTimeout(&client));
+    dtclientProcess(&client);
+
+    if (expired.calls != 1 || expired.status != DTCLIENT_ERR_TIMEOUT || client.timed_out != 1) {
+        failures++;
+        fail("dtclientProcess", "the request did not time out");
+    }
+
+    dtclientSetTimeout(&client, DTCLIENT_DEFAULT_TIMEOUT);
+    dtclientSend(&client, REQ_TIME, record, &late);
+    receiveRequest(server, &client_address);
+    sendResponse(server, &client_address, REQ_DATE, LANG_ENG);
+    sendResponse(server, &client_address, REQ_TIME, LANG_ENG);
+
+    for (int i = 0; i < 2 && late.calls == 0; i++) {
+        processWhenReadable(&client);
+    }
+
+    if (late.calls != 1 || strcmp(late.response.text, "The current time is 09:30") != 0 || client.unmatched != 1) {
+        failures++;
+        fail("dtclientMatch", "a late date response was taken by a time request");
+    }
+
+    // ** dtclientRequest **
+    // check that a blocking request returns when it times out
+    dtclientSetTimeout(&client, 20);
+
+    if (dtclientRequest(&client, REQ_DATE, &response) != DTCLIENT_ERR_TIMEOUT) {
+        failures++;
+        fail("dtclientRequest", "an unanswered request did not time out");
+    }
+
+    if (dtclientRequest(&client, 0x0007, &response) != DTCLIENT_ERR_REQUEST) {
+        failures++;
+        fail("dtclientRequest", "sent a request of an unknown type");
+    }
+
+    // ** dtclientClose **
+    // check that a full handle turns requests away and that closing it fails the requests waiting
+    dtclientSetTimeout(&client, DTCLIENT_DEFAULT_TIMEOUT);
+
+    for (int i = 0; i < DTCLIENT_MAX_PENDING; i++) {
+        dtclientSend(&client, REQ_TIME, record, &full[i]);
+    }
+
+    if (dtclientSend(&client, REQ_TIME, record, &late) != DTCLIENT_ERR_FULL) {
+        failures++;
+        fail("dtclientSend", "sent more requests than the handle can wait for");
+    }
+
+    dtclientClose(&client);
+
+    for (int i = 0; i < DTCLIENT_MAX_PENDING; i++) {
+        if (full[i].calls != 1 || full[i].status != DTCLIENT_ERR_CLOSED) {
+            failures++;
+            fail("dtclientClose", "a waiting request was not failed");
+            break;
+        }
+    }
+
+    close(server);
+
+    return failures;
+}
@@ -0,0 +1,101 @@
+// handoff.test.c
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../handoff.h"
+#include "../utils.h"
+
+// more than two messages' worth so that the chunking is exercised
+#define SOCKET_COUNT (HANDOFF_CHUNK * 2 + 3)
+
+/**
+ * Checks that two descriptors refer to the same socket.
+ * */
+bool sameSocket(int a, int b)
+{
+    struct stat first, second;
+
+    return fstat(a, &first) == 0 && fstat(b, &second) == 0 &&
+        first.st_dev == second.st_dev && first.st_ino == second.st_ino;
+}
+
+int main(void)
+{
+    uint16_t failures = 0;
+
+    int pair[2];
+    int sockets[SOCKET_COUNT];
+    int received[SOCKET_COUNT];
+    uint16_t ports[SOCKET_COUNT];
+    uint16_t received_ports[SOCKET_COUNT];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) < 0) {
+        fail("socketpair", "could not create the Unix sockets");
+        return 1;
+    }
+
+    for (int i = 0; i < SOCKET_COUNT; i++) {
+        sockets[i] = socket(AF_INET, SOCK_DGRAM, 0);
+        ports[i] = 5000 + i;
+    }
+
+    // ** handoffSend / handoffReceive **
+    // check that every socket arrives as the same socket with its port
+    if (!handoffSend(pair[0], sockets, ports, SOCKET_COUNT)) {
+        failures++;
+        fail("handoffSend", "could not send the sockets");
+    }
+
+    if (!handoffReceive(pair[1], received, received_ports, SOCKET_COUNT)) {
+        failures++;
+        fail("handoffReceive", "could not receive the sockets");
+    } else {
+        for (int i = 0; i < SOCKET_COUNT; i++) {
+            if (!sameSocket(sockets[i], received[i]) || received_ports[i] != ports[i]) {
+                failures++;
+                fail("handoffReceive", "socket or port does not match what was sent");
+                break;
+            }
+        }
+
+        for (int i = 0; i < SOCKET_COUNT; i++) {
+            close(received[i]);
+        }
+    }
+
+    // check that a receiver expecting different sockets refuses them
+    handoffSend(pair[0], sockets, ports, 3);
+
+    if (handoffReceive(pair[1], received, received_ports, 4)) {
+        failures++;
+        fail("handoffReceive", "accepted the wrong number of sockets");
+    }
+
+    // ** handoffReady / handoffWait **
+    // check that the ready byte is seen, and that a closed peer is not mistaken for it
+    if (!handoffReady(pair[1]) || !handoffWait(pair[0], 1000)) {
+        failures++;
+        fail("handoffWait", "did not see the new process become ready");
+    }
+
+    close(pair[1]);
+
+    if (handoffWait(pair[0], 1000)) {
+        failures++;
+        fail("handoffWait", "took a closed socket for a ready one");
+    }
+
+    close(pair[0]);
+
+    for (int i = 0; i < SOCKET_COUNT; i++) {
+        close(sockets[i]);
+    }
+
+    return failures;
+}
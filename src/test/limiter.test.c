@@ -0,0 +1,107 @@
+// limiter.test.c
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../limiter.h"
+#include "../utils.h"
+
+// one second in nanoseconds
+#define SECOND 1000000000ULL
+
+/**
+ * Returns the address 10.0.x.y for a number.
+ * 
+ * @param n The number.
+ * @return The address.
+ * */
+struct in_addr address(uint32_t n)
+{
+    struct in_addr addr;
+    addr.s_addr = htonl(0x0A000000 + n);
+    return addr;
+}
+
+int main(void)
+{
+    uint16_t failures = 0;
+
+    struct limiter limiter;
+    int allowed = 0;
+
+    // ** limiterAllow **
+    // check that a new client gets its burst and then nothing more
+    limiterInit(&limiter, 16, 10, 5);
+
+    for (int i = 0; i < 8; i++) {
+        allowed += limiterAllow(&limiter, address(1), SECOND);
+    }
+
+    if (allowed != 5 || limiter.limited != 3) {
+        failures++;
+        fail("limiterAllow", "burst is wrong");
+    }
+
+    // check that the bucket refills at the rate, 10 per second
+    allowed = 0;
+
+    for (int i = 0; i < 5; i++) {
+        allowed += limiterAllow(&limiter, address(1), SECOND + SECOND / 5);
+    }
+
+    if (allowed != 2) {
+        failures++;
+        fail("limiterAllow", "refill is wrong");
+    }
+
+    // check that the bucket never holds more than the burst
+    allowed = 0;
+
+    for (int i = 0; i < 10; i++) {
+        allowed += limiterAllow(&limiter, address(1), 100 * SECOND);
+    }
+
+    if (allowed != 5) {
+        failures++;
+        fail("limiterAllow", "bucket overfilled");
+    }
+
+    // check that other clients are unaffected
+    if (!limiterAllow(&limiter, address(2), 100 * SECOND)) {
+        failures++;
+        fail("limiterAllow", "client limited by another");
+    }
+
+    // ** eviction **
+    // fill a small table well past its capacity of 12, touching client 1
+    // each time so it is never the least recently seen
+    limiterInit(&limiter, 16, 0.001, 1);
+
+    for (uint32_t n = 2; n < 1000; n++) {
+        limiterAllow(&limiter, address(1), n * SECOND);
+        limiterAllow(&limiter, address(n), n * SECOND);
+    }
+
+    if (limiter.count != 12 || limiter.evictions != 999 - 12) {
+        failures++;
+        fail("limiterAllow", "occupancy or evictions are wrong");
+    }
+
+    // the survivors must still be found after every shift, so their empty buckets still limit them
+    for (uint32_t n = 999 - 10; n < 1000; n++) {
+        if (limiterAllow(&limiter, address(n), 999 * SECOND)) {
+            failures++;
+            fail("limiterAllow", "recent client was lost from the table");
+        }
+    }
+
+    if (limiterAllow(&limiter, address(1), 999 * SECOND)) {
+        failures++;
+        fail("limiterAllow", "most used client was evicted");
+    }
+
+    return failures;
+}
@@ -0,0 +1,84 @@
+// pool.test.c
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../pool.h"
+#include "../utils.h"
+
+int main(void)
+{
+    uint16_t failures = 0;
+
+    struct packet_pool pool;
+    uint8_t* buffers[8];
+    uint8_t* more[8];
+
+    poolInit(&pool, 8, 100);
+
+    // ** poolInit **
+    // check that the buffers are rounded up to whole cache lines
+    if (pool.buffer_len != 128) {
+        failures++;
+        fail("poolInit", "buffer length is not a whole number of cache lines");
+    }
+
+    // ** poolAlloc **
+    // check that every buffer is aligned and distinct
+    if (poolAlloc(&pool, buffers, 8) != 8) {
+        failures++;
+        fail("poolAlloc", "could not take every buffer");
+    }
+
+    for (int i = 0; i < 8; i++) {
+        if ((uintptr_t) buffers[i] % POOL_ALIGN != 0) {
+            failures++;
+            fail("poolAlloc", "buffer is not cache line aligned");
+        }
+
+        for (int j = 0; j < i; j++) {
+            if (buffers[i] == buffers[j]) {
+                failures++;
+                fail("poolAlloc", "buffer was handed out twice");
+            }
+        }
+
+        // every byte of the buffer must be usable
+        memset(buffers[i], i, pool.buffer_len);
+    }
+
+    // check that an empty pool hands out nothing and counts it
+    if (poolAlloc(&pool, more, 1) != 0 || pool.exhausted != 1) {
+        failures++;
+        fail("poolAlloc", "empty pool is not reported as exhausted");
+    }
+
+    // ** poolFree **
+    // check that freed buffers can be taken again and a short take is counted
+    poolFree(&pool, buffers, 3);
+
+    if (poolInUse(&pool) != 5) {
+        failures++;
+        fail("poolFree", "buffers in use is wrong");
+    }
+
+    if (poolAlloc(&pool, more, 4) != 3 || pool.exhausted != 2) {
+        failures++;
+        fail("poolAlloc", "short take is wrong");
+    }
+
+    // ** high water **
+    // check that the high water mark stays at the most ever taken
+    poolFree(&pool, more, 3);
+    poolFree(&pool, buffers + 3, 5);
+
+    if (poolInUse(&pool) != 0 || pool.high_water != 8 || pool.allocations != 11) {
+        failures++;
+        fail("poolAlloc", "high water mark or allocations are wrong");
+    }
+
+    return failures;
+}
@@ -3,10 +3,81 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "../protocol.h"
 #include "../utils.h"
 
+/**
+ * Constructs a DT Response packet the way dtRes() did before it had its
+ * own encoder, by filling in PHRASES with sprintf().
+ * 
+ * @return The length of the packet.
+ * */
+size_t referenceDtRes(uint8_t pkt[], uint16_t reqType, uint16_t langCode, uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute)
+{
+    const char* phrase = PHRASES[langCode - 1][reqType - 1];
+    char text[RES_TEXT_LEN + 1] = {0};
+    int length;
+
+    if (reqType == REQ_DATE) {
+        const char* monthStr = MONTHS[langCode - 1][month - 1].text;
+        if (langCode == LANG_GER) {
+            length = sprintf(text, phrase, day, monthStr, year);
+        } else {
+            length = sprintf(text, phrase, monthStr, day, year);
+        }
+    } else {
+        length = sprintf(text, phrase, hour, minute);
+    }
+
+    pkt[0] = (uint8_t)(MAGIC_NO >> 8);
+    pkt[1] = (uint8_t)(MAGIC_NO & 0xFF);
+    pkt[2] = (uint8_t)(PACKET_RES >> 8);
+    pkt[3] = (uint8_t)(PACKET_RES & 0xFF);
+    pkt[4] = (uint8_t)(langCode >> 8);
+    pkt[5] = (uint8_t)(langCode & 0xFF);
+    pkt[6] = (uint8_t)(year >> 8);
+    pkt[7] = (uint8_t)(year & 0xFF);
+    pkt[8] = month;
+    pkt[9] = day;
+    pkt[10] = hour;
+    pkt[11] = minute;
+    pkt[12] = (uint8_t)length;
+    memcpy(&pkt[13], text, length);
+
+    return 13 + length;
+}
+
+/**
+ * Returns true if dtRes() and referenceDtRes() produce the same packet.
+ * The first mismatch is dumped.
+ * */
+bool sameDtRes(uint16_t reqType, uint16_t langCode, uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute)
+{
+    static bool dumped = false;
+
+    uint8_t expected[RES_PKT_LEN] = {0};
+    uint8_t actual[RES_PKT_LEN] = {0};
+
+    size_t expectedLen = referenceDtRes(expected, reqType, langCode, year, month, day, hour, minute);
+    size_t actualLen = dtRes(actual, RES_PKT_LEN, reqType, langCode, year, month, day, hour, minute);
+
+    if (expectedLen == actualLen && memcmp(expected, actual, expectedLen) == 0) {
+        return true;
+    }
+
+    if (!dumped) {
+        dumped = true;
+        printf("expected:\n");
+        dtPktDump(expected);
+        printf("actual:\n");
+        dtPktDump(actual);
+    }
+
+    return false;
+}
+
 int main(void)
 {
     uint16_t failures = 0;
@@ -209,6 +280,54 @@ int main(void)
         dtPktDump(timeEngResPkt);
     }
 
+    // create a date packet with an invalid month
+    uint8_t badMonthResPkt[RES_PKT_LEN] = {0};
+    if (dtRes(badMonthResPkt, RES_PKT_LEN, REQ_DATE, LANG_ENG, 2018, 13, 10, 12, 45) != 0) {
+        failures++;
+        fail("dtRes", "month should be invalid");
+    }
+
+    // compare the encoder against sprintf for every language, request type,
+    // month, day, hour and minute
+    uint32_t mismatches = 0;
+
+    for (uint16_t langCode = LANG_ENG; langCode <= LANG_GER; langCode++) {
+        for (uint16_t reqType = REQ_DATE; reqType <= REQ_TIME; reqType++) {
+            for (uint8_t month = 1; month <= 12; month++) {
+                for (uint8_t day = 1; day <= 31; day++) {
+                    for (uint8_t hour = 0; hour <= 23; hour++) {
+                        for (uint8_t minute = 0; minute <= 59; minute++) {
+                            if (!sameDtRes(reqType, langCode, 2018, month, day, hour, minute)) {
+                                mismatches++;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // and for every year and every out of range day, hour and minute
+    for (uint16_t langCode = LANG_ENG; langCode <= LANG_GER; langCode++) {
+        for (uint32_t year = 0; year <= 0xFFFF; year++) {
+            if (!sameDtRes(REQ_DATE, langCode, year, 6, 10, 12, 45)) {
+                mismatches++;
+            }
+        }
+
+        for (uint16_t value = 0; value <= 0xFF; value++) {
+            if (!sameDtRes(REQ_DATE, langCode, 2018, 6, value, 12, 45) ||
+                !sameDtRes(REQ_TIME, langCode, 2018, 6, 10, value, value)) {
+                mismatches++;
+            }
+        }
+    }
+
+    if (mismatches > 0) {
+        failures++;
+        fail("dtRes", "encoder output differs from sprintf");
+    }
+
     // ** dtResValid **
     // check with a packet that is too small
     if (dtResValid(smallResPkt, smallResPktLen)) {
@@ -374,5 +493,213 @@ int main(void)
         }
     }
 
+    // ** dtStatsReq **
+    // check that the request is built and only with the right length
+    uint8_t statsReqPkt[STATS_REQ_LEN] = {0};
+    if (dtStatsReq(statsReqPkt, STATS_REQ_LEN) != STATS_REQ_LEN ||
+        dtPktType(statsReqPkt, STATS_REQ_LEN) != PACKET_STATS_REQ) {
+        failures++;
+        fail("dtStatsReq", "request not created");
+    }
+
+    if (dtStatsReq(statsReqPkt, STATS_REQ_LEN - 1) != 0) {
+        failures++;
+        fail("dtStatsReq", "n should be too small");
+    }
+
+    // ** dtStatsReqValid **
+    // check that a stats request is valid and a date request is not
+    if (!dtStatsReqValid(statsReqPkt, STATS_REQ_LEN)) {
+        failures++;
+        fail("dtStatsReqValid", "stats packet should be correct");
+    }
+
+    if (dtStatsReqValid(reqPktDate, REQ_PKT_LEN)) {
+        failures++;
+        fail("dtStatsReqValid", "date packet should be incorrect");
+    }
+
+    // ** dtStatsRes **
+    // check that the text follows the header and is cut short to fit
+    uint8_t statsResPkt[32] = {0};
+    if (dtStatsRes(statsResPkt, 32, "dt_requests 1\n", 14) != 18 ||
+        memcmp(statsResPkt + STATS_HEADER_LEN, "dt_requests 1\n", 14) != 0) {
+        failures++;
+        fail("dtStatsRes", "text not copied");
+    }
+
+    if (dtStatsRes(statsResPkt, 16, "dt_requests_total 1\n", 20) != 16) {
+        failures++;
+        fail("dtStatsRes", "text not cut short");
+    }
+
+    // ** dtStatsResValid **
+    if (!dtStatsResValid(statsResPkt, 16)) {
+        failures++;
+        fail("dtStatsResValid", "stats response should be correct");
+    }
+
+    if (dtStatsResValid(statsReqPkt, STATS_REQ_LEN)) {
+        failures++;
+        fail("dtStatsResValid", "stats request should be incorrect");
+    }
+
+    // ** dtReqCompact **
+    // check that the flag is carried without changing the request type
+    uint8_t compactReqPkt[REQ_PKT_LEN] = {0};
+
+    if (dtReq(compactReqPkt, REQ_PKT_LEN, REQ_TIME | REQ_FLAG_COMPACT) != REQ_PKT_LEN ||
+        !dtReqValid(compactReqPkt, REQ_PKT_LEN) || !dtReqCompact(compactReqPkt, REQ_PKT_LEN) ||
+        dtReqType(compactReqPkt, REQ_PKT_LEN) != REQ_TIME) {
+        failures++;
+        fail("dtReqCompact", "compact time request not created");
+    }
+
+    if (dtReqCompact(reqPktDate, REQ_PKT_LEN)) {
+        failures++;
+        fail("dtReqCompact", "date request should not be compact");
+    }
+
+    // any other high bit is still an invalid request type
+    compactReqPkt[4] = 0x40;
+
+    if (dtReqValid(compactReqPkt, REQ_PKT_LEN)) {
+        failures++;
+        fail("dtReqValid", "unknown flag should be incorrect");
+    }
+
+    // ** dtResCompact **
+    // check that a compact response is a response with the same fields and no text
+    uint8_t compactResPkt[RES_PKT_LEN] = {0};
+
+    if (dtResCompact(compactResPkt, RES_PKT_LEN, LANG_ENG, 2018, 6, 10, 12, 45) != RES_HEADER_LEN ||
+        memcmp(compactResPkt, dateEngResPkt, RES_HEADER_LEN - 1) != 0 ||
+        dtResLength(compactResPkt, RES_HEADER_LEN) != 0) {
+        failures++;
+        fail("dtResCompact", "fields not written");
+    }
+
+    if (dtResCompact(compactResPkt, RES_HEADER_LEN - 1, LANG_ENG, 2018, 6, 10, 12, 45) != 0) {
+        failures++;
+        fail("dtResCompact", "n should be too small");
+    }
+
+    // ** dtResCompactValid **
+    if (!dtResCompactValid(compactResPkt, RES_HEADER_LEN) || !dtResValid(compactResPkt, RES_HEADER_LEN)) {
+        failures++;
+        fail("dtResCompactValid", "compact response should be correct");
+    }
+
+    if (dtResCompactValid(dateEngResPkt, 13 + 29)) {
+        failures++;
+        fail("dtResCompactValid", "response with text should not be compact");
+    }
+
+    // ** dtBatchReq **
+    // check that the queries follow the count, and that too many are refused
+    uint16_t batchTypes[BATCH_MAX_QUERIES + 1] = { REQ_DATE, REQ_TIME, REQ_TIME, REQ_DATE, REQ_TIME, REQ_DATE, REQ_TIME };
+    uint16_t batchLangs[BATCH_MAX_QUERIES + 1] = { LANG_ENG, LANG_MAO, LANG_GER, LANG_GER, LANG_ENG, LANG_MAO, LANG_ENG };
+    uint8_t batchReqPkt[BATCH_REQ_MAX_LEN + BATCH_QUERY_LEN] = {0};
+
+    if (dtBatchReq(batchReqPkt, BATCH_REQ_MAX_LEN, batchTypes, batchLangs, 3) != BATCH_HEADER_LEN + 3 * BATCH_QUERY_LEN ||
+        dtBatchCount(batchReqPkt, BATCH_REQ_MAX_LEN) != 3 ||
+        dtBatchReqType(batchReqPkt, BATCH_REQ_MAX_LEN, 1) != REQ_TIME ||
+        dtBatchReqLangCode(batchReqPkt, BATCH_REQ_MAX_LEN, 2) != LANG_GER) {
+        failures++;
+        fail("dtBatchReq", "queries not written");
+    }
+
+    if (dtBatchReq(batchReqPkt, sizeof(batchReqPkt), batchTypes, batchLangs, BATCH_MAX_QUERIES + 1) != 0 ||
+        dtBatchReq(batchReqPkt, sizeof(batchReqPkt), batchTypes, batchLangs, 0) != 0) {
+        failures++;
+        fail("dtBatchReq", "count should be out of range");
+    }
+
+    if (dtBatchReq(batchReqPkt, BATCH_HEADER_LEN + BATCH_QUERY_LEN, batchTypes, batchLangs, 2) != 0) {
+        failures++;
+        fail("dtBatchReq", "n should be too small");
+    }
+
+    // ** dtBatchReqValid **
+    // check that a batch is valid only with its exact length and valid queries
+    size_t batchReqLen = dtBatchReq(batchReqPkt, BATCH_REQ_MAX_LEN, batchTypes, batchLangs, BATCH_MAX_QUERIES);
+
+    if (!dtBatchReqValid(batchReqPkt, batchReqLen)) {
+        failures++;
+        fail("dtBatchReqValid", "batch packet should be correct");
+    }
+
+    if (dtBatchReqValid(batchReqPkt, batchReqLen - 1) || dtBatchReqValid(reqPktDate, REQ_PKT_LEN)) {
+        failures++;
+        fail("dtBatchReqValid", "truncated batch or date packet should be incorrect");
+    }
+
+    // a count over the maximum is refused even when the queries are all there
+    batchReqPkt[4] = BATCH_MAX_QUERIES + 1;
+    batchReqPkt[BATCH_REQ_MAX_LEN + 1] = REQ_TIME;
+    batchReqPkt[BATCH_REQ_MAX_LEN + 3] = LANG_ENG;
+
+    if (dtBatchReqValid(batchReqPkt, BATCH_REQ_MAX_LEN + BATCH_QUERY_LEN)) {
+        failures++;
+        fail("dtBatchReqValid", "oversized batch should be incorrect");
+    }
+
+    batchReqPkt[4] = BATCH_MAX_QUERIES;
+    batchReqPkt[BATCH_HEADER_LEN + 1] = 3;
+
+    if (dtBatchReqValid(batchReqPkt, batchReqLen)) {
+        failures++;
+        fail("dtBatchReqValid", "query with a bad request type should be incorrect");
+    }
+
+    // ** dtBatchRes **
+    // check that each record is the response dtRes() builds for its query
+    uint8_t batchResPkt[BATCH_RES_MAX_LEN] = {0};
+    size_t batchResLen = dtBatchRes(batchResPkt, BATCH_RES_MAX_LEN, batchTypes, batchLangs, 3, 2017, 8, 13, 12, 34);
+    uint8_t recordPkt[RES_PKT_LEN] = {0};
+    size_t recordOffset = BATCH_HEADER_LEN;
+
+    for (unsigned int r = 0; r < 3; r++) {
+
+        size_t recordLen = dtRes(recordPkt, RES_PKT_LEN, batchTypes[r], batchLangs[r], 2017, 8, 13, 12, 34);
+        size_t foundLen;
+
+        if (dtBatchResRecord(batchResPkt, batchResLen, r, &foundLen) != recordOffset || foundLen != recordLen ||
+            memcmp(batchResPkt + recordOffset, recordPkt, recordLen) != 0) {
+            failures++;
+            fail("dtBatchRes", "record is not the dtRes() response");
+        }
+
+        recordOffset += recordLen;
+    }
+
+    if (batchResLen != recordOffset || dtPktLength(batchResPkt) != batchResLen) {
+        failures++;
+        fail("dtBatchRes", "length is wrong");
+    }
+
+    if (dtBatchRes(batchResPkt, 40, batchTypes, batchLangs, 3, 2017, 8, 13, 12, 34) != 0) {
+        failures++;
+        fail("dtBatchRes", "records should not fit");
+    }
+
+    // ** dtBatchResValid **
+    if (!dtBatchResValid(batchResPkt, batchResLen)) {
+        failures++;
+        fail("dtBatchResValid", "batch response should be correct");
+    }
+
+    if (dtBatchResValid(batchResPkt, batchResLen - 1) || dtBatchResValid(batchResPkt, batchResLen + 1)) {
+        failures++;
+        fail("dtBatchResValid", "batch response with the wrong length should be incorrect");
+    }
+
+    batchResPkt[4] = 4;
+
+    if (dtBatchResValid(batchResPkt, batchResLen)) {
+        failures++;
+        fail("dtBatchResValid", "batch response missing a record should be incorrect");
+    }
+
     return failures;
 }
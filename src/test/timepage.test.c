@@ -0,0 +1,111 @@
+// timepage.test.c
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "../protocol.h"
+#include "../timepage.h"
+#include "../utils.h"
+
+#define PAGE_NAME "/dt-timepage-test"
+
+int main(void)
+{
+    uint16_t failures = 0;
+
+    struct time_page_writer writer;
+    const struct time_page* page;
+    uint8_t pkt[RES_PKT_LEN];
+    time_t minute;
+    size_t length;
+
+    timepageCreate(&writer, PAGE_NAME, true);
+
+    // ** timepageOpen **
+    // check that a published page can be mapped, and that a missing one is reported
+    page = timepageOpen(PAGE_NAME);
+
+    if (page == NULL) {
+        fail("timepageOpen", "could not open a page that was just created");
+        timepageClose(&writer, true);
+        return 1;
+    }
+
+    if (timepageOpen("/dt-timepage-missing") != NULL) {
+        failures++;
+        fail("timepageOpen", "opened a page that does not exist");
+    }
+
+    // ** timepageRead **
+    // check that every response is whole, in the right language and for this minute
+    for (uint16_t lang = LANG_ENG; lang <= LANG_GER; lang++) {
+        for (uint16_t type = REQ_DATE; type <= REQ_TIME; type++) {
+
+            length = timepageRead(page, type, lang, pkt, RES_PKT_LEN, &minute);
+
+            if (length == 0 || !dtResValid(pkt, length) || dtResLangCode(pkt, length) != lang) {
+                failures++;
+                fail("timepageRead", "response is not a valid response in the language asked for");
+            }
+
+            if (!timepageFresh(minute, time(NULL))) {
+                failures++;
+                fail("timepageRead", "response is not for the current minute");
+            }
+        }
+    }
+
+    // check that a query outside the page or a buffer too small is refused
+    if (timepageRead(page, REQ_BATCH, LANG_ENG, pkt, RES_PKT_LEN, &minute) != 0 ||
+        timepageRead(page, REQ_DATE, 0, pkt, RES_PKT_LEN, &minute) != 0 ||
+        timepageRead(page, REQ_DATE, LANG_ENG, pkt, RES_HEADER_LEN, &minute) != 0) {
+        failures++;
+        fail("timepageRead", "read a response that does not exist or does not fit");
+    }
+
+    // check that a page left mid-write is never read
+    writer.page->sequence++;
+
+    if (timepageRead(page, REQ_TIME, LANG_MAO, pkt, RES_PKT_LEN, &minute) != 0) {
+        failures++;
+        fail("timepageRead", "read a page that was being written");
+    }
+
+    // check that a publish is skipped rather than torn while another writer holds the page
+    timepagePublish(&writer);
+
+    if (writer.page->sequence & 1) {
+        writer.page->sequence++;
+    } else {
+        failures++;
+        fail("timepagePublish", "took a page another writer was holding");
+    }
+
+    timepagePublish(&writer);
+
+    if (writer.page->published != 2 || timepageRead(page, REQ_TIME, LANG_MAO, pkt, RES_PKT_LEN, &minute) == 0) {
+        failures++;
+        fail("timepagePublish", "did not publish once the page was released");
+    }
+
+    // ** timepageFresh **
+    // check that a page is trusted through its minute and briefly after, but not once it is stale
+    if (!timepageFresh(600, 600) || !timepageFresh(600, 659) || !timepageFresh(600, 660 + TIMEPAGE_GRACE - 1) ||
+        timepageFresh(600, 660 + TIMEPAGE_GRACE) || timepageFresh(600, 599)) {
+        failures++;
+        fail("timepageFresh", "trusted a stale page or distrusted a fresh one");
+    }
+
+    timepageUnmap(page);
+    timepageClose(&writer, true);
+
+    if (timepageOpen(PAGE_NAME) != NULL) {
+        failures++;
+        fail("timepageClose", "left the page behind");
+    }
+
+    return failures;
+}
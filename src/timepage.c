@@ -0,0 +1,287 @@
+// timepage.c
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "protocol.h"
+#include "timepage.h"
+#include "utils.h"
+
+/**
+ * Creates the shared memory object and maps it for writing, then builds
+ * and publishes the responses for the current minute. A fresh page
+ * replaces any page left behind, so a reader of the old one sees it go
+ * stale rather than change under it. A server taking over from an old one
+ * keeps the page it shares with it, unless it was laid out differently.
+ *
+ * @param writer The writer to initialise.
+ * @param name The name of the shared memory object, which starts with a slash.
+ * @param fresh If false, an existing page with the same layout is written to in place.
+ * */
+void timepageCreate(struct time_page_writer* writer, char* name, bool fresh)
+{
+    struct stat page_stat;
+    int fd;
+
+    memset(writer, 0, sizeof(struct time_page_writer));
+    writer->name = name;
+
+    if (fresh) {
+        shm_unlink(name);
+    }
+
+    // readers only need to read the page, which they cannot write to
+    fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+
+    if (fd < 0 || fstat(fd, &page_stat) < 0) {
+        error("could not create the time page", 2);
+    }
+
+    if (page_stat.st_size != 0 && page_stat.st_size != sizeof(struct time_page)) {
+        close(fd);
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    }
+
+    if (fd < 0 || ftruncate(fd, sizeof(struct time_page)) < 0) {
+        error("could not size the time page", 2);
+    }
+
+    writer->page = mmap(NULL, sizeof(struct time_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (writer->page == MAP_FAILED) {
+        error("could not map the time page", 2);
+    }
+
+    // an old server with another layout carries on with its own page, and this one starts a new one
+    if (writer->page->magic != 0 &&
+        (writer->page->magic != TIMEPAGE_MAGIC || writer->page->version != TIMEPAGE_VERSION)) {
+        munmap(writer->page, sizeof(struct time_page));
+        shm_unlink(name);
+        timepageCreate(writer, name, true);
+        return;
+    }
+
+    writer->page->magic = TIMEPAGE_MAGIC;
+    writer->page->version = TIMEPAGE_VERSION;
+
+    writer->cache = malloc(sizeof(struct response_cache));
+
+    if (writer->cache == NULL) {
+        error("could not allocate the time page cache", 3);
+    }
+
+    cacheInit(writer->cache);
+    timepagePublish(writer);
+}
+
+/**
+ * Starts the thread that publishes each minute.
+ *
+ * @param writer The writer to start.
+ * */
+void timepageStart(struct time_page_writer* writer)
+{
+    if (pthread_create(&writer->thread, NULL, runTimePage, writer) != 0) {
+        error("could not start the time page writer", 3);
+    }
+}
+
+/**
+ * Publishes each minute as soon as the cache timer rebuilds it.
+ *
+ * @param arg The writer.
+ * @return Never returns, the thread ends with the process.
+ * */
+void* runTimePage(void* arg)
+{
+    struct time_page_writer* writer = arg;
+    struct pollfd timer_poll = { .fd = writer->cache->timer_fd, .events = POLLIN };
+
+    while (true) {
+        if (poll(&timer_poll, 1, -1) < 0) {
+            continue;
+        }
+
+        cacheHandleTimer(writer->cache);
+        timepagePublish(writer);
+    }
+
+    return NULL;
+}
+
+/**
+ * Copies every cached response into the page under the seqlock. While an
+ * upgrade is under way the old and new servers share the page, so the
+ * sequence is taken with a compare and swap, and whichever server loses
+ * leaves the minute to the one that is already writing it.
+ *
+ * @param writer The writer.
+ * */
+void timepagePublish(struct time_page_writer* writer)
+{
+    struct time_page* page = writer->page;
+    uint32_t sequence = __atomic_load_n(&page->sequence, __ATOMIC_RELAXED);
+    struct timespec now;
+
+    if ((sequence & 1) || !__atomic_compare_exchange_n(&page->sequence, &sequence, sequence + 1,
+        false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    // mark the page as being rewritten before touching it
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    page->minute = now.tv_sec - now.tv_sec % 60;
+
+    for (uint16_t lang = 0; lang < CACHE_LANGS; lang++) {
+        for (uint16_t type = 0; type < CACHE_REQ_TYPES; type++) {
+
+            struct iovec segments[CACHE_SEGMENTS];
+            uint8_t* response = page->responses[lang][type];
+
+            page->lengths[lang][type] = cacheLookup(writer->cache, type + 1, lang + 1, segments);
+
+            memcpy(response, segments[0].iov_base, segments[0].iov_len);
+            memcpy(response + segments[0].iov_len, segments[1].iov_base, segments[1].iov_len);
+        }
+    }
+
+    page->published++;
+
+    __atomic_store_n(&page->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Unmaps the page and closes the cache timer, removing the shared memory
+ * object unless another server has taken it over.
+ *
+ * @param writer The writer.
+ * @param unlink If true, the shared memory object is removed.
+ * */
+void timepageClose(struct time_page_writer* writer, bool unlink)
+{
+    munmap(writer->page, sizeof(struct time_page));
+    cacheClose(writer->cache);
+
+    if (unlink) {
+        shm_unlink(writer->name);
+    }
+}
+
+/**
+ * Maps the time page of a server on the same host, read only.
+ *
+ * @param name The name the server was given for its time page.
+ * @return The page, or NULL if there is no page with that name or it has another layout.
+ * */
+const struct time_page* timepageOpen(char* name)
+{
+    struct time_page* page;
+    struct stat page_stat;
+    int fd = shm_open(name, O_RDONLY, 0);
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &page_stat) < 0 || page_stat.st_size != sizeof(struct time_page)) {
+        close(fd);
+        return NULL;
+    }
+
+    page = mmap(NULL, sizeof(struct time_page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (page == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (page->magic != TIMEPAGE_MAGIC || page->version != TIMEPAGE_VERSION) {
+        munmap(page, sizeof(struct time_page));
+        return NULL;
+    }
+
+    return page;
+}
+
+/**
+ * Copies a response out of the page. This takes no locks and makes no
+ * system calls, it retries the copy until the sequence shows that the
+ * writer did not change the page while it was being read.
+ *
+ * @param page The page.
+ * @param reqType The type of request, either REQ_DATE or REQ_TIME.
+ * @param langCode The language of the response.
+ * @param pkt Where the response is to be stored.
+ * @param n The size of pkt, which must be RES_PKT_LEN to hold any response.
+ * @param minute Where the start of the minute the response is for is to be stored.
+ * @return The length of the response, or 0 if there is none or the page never settled.
+ * */
+size_t timepageRead(const struct time_page* page, uint16_t reqType, uint16_t langCode, uint8_t pkt[], size_t n, time_t* minute)
+{
+    uint32_t before, after;
+    size_t length;
+
+    if (reqType < REQ_DATE || reqType > REQ_TIME || langCode < LANG_ENG || langCode > LANG_GER) {
+        return 0;
+    }
+
+    for (unsigned int attempt = 0; attempt < TIMEPAGE_RETRIES; attempt++) {
+
+        before = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+        length = page->lengths[langCode - 1][reqType - 1];
+
+        // a torn length must not send the copy out of bounds
+        if (length <= n && length <= RES_PKT_LEN) {
+            memcpy(pkt, page->responses[langCode - 1][reqType - 1], length);
+        }
+
+        *minute = page->minute;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&page->sequence, __ATOMIC_RELAXED);
+
+        if (before == after && !(before & 1)) {
+            return length <= n ? length : 0;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Checks that a response read from a page is for the current minute, or
+ * has only just been overtaken by it. A page that has gone stale was left
+ * behind by a server that has stopped.
+ *
+ * @param minute The minute returned by timepageRead().
+ * @param now The current time.
+ * @return True if the response can be trusted.
+ * */
+bool timepageFresh(time_t minute, time_t now)
+{
+    return now >= minute && now - minute < 60 + TIMEPAGE_GRACE;
+}
+
+/**
+ * Unmaps a page mapped by timepageOpen().
+ *
+ * @param page The page.
+ * */
+void timepageUnmap(const struct time_page* page)
+{
+    munmap((void*) page, sizeof(struct time_page));
+}
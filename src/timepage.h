@@ -0,0 +1,72 @@
+// timepage.h
+
+#ifndef TIMEPAGE_H
+#define TIMEPAGE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "cache.h"
+#include "protocol.h"
+
+// identifies a time page and the layout it was written with, "DTPG"
+#define TIMEPAGE_MAGIC 0x44545047
+#define TIMEPAGE_VERSION 1
+
+// how long after its minute ends a page is still trusted, in seconds,
+// which leaves the writer time to notice that the minute has changed
+#define TIMEPAGE_GRACE 5
+
+// the number of times a reader retries a copy that was torn by the writer
+#define TIMEPAGE_RETRIES 1000
+
+// Every response for the current minute, laid out in shared memory for
+// clients on the same host to copy without asking the server. The writer
+// makes the sequence odd while it changes the page and even once it is
+// done, so a reader that sees the same even sequence before and after its
+// copy knows that the copy is whole.
+struct time_page {
+    uint32_t magic;
+    uint32_t version;
+
+    // the seqlock sequence, and the start of the minute the page holds
+    uint32_t sequence __attribute__((aligned(64)));
+    int64_t minute;
+
+    // the number of minutes published
+    uint64_t published;
+
+    // each whole response, indexed by language code - 1 and request type - 1
+    uint8_t responses[CACHE_LANGS][CACHE_REQ_TYPES][RES_PKT_LEN];
+    uint16_t lengths[CACHE_LANGS][CACHE_REQ_TYPES];
+};
+
+// The server's side of a time page, kept up to date by a thread of its own
+struct time_page_writer {
+
+    // the name of the shared memory object, e.g. /dt-time
+    char* name;
+
+    struct time_page* page;
+
+    // the responses, rebuilt by the writer's own minute timer
+    struct response_cache* cache;
+
+    pthread_t thread;
+};
+
+void timepageCreate(struct time_page_writer* writer, char* name, bool fresh);
+void timepageStart(struct time_page_writer* writer);
+void* runTimePage(void* arg);
+void timepagePublish(struct time_page_writer* writer);
+void timepageClose(struct time_page_writer* writer, bool unlink);
+
+const struct time_page* timepageOpen(char* name);
+size_t timepageRead(const struct time_page* page, uint16_t reqType, uint16_t langCode, uint8_t pkt[], size_t n, time_t* minute);
+bool timepageFresh(time_t minute, time_t now);
+void timepageUnmap(const struct time_page* page);
+
+#endif
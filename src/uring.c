@@ -0,0 +1,355 @@
+// uring.c
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+/**
+ * Creates an io_uring instance and maps its queues. The system calls are
+ * made directly so that the server does not depend on liburing.
+ *
+ * @param ring The ring to initialise.
+ * @param entries The number of submission queue entries.
+ * @return True if the ring was created, otherwise errno says why not.
+ * */
+bool uringInit(struct uring* ring, unsigned int entries)
+{
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(struct uring));
+    memset(&params, 0, sizeof(params));
+
+    // the ring is only ever used by the thread that creates it, and the kernel
+    // flags when completions are waiting to be run rather than interrupting it
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG;
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+
+    // older kernels reject the flags, which are only hints
+    if (ring->fd < 0 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params));
+        ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    }
+
+    if (ring->fd < 0) {
+        return false;
+    }
+
+    ring->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // newer kernels map both queues at once
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_len > ring->sq_ring_len) {
+            ring->sq_ring_len = ring->cq_ring_len;
+        }
+        ring->cq_ring_len = 0;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        uringClose(ring);
+        return false;
+    }
+
+    if (ring->cq_ring_len == 0) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            uringClose(ring);
+            return false;
+        }
+    }
+
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        uringClose(ring);
+        return false;
+    }
+
+    ring->sq_head = (unsigned int*) ((uint8_t*) ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (unsigned int*) ((uint8_t*) ring->sq_ring + params.sq_off.tail);
+    ring->sq_array = (unsigned int*) ((uint8_t*) ring->sq_ring + params.sq_off.array);
+    ring->sq_flags = (unsigned int*) ((uint8_t*) ring->sq_ring + params.sq_off.flags);
+    ring->sq_mask = *(unsigned int*) ((uint8_t*) ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+
+    ring->cq_head = (unsigned int*) ((uint8_t*) ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned int*) ((uint8_t*) ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = *(unsigned int*) ((uint8_t*) ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) ((uint8_t*) ring->cq_ring + params.cq_off.cqes);
+
+    return true;
+}
+
+/**
+ * Asks the kernel whether it supports an operation.
+ *
+ * @param ring The ring.
+ * @param opcode The operation, one of the IORING_OP_ definitions.
+ * @return True if the operation is supported.
+ * */
+bool uringSupports(struct uring* ring, uint8_t opcode)
+{
+    // the probe is followed by an entry for every possible operation
+    size_t length = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, length);
+    bool supported;
+
+    if (probe == NULL) {
+        return false;
+    }
+
+    supported = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+        opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+
+    free(probe);
+
+    return supported;
+}
+
+/**
+ * Registers receive buffers with the kernel as a provided buffer ring, so
+ * that a multishot receive can pick a buffer for each datagram as it
+ * arrives. The buffer ids are the indices into the buffers array.
+ *
+ * @param ring The ring.
+ * @param buffers The buffers, which must outlive the ring.
+ * @param count The number of buffers, a power of two.
+ * @param length The length of each buffer.
+ * @param group The buffer group the receives will select from.
+ * @return True if the buffers were registered, otherwise errno says why not.
+ * */
+bool uringInitBuffers(struct uring* ring, uint8_t* buffers[], unsigned int count, size_t length, uint16_t group)
+{
+    struct io_uring_buf_reg reg;
+
+    ring->buf_ring_len = count * sizeof(struct io_uring_buf);
+    ring->buffer_len = length;
+    ring->buffer_count = count;
+    ring->buffers = calloc(count, sizeof(uint8_t*));
+
+    if (ring->buffers == NULL) {
+        return false;
+    }
+
+    memcpy(ring->buffers, buffers, count * sizeof(uint8_t*));
+
+    // the ring must be page aligned, which an anonymous mapping always is
+    ring->buf_ring = mmap(NULL, ring->buf_ring_len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+
+    if (ring->buf_ring == MAP_FAILED) {
+        ring->buf_ring = NULL;
+        return false;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) ring->buf_ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return false;
+    }
+
+    // hand every buffer to the kernel
+    for (unsigned int id = 0; id < count; id++) {
+        uringRecycleBuffer(ring, id);
+    }
+
+    return true;
+}
+
+/**
+ * Returns a buffer from the provided buffer ring.
+ *
+ * @param ring The ring.
+ * @param id The buffer id given in a completion.
+ * @return The buffer.
+ * */
+uint8_t* uringBuffer(struct uring* ring, uint16_t id)
+{
+    return ring->buffers[id];
+}
+
+/**
+ * Gives a buffer back to the kernel once its contents are no longer needed.
+ *
+ * @param ring The ring.
+ * @param id The buffer id given in a completion.
+ * */
+void uringRecycleBuffer(struct uring* ring, uint16_t id)
+{
+    // only this thread moves the tail, the kernel moves the head
+    uint16_t tail = ring->buf_ring->tail;
+    struct io_uring_buf* buf = &ring->buf_ring->bufs[tail & (ring->buffer_count - 1)];
+
+    buf->addr = (uint64_t) (uintptr_t) uringBuffer(ring, id);
+    buf->len = ring->buffer_len;
+    buf->bid = id;
+
+    // the buffer must be filled in before the kernel can see it
+    __atomic_store_n(&ring->buf_ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Returns the next free submission queue entry, cleared, or NULL if the
+ * queue is full and must be submitted first.
+ *
+ * @param ring The ring.
+ * @return The entry.
+ * */
+struct io_uring_sqe* uringGetSqe(struct uring* ring)
+{
+    unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned int index;
+    struct io_uring_sqe* sqe;
+
+    if (ring->sq_local_tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+
+    index = ring->sq_local_tail & ring->sq_mask;
+    sqe = &ring->sqes[index];
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    return sqe;
+}
+
+/**
+ * Publishes the queued entries to the kernel and optionally waits for
+ * completions.
+ *
+ * @param ring The ring.
+ * @param wait The number of completions to wait for, 0 to return at once.
+ * @return The number of entries submitted, or -1 on error.
+ * */
+int uringSubmit(struct uring* ring, unsigned int wait)
+{
+    unsigned int pending = ring->sq_local_tail - *ring->sq_tail;
+
+    // the entries must be written before the kernel can see the new tail
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    if (pending == 0 && wait == 0) {
+        return 0;
+    }
+
+    return syscall(__NR_io_uring_enter, ring->fd, pending, wait,
+        wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+/**
+ * Returns the position of the oldest unread completion.
+ *
+ * @param ring The ring.
+ * @return The head of the completion queue.
+ * */
+unsigned int uringCqHead(struct uring* ring)
+{
+    return *ring->cq_head;
+}
+
+/**
+ * Returns the number of completions waiting to be read. The kernel is only
+ * entered if it has flagged work that must run before its completions can
+ * be posted, so this is cheap enough to spin on.
+ *
+ * @param ring The ring.
+ * @return The number of completions.
+ * */
+unsigned int uringPeek(struct uring* ring)
+{
+    if (__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_TASKRUN) {
+        syscall(__NR_io_uring_enter, ring->fd, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+
+    return __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) - *ring->cq_head;
+}
+
+/**
+ * Returns the completion at a position and moves past it, or NULL if
+ * there are no more completions. The completions are not released to
+ * the kernel until uringAdvance() is called.
+ *
+ * @param ring The ring.
+ * @param head The position, from uringCqHead() or a previous call.
+ * @return The completion.
+ * */
+struct io_uring_cqe* uringNextCqe(struct uring* ring, unsigned int* head)
+{
+    // the completion must be read after the kernel has published it
+    if (*head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    return &ring->cqes[(*head)++ & ring->cq_mask];
+}
+
+/**
+ * Releases the completions that have been read back to the kernel.
+ *
+ * @param ring The ring.
+ * @param head The position just after the last completion read.
+ * */
+void uringAdvance(struct uring* ring, unsigned int head)
+{
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * Unmaps the queues and the buffer ring and closes the ring. The buffers
+ * themselves are left to their owner.
+ *
+ * @param ring The ring.
+ * */
+void uringClose(struct uring* ring)
+{
+    free(ring->buffers);
+
+    if (ring->buf_ring != NULL) {
+        munmap(ring->buf_ring, ring->buf_ring_len);
+    }
+
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+
+    if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_len);
+    }
+
+    if (ring->sq_ring != NULL) {
+        munmap(ring->sq_ring, ring->sq_ring_len);
+    }
+
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+
+    memset(ring, 0, sizeof(struct uring));
+    ring->fd = -1;
+}
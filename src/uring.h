@@ -0,0 +1,69 @@
+// uring.h
+
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// the number of submission queue entries in each ring
+#define URING_ENTRIES 1024
+
+// the number of buffers in the provided buffer ring, a power of two
+#define URING_BUFFERS 512
+
+// the buffer group the receives select their buffers from
+#define URING_BUFFER_GROUP 0
+
+// An io_uring instance driven with the raw system calls
+struct uring {
+    int fd;
+
+    // the submission queue, sq_tail is only published by uringSubmit()
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_array;
+    unsigned int* sq_flags;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    unsigned int sq_local_tail;
+    struct io_uring_sqe* sqes;
+
+    // the completion queue
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe* cqes;
+
+    // the mapped regions, kept so that they can be unmapped
+    void* sq_ring;
+    size_t sq_ring_len;
+    void* cq_ring;
+    size_t cq_ring_len;
+    size_t sqes_len;
+
+    // the buffers the kernel picks from when a receive completes, indexed
+    // by buffer id, which belong to the caller
+    struct io_uring_buf_ring* buf_ring;
+    size_t buf_ring_len;
+    uint8_t** buffers;
+    size_t buffer_len;
+    unsigned int buffer_count;
+};
+
+bool uringInit(struct uring* ring, unsigned int entries);
+bool uringSupports(struct uring* ring, uint8_t opcode);
+bool uringInitBuffers(struct uring* ring, uint8_t* buffers[], unsigned int count, size_t length, uint16_t group);
+uint8_t* uringBuffer(struct uring* ring, uint16_t id);
+void uringRecycleBuffer(struct uring* ring, uint16_t id);
+struct io_uring_sqe* uringGetSqe(struct uring* ring);
+int uringSubmit(struct uring* ring, unsigned int wait);
+unsigned int uringCqHead(struct uring* ring);
+unsigned int uringPeek(struct uring* ring);
+struct io_uring_cqe* uringNextCqe(struct uring* ring, unsigned int* head);
+void uringAdvance(struct uring* ring, unsigned int head);
+void uringClose(struct uring* ring);
+
+#endif
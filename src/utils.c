@@ -5,6 +5,8 @@
 #include <string.h>
 #include <time.h>
 
+#include "clock.h"
+
 /**
  * Prints an error message.
  * 
@@ -35,34 +37,15 @@ void error(char message[], int code)
 void printCurrentDateTimeString()
 {
     // used to store the time
-    time_t rawtime;
-    struct tm* info;
+    struct tm info;
 
     // used to store the string
     char str[32] = {0};
     
-    // get the local time
-    time(&rawtime);
-    info = localtime(&rawtime);
+    // get the local time from the cached clock
+    clockNow(&info);
 
     // format and print the date time string
-    strftime(str, 32, "%F %H:%M:%S", info);
+    strftime(str, 32, "%F %H:%M:%S", &info);
     printf("%s", str);
 }
-
-/**
- * Returns the largest value in the array.
- * 
- * @param nums The array to iterate through.
- * @param n The length of the array
- * */
-int max(int nums[], int n)
-{
-    int largest;
-    for (int i = 0; i < n; i++) {
-        if (i == 0 || nums[i] > largest) {
-            largest = nums[i];
-        }
-    }
-    return largest;
-}
\ No newline at end of file
@@ -4,8 +4,7 @@
 #define UTILS_H
 
 void fail(char funcname[], char condition[]);
-void error(char message[], int code);
+void error(char message[], int code) __attribute__((noreturn));
 void printCurrentDateTimeString();
-int max(int nums[], int n);
 
 #endif